@@ -0,0 +1,79 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "my_aio.h"
+#include "my_threadpool.h"
+#include "my_stats.h"
+
+threadpool<my_aio::prefetch_awaiter>* my_aio::m_pool = NULL;
+
+void my_aio::start(int threads)
+{
+    if (threads > 0)
+        m_pool = new threadpool<prefetch_awaiter>(threads);
+}
+
+bool my_aio::resident(const void* addr, size_t len)
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);            // mincore要求按页对齐
+    size_t pages = ((uintptr_t)addr + len - start + page - 1) / page;
+    unsigned char vec[256];
+    while (pages > 0)
+    {
+        size_t n = pages < sizeof(vec) ? pages : sizeof(vec);
+        if (mincore((void*)start, n * page, vec) < 0)
+            return true;                // 无法判断时按已在内存中处理，退回到直接发送
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!(vec[i] & 1))
+                return false;
+        }
+        start += n * page;
+        pages -= n;
+    }
+    return true;
+}
+
+bool my_aio::prefetch_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    m_handle = h;
+    m_suspended = true;
+    if (m_pool->append(this))
+    {
+        my_stats::add(my_stats::AIO_PREFETCH);
+        return true;
+    }
+    m_suspended = false;                // 队列已满，在当前线程上直接发送
+    return false;
+}
+
+void my_aio::prefetch_awaiter::process()
+{
+    static thread_local char* scratch = new char[SCRATCH_SIZE];
+    if (m_fd != -1)
+    {
+        /** 一次为整个范围发起预读，再读一遍等待数据真正进入页缓存；顺便为下一个窗口发起预读 **/
+        posix_fadvise(m_fd, m_offset, m_len + WINDOW, POSIX_FADV_WILLNEED);
+        off_t offset = m_offset;
+        size_t left = m_len;
+        while (left > 0)
+        {
+            ssize_t n = pread(m_fd, scratch, left < SCRATCH_SIZE ? left : SCRATCH_SIZE, offset);
+            if (n <= 0)                 // 文件被截断或者出错，由之后的sendfile报告
+                break;
+            offset += n;
+            left -= n;
+        }
+    }
+    else
+    {
+        /** 资源包不会被原地修改，可以直接访问映射的页 **/
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)m_addr & ~(page - 1);
+        madvise((void*)start, (uintptr_t)m_addr + m_len - start, MADV_WILLNEED);
+        for (uintptr_t p = start; p < (uintptr_t)m_addr + m_len; p += page)
+            (void)*(volatile const char*)p;
+    }
+    m_sock->rearm(m_handle, EPOLLOUT);  // 数据已经就绪，之后协程由事件循环恢复，不能再访问this
+}
@@ -0,0 +1,62 @@
+#ifndef _MY_AIO_H_
+#define _MY_AIO_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "my_coroutine.h"
+#include "my_socket.h"
+
+template <typename T>
+class threadpool;
+
+/*
+*   异步文件I/O：发送应答体之前用mincore检查要发送的范围是否都在页缓存中，
+*   不在时把连接协程挂起，交给专门的I/O线程池用posix_fadvise发起预读并等待数据读入，
+*   数据就绪后I/O线程为socket重新注册EPOLLOUT，由事件循环恢复协程继续发送。
+*   这样sendfile/writev在事件循环线程上只会碰到已经在内存中的页，不会因为缺页等待磁盘
+*/
+
+class my_aio
+{
+public:
+    /** 每次检查与预读的范围，sendfile按这个大小分段发送 **/
+    static const size_t WINDOW = 1 << 20;
+    /** I/O线程等待数据读入时使用的缓冲区大小 **/
+    static const size_t SCRATCH_SIZE = 128 << 10;
+
+    /** 启动I/O线程池，threads为0时不启用，所有的I/O都在连接协程当前的线程上进行 **/
+    static void start(int threads);
+    static bool enabled() { return m_pool != NULL; }
+    /** 映射内存[addr, addr+len)对应的页是否都在页缓存中 **/
+    static bool resident(const void* addr, size_t len);
+
+    /** 等待[addr, addr+len)的数据进入页缓存，失败或挂断时返回false **/
+    struct prefetch_awaiter
+    {
+        my_socket*              m_sock;
+        /** 文件的fd与偏移；fd为-1表示只有映射（资源包），通过访问映射的页读入 **/
+        int                     m_fd;
+        off_t                   m_offset;
+        /** 文件在内存中的映射，用于mincore检查 **/
+        const char*             m_addr;
+        size_t                  m_len;
+        std::coroutine_handle<> m_handle;
+        bool                    m_suspended;
+
+        bool await_ready() { return !m_pool || !m_addr || resident(m_addr, m_len); }
+        bool await_suspend(std::coroutine_handle<> h);
+        bool await_resume() { return !m_suspended || m_sock->ok(); }
+
+        /** 由I/O线程调用：读入数据，然后让事件循环恢复协程 **/
+        void process();
+    };
+    static prefetch_awaiter prefetch(my_socket* sock, int fd, off_t offset, const void* addr, size_t len)
+    {
+        return prefetch_awaiter{sock, fd, offset, (const char*)addr, len, nullptr, false};
+    }
+
+private:
+    static threadpool<prefetch_awaiter>*    m_pool;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include "my_cache.h"
+#include "my_aio.h"
+
+my_cache::my_cache(size_t capacity) : m_capacity(capacity), m_head(NULL), m_tail(NULL), m_sizes()
+{
+}
+
+my_cache::~my_cache()
+{
+    while (m_head)
+        remove(m_head);
+}
+
+void my_cache::unlink(entry* e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        m_head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        m_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+void my_cache::push_front(entry* e)
+{
+    e->prev = NULL;
+    e->next = m_head;
+    if (m_head)
+        m_head->prev = e;
+    m_head = e;
+    if (!m_tail)
+        m_tail = e;
+}
+
+void my_cache::put(entry* e)
+{
+    if (--e->refs == 0)
+    {
+        if (e->map)
+            munmap((void*)e->map, e->st.st_size);
+        close(e->fd);
+        delete e;
+    }
+}
+
+void my_cache::remove(entry* e)
+{
+    m_entries.erase(std::string_view(e->url));
+    unlink(e);
+    put(e);                             // 正在被发送的表项要等请求释放之后才关闭
+}
+
+my_cache::entry* my_cache::lookup(std::string_view url, bool nonblocking)
+{
+    m_locker.lock();
+    std::unordered_map<std::string_view, entry*>::iterator it = m_entries.find(url);
+    if (it == m_entries.end())
+    {
+        m_locker.unlock();
+        return NULL;
+    }
+    entry* e = it->second;
+
+    time_t now = time(NULL);
+    if (now - e->checked >= CHECK_INTERVAL)
+    {
+        if (nonblocking)
+        {
+            m_locker.unlock();
+            return NULL;
+        }
+        /** 文件可能已经被替换或者修改，与打开时的stat比较 **/
+        struct stat st;
+        if (stat(e->path.c_str(), &st) < 0 || st.st_ino != e->st.st_ino || st.st_dev != e->st.st_dev ||
+            st.st_size != e->st.st_size || st.st_mtim.tv_sec != e->st.st_mtim.tv_sec ||
+            st.st_mtim.tv_nsec != e->st.st_mtim.tv_nsec || st.st_mode != e->st.st_mode)
+        {
+            remove(e);
+            m_locker.unlock();
+            return NULL;
+        }
+        e->checked = now;
+    }
+
+    unlink(e);
+    push_front(e);
+    e->refs++;
+    m_locker.unlock();
+    return e;
+}
+
+my_cache::entry* my_cache::insert(std::string_view url, const char* path, int fd, const struct stat& st)
+{
+    entry* e = new entry;
+    e->url.assign(url);
+    e->path = path;
+    e->fd = fd;
+    e->st = st;
+    e->map = NULL;
+    if (my_aio::enabled() && st.st_size > 0)
+    {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            e->map = (const char*)map;
+    }
+    e->checked = time(NULL);
+    e->refs = 1;
+    e->prev = e->next = NULL;
+
+    size_t hash = std::hash<std::string_view>()(url);
+    m_locker.lock();
+    m_sizes[hash % SIZE_HINTS].hash = hash;
+    m_sizes[hash % SIZE_HINTS].size = st.st_size;
+    if (m_capacity == 0)
+    {
+        m_locker.unlock();
+        return e;
+    }
+    std::unordered_map<std::string_view, entry*>::iterator it = m_entries.find(url);
+    if (it != m_entries.end())          // 别的线程同时打开了同一个文件，用新的替换它
+        remove(it->second);
+    while (m_entries.size() >= m_capacity && m_tail)
+        remove(m_tail);                 // 淘汰最久没有使用的
+    e->refs++;
+    m_entries[std::string_view(e->url)] = e;
+    push_front(e);
+    m_locker.unlock();
+    return e;
+}
+
+void my_cache::release(entry* e)
+{
+    m_locker.lock();
+    put(e);
+    m_locker.unlock();
+}
+
+void my_cache::invalidate(std::string_view url)
+{
+    m_locker.lock();
+    std::unordered_map<std::string_view, entry*>::iterator it = m_entries.find(url);
+    if (it != m_entries.end())
+        remove(it->second);
+    m_locker.unlock();
+}
+
+off_t my_cache::size_hint(std::string_view url)
+{
+    size_t hash = std::hash<std::string_view>()(url);
+    m_locker.lock();
+    const size_hint_slot& slot = m_sizes[hash % SIZE_HINTS];
+    off_t size = (slot.hash == hash) ? slot.size : -1;
+    m_locker.unlock();
+    return size;
+}
@@ -0,0 +1,86 @@
+#ifndef _MY_CACHE_H_
+#define _MY_CACHE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "my_locker.h"
+
+/*
+*   打开文件的缓存：url -> 已打开的fd与stat结果，按LRU淘汰
+*   命中时不再有stat/open系统调用；表项超过CHECK_INTERVAL秒后重新stat一次，文件被替换时丢弃旧的表项。
+*   表项有引用计数，正在发送的请求持有引用，被淘汰的表项在最后一个引用释放时才关闭fd。
+*   每个虚拟主机一个缓存，各自的容量互不影响
+*/
+
+class my_cache
+{
+public:
+    /** 重新检查文件是否被修改的间隔(秒) **/
+    static const int CHECK_INTERVAL = 1;
+
+    struct entry
+    {
+        std::string     url;
+        /** 文件的完整路径，重新检查时使用 **/
+        std::string     path;
+        int             fd;
+        struct stat     st;
+        /** 文件的只读映射，只用于mincore检查数据是否在页缓存中，不通过它读文件；可能为NULL **/
+        const char*     map;
+        time_t          checked;
+        /** 引用计数，缓存本身也算一个 **/
+        int             refs;
+        /** LRU链表，表头是最近使用的 **/
+        entry*          prev;
+        entry*          next;
+    };
+
+public:
+    explicit my_cache(size_t capacity);
+    ~my_cache();
+
+    void set_capacity(size_t capacity) { m_capacity = capacity; }
+    size_t capacity() const { return m_capacity; }
+
+    /** 查找url，命中时增加引用计数并返回，没有命中或者文件已被修改时返回NULL；
+        nonblocking为true时不做重新stat，表项需要重新检查时也返回NULL，由调用者到线程池里再查 **/
+    entry* lookup(std::string_view url, bool nonblocking = false);
+    /** 放入一个刚打开的文件，返回持有一个引用的表项；容量为0时表项不进入缓存，释放时关闭fd **/
+    entry* insert(std::string_view url, const char* path, int fd, const struct stat& st);
+    void release(entry* e);
+    /** 丢弃url的表项，文件被上传覆盖时调用 **/
+    void invalidate(std::string_view url);
+    /** 最近打开过的url的文件大小，表项被淘汰之后通常还记得，只用于给请求分类；不知道时返回-1 **/
+    off_t size_hint(std::string_view url);
+
+private:
+    void unlink(entry* e);
+    void push_front(entry* e);
+    /** 从缓存中移除并放弃缓存自己的引用，需要持有m_locker **/
+    void remove(entry* e);
+    void put(entry* e);
+
+private:
+    /** 文件大小的记录按url的哈希值直接映射，冲突时覆盖，不参与LRU **/
+    static const size_t SIZE_HINTS = 1024;
+    struct size_hint_slot
+    {
+        size_t      hash;
+        off_t       size;
+    };
+
+    size_t                                      m_capacity;
+    /** 键指向表项自己的url，查找时不需要构造string **/
+    std::unordered_map<std::string_view, entry*> m_entries;
+    entry*                                      m_head;
+    entry*                                      m_tail;
+    size_hint_slot                              m_sizes[SIZE_HINTS];
+    /** 每个虚拟主机一把锁，不同站点的请求不会互相竞争 **/
+    mutex_locker                                m_locker;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "my_capture.h"
+#include "my_trace.h"
+
+int my_capture::m_fd = -1;
+long long my_capture::m_max = 0;
+long long my_capture::m_written = 0;
+std::atomic<bool> my_capture::m_full(false);
+uint64_t my_capture::m_start = 0;
+std::atomic<uint32_t> my_capture::m_next_conn(1);
+mutex_locker my_capture::m_lock;
+char* my_capture::m_buf = NULL;
+size_t my_capture::m_len = 0;
+my_timer::entry my_capture::m_timer;
+
+bool my_capture::open(const char* path, long long max)
+{
+    m_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (m_fd < 0)
+    {
+        printf("capture: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    m_buf = new char[BUFFER_SIZE];
+    m_max = max;
+    m_start = my_trace::now();
+
+    capture_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.record_size = sizeof(capture_record);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    memcpy(m_buf, &header, sizeof(header));
+    m_len = sizeof(header);
+
+    m_timer.fn = on_tick;
+    my_timer::add(&m_timer, 1);
+    return true;
+}
+
+uint32_t my_capture::open_conn()
+{
+    if (!enabled())
+        return 0;
+    uint32_t conn = m_next_conn.fetch_add(1, std::memory_order_relaxed);
+    record(conn, OPEN);
+    return conn;
+}
+
+void my_capture::record(uint32_t conn, TYPE type, const char* data, uint32_t len, uint32_t answered, uint16_t flags)
+{
+    if (conn == 0 || m_full.load(std::memory_order_relaxed))
+        return;
+    capture_record r;
+    r.time = my_trace::now() - m_start;
+    r.conn = conn;
+    r.len = len;
+    r.answered = answered;
+    r.type = type;
+    r.flags = flags;
+
+    m_lock.lock();
+    if (m_len + sizeof(r) + len > BUFFER_SIZE)
+        flush_locked();
+    if (m_len + sizeof(r) + len <= BUFFER_SIZE)     // 比缓冲区还大的数据不会出现，读缓冲区远小于它
+    {
+        memcpy(m_buf + m_len, &r, sizeof(r));
+        if (len > 0)
+            memcpy(m_buf + m_len + sizeof(r), data, len);
+        m_len += sizeof(r) + len;
+    }
+    m_lock.unlock();
+}
+
+void my_capture::flush_locked()
+{
+    if (m_len == 0 || m_full.load(std::memory_order_relaxed))
+        return;
+    /** 写进页缓存，一般不会阻塞；达到上限时整个缓冲区丢弃，文件里不留下半条记录 **/
+    if (m_written + (long long)m_len > m_max)
+    {
+        m_full.store(true, std::memory_order_relaxed);
+        printf("capture: reached %lld bytes, stopped\n", m_written);
+        m_len = 0;
+        return;
+    }
+    size_t done = 0;
+    while (done < m_len)
+    {
+        ssize_t n = write(m_fd, m_buf + done, m_len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            printf("capture: write failed: %s, stopped\n", strerror(errno));
+            m_full.store(true, std::memory_order_relaxed);
+            break;
+        }
+        done += n;
+    }
+    m_written += done;
+    m_len = 0;
+}
+
+void my_capture::flush()
+{
+    if (m_fd == -1)
+        return;
+    m_lock.lock();
+    flush_locked();
+    m_lock.unlock();
+}
+
+void my_capture::on_tick(void* arg)
+{
+    flush();
+    if (!m_full.load(std::memory_order_relaxed))
+        my_timer::add(&m_timer, 1);
+}
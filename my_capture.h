@@ -0,0 +1,89 @@
+#ifndef _MY_CAPTURE_H_
+#define _MY_CAPTURE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include "my_locker.h"
+#include "my_timer.h"
+
+/*
+*   流量录制：--capture FILE 时把每个连接上读到的请求原始字节连同到达时间写进一个二进制文件，
+*   tools/my_replay 按原来的时间、并发与流水线把这些会话重新发给服务器，离线比较两个版本在真实请求组合下的延迟。
+*   录制的是my_httpconn读到的明文（TLS连接上已经解密），回放时发往明文的监听地址。
+*   每条数据记下它依赖前面几个应答：每个应答开始发的时候看一眼socket，里面还没有数据，之后到的数据就当作
+*   客户端看到这个应答之后才发的；已经有数据，说明客户端没有等这个应答（流水线）。
+*   回放时数据要到了时间、并且收齐了它依赖的应答才发，连接上的请求应答顺序与流水线都和录制时一样。
+*   转入HTTP/2、WebSocket、SSE订阅或者流式上传的连接，请求体不经过这里，标记为放弃，回放时跳过。
+*   记录先放进缓冲区，满了或者每个时间轮tick写一次文件；文件达到 --capture-max 后停止录制
+*/
+
+/** 录制文件的格式，服务器与回放工具共用，所有整数为本机字节序 **/
+struct capture_header
+{
+    char        magic[8];
+    uint32_t    version;
+    /** capture_record的大小，格式扩展时用来检查 **/
+    uint32_t    record_size;
+    /** 开始录制时的CLOCK_REALTIME（纳秒），只用于显示 **/
+    uint64_t    start;
+    uint64_t    reserved;
+};
+
+/** 文件头之后是一串记录，DATA记录后面紧跟len字节的数据 **/
+struct capture_record
+{
+    /** 从开始录制经过的纳秒数 **/
+    uint64_t    time;
+    /** 连接的编号，录制期间不重复 **/
+    uint32_t    conn;
+    uint32_t    len;
+    /** DATA：这批数据依赖的应答数，回放时收齐这么多应答才发 **/
+    uint32_t    answered;
+    uint16_t    type;
+    uint16_t    flags;
+};
+
+class my_capture
+{
+public:
+    static constexpr char MAGIC[8] = { 'M', 'Y', 'C', 'A', 'P', 'T', '\0', '\0' };
+    static const uint32_t VERSION = 1;
+
+    enum TYPE { OPEN = 0,           // accept了一个连接
+                DATA,               // 读到一批请求数据
+                CLOSE,              // 连接关闭
+                ABANDON             // 连接离开了HTTP/1.1请求应答的路径，回放时跳过
+              };
+    /** 创建录制文件，文件达到max字节后停止录制，失败返回false；要在my_timer::start之后调用 **/
+    static bool open(const char* path, long long max);
+    static bool enabled() { return m_fd != -1 && !m_full.load(std::memory_order_relaxed); }
+    /** 为新连接分配编号并记一条OPEN，没有录制时返回0 **/
+    static uint32_t open_conn();
+    /** 记一条记录，conn为0时什么也不做，可以在任意线程上调用 **/
+    static void record(uint32_t conn, TYPE type, const char* data = NULL, uint32_t len = 0,
+                       uint32_t answered = 0, uint16_t flags = 0);
+    /** 把缓冲区写进文件，退出之前调用；平时由时间轮每个tick调用 **/
+    static void flush();
+
+private:
+    static void flush_locked();
+    static void on_tick(void* arg);
+
+private:
+    /** 缓冲区写满后才写文件，写文件时持有锁，别的线程的记录要等它写完 **/
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    static int                      m_fd;
+    static long long                m_max;
+    static long long                m_written;
+    /** 文件达到上限，不再录制 **/
+    static std::atomic<bool>        m_full;
+    static uint64_t                 m_start;
+    static std::atomic<uint32_t>    m_next_conn;
+    static mutex_locker             m_lock;
+    static char*                    m_buf;
+    static size_t                   m_len;
+    static my_timer::entry          m_timer;
+};
+
+#endif
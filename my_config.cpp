@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "my_config.h"
+#include "my_proxy.h"
+#include "my_pack.h"
+#include "my_vhost.h"
+#include "my_ratelimit.h"
+#include "my_listener.h"
+#include "my_trace.h"
+
+extern const char* doc_root;
+
+long long my_config::m_max_upload = 64LL << 20;          // 默认64M
+const char* my_config::m_upload_paths[my_config::MAX_UPLOAD_PATHS];
+int my_config::m_upload_path_count = 0;
+int my_config::m_io_threads = 4;
+bool my_config::m_dispatch_hybrid = true;
+int my_config::m_pool_threads = 8;
+int my_config::m_pool_reserved = 0;
+int my_config::m_pool_weight = 4;
+long long my_config::m_bulk_size = 1LL << 20;           // 默认1M
+const char* my_config::m_bulk_paths[my_config::MAX_BULK_PATHS];
+int my_config::m_bulk_path_count = 0;
+const char* my_config::m_stats_url = NULL;
+const char* my_config::m_trace_url = NULL;
+const char* my_config::m_capture_file = NULL;
+long long my_config::m_capture_max = 1LL << 30;         // 默认1G
+int my_config::m_busy_poll = 0;
+const char* my_config::m_websocket_url = NULL;
+int my_config::m_ws_ping = 30;
+const char* my_config::m_sse_url = NULL;
+long long my_config::m_sse_max_queue = 256LL << 10;     // 默认256K
+int my_config::m_tls_port = 0;
+const char* my_config::m_upgrade_socket = NULL;
+int my_config::m_drain_timeout = 30;
+const char* my_config::m_tls_cert = NULL;
+const char* my_config::m_tls_key = NULL;
+
+void my_config::usage(const char* prog)
+{
+    printf("usage: %s [options] [ip_address port_number]\n", prog);
+    printf("  --listen [tls:]ADDR    also listen on ADDR: host:port, [v6]:port ([::] accepts IPv4 too) or unix:/path (repeatable)\n");
+    printf("  --upload-path PREFIX   accept PUT/POST uploads under PREFIX, uploads are off without it (repeatable)\n");
+    printf("  --max-upload SIZE      max PUT/POST body size, K/M/G suffix allowed (default 64M)\n");
+    printf("  --proxy PREFIX=ADDR[,ADDR...]\n");
+    printf("                         forward PREFIX to upstreams, ADDR is host:port or unix:/path (repeatable)\n");
+    printf("  --root DIR             document root of the default site (default /var/www/html)\n");
+    printf("  --vhost HOST=DIR[,N]   serve Host HOST from DIR, caching up to N open files (repeatable)\n");
+    printf("  --cache-entries N      open files cached for the default site (default 256)\n");
+    printf("  --io-threads N         threads that read cold files into the page cache, 0 disables (default 4)\n");
+    printf("  --dispatch MODE        hybrid: finish cheap requests on the event loop (default), pool: hand every request to the pool\n");
+    printf("  --pool-threads N       threads in the request pool (default 8)\n");
+    printf("  --pool-reserved N      pool threads that only serve small requests, fewer than --pool-threads (default 0)\n");
+    printf("  --pool-weight N        take N small requests for each large one when both are queued (default 4)\n");
+    printf("  --bulk-size SIZE       queue requests for files of at least SIZE as large (default 1M)\n");
+    printf("  --bulk-path PREFIX     queue requests under PREFIX as large (repeatable)\n");
+    printf("  --busy-poll USEC       spin on epoll_wait for USEC microseconds before blocking, and busy poll sockets\n");
+    printf("  --rate-limit RATE[,BURST]\n");
+    printf("                         allow each client IP RATE requests per second, bursts up to BURST\n");
+    printf("  --rate-limit-path PREFIX=RATE[,BURST]\n");
+    printf("                         per client IP limit for paths under PREFIX (repeatable)\n");
+    printf("  --rate-limit-v6-prefix BITS\n");
+    printf("                         count IPv6 clients by their first BITS bits (default 64), IPv4 clients by full address\n");
+    printf("  --stats-url PATH       serve runtime counters as text at PATH\n");
+    printf("  --trace N              record the stages of 1 in N requests, SIGUSR1 dumps them as Chrome trace JSON\n");
+    printf("  --trace-url PATH       serve the recorded stages as Chrome trace JSON at PATH\n");
+    printf("  --capture FILE         record the raw request bytes and their timing per connection, for tools/my_replay\n");
+    printf("  --capture-max SIZE     stop recording when the capture file reaches SIZE (default 1G)\n");
+    printf("  --websocket PATH       accept WebSocket upgrades at PATH, messages are echoed back\n");
+    printf("  --ws-ping SEC          ping WebSocket clients idle for SEC seconds, close them if still silent (default 30, 0 disables)\n");
+    printf("  --sse PATH             Server-Sent Events at PATH: GET subscribes, POST broadcasts the body (?event=NAME)\n");
+    printf("  --sse-max-queue SIZE   drop SSE subscribers with more than SIZE bytes queued (default 256K)\n");
+    printf("  --tls-port PORT        also accept TLS connections on PORT (needs a build with -DMY_TLS)\n");
+    printf("  --cert FILE            PEM certificate chain for --tls-port and tls: listeners\n");
+    printf("  --key FILE             PEM private key for --tls-port and tls: listeners\n");
+    printf("  --upgrade-socket PATH  hot restart: take over the listening sockets of the server on PATH, then wait on PATH for the next upgrade\n");
+    printf("  --drain-timeout SEC    after handing the sockets over, wait at most SEC seconds for connections to finish (default 30)\n");
+    printf("  --pack FILE            serve assets from a pack built by my_packer, SIGHUP reloads it\n");
+}
+
+long long my_config::parse_size(const char* text)
+{
+    char* end = NULL;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || value < 0)
+        return -1;
+    switch (*end)
+    {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? value : -1;
+}
+
+bool my_config::parse(int argc, char* argv[])
+{
+    static const struct option options[] =
+    {
+        { "max-upload", required_argument, NULL, 'u' },
+        { "upload-path", required_argument, NULL, 'H' },
+        { "listen",     required_argument, NULL, 'a' },
+        { "proxy",      required_argument, NULL, 'p' },
+        { "pack",       required_argument, NULL, 'k' },
+        { "root",       required_argument, NULL, 'r' },
+        { "vhost",      required_argument, NULL, 'v' },
+        { "cache-entries", required_argument, NULL, 'c' },
+        { "io-threads", required_argument, NULL, 'i' },
+        { "dispatch",   required_argument, NULL, 'd' },
+        { "stats-url",  required_argument, NULL, 's' },
+        { "trace",      required_argument, NULL, 'T' },
+        { "trace-url",  required_argument, NULL, 'D' },
+        { "capture",    required_argument, NULL, 'X' },
+        { "capture-max", required_argument, NULL, 'M' },
+        { "pool-threads", required_argument, NULL, 'n' },
+        { "pool-reserved", required_argument, NULL, 'R' },
+        { "pool-weight", required_argument, NULL, 'W' },
+        { "bulk-size",  required_argument, NULL, 'B' },
+        { "bulk-path",  required_argument, NULL, 'O' },
+        { "busy-poll",  required_argument, NULL, 'b' },
+        { "rate-limit", required_argument, NULL, 'l' },
+        { "rate-limit-path", required_argument, NULL, 'L' },
+        { "rate-limit-v6-prefix", required_argument, NULL, 'V' },
+        { "websocket",  required_argument, NULL, 'w' },
+        { "ws-ping",    required_argument, NULL, 'P' },
+        { "sse",        required_argument, NULL, 'e' },
+        { "sse-max-queue", required_argument, NULL, 'Q' },
+        { "upgrade-socket", required_argument, NULL, 'U' },
+        { "drain-timeout", required_argument, NULL, 'E' },
+        { "tls-port",   required_argument, NULL, 't' },
+        { "cert",       required_argument, NULL, 'C' },
+        { "key",        required_argument, NULL, 'K' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'u':
+            {
+                m_max_upload = parse_size(optarg);
+                if (m_max_upload < 0)
+                {
+                    printf("invalid --max-upload: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'H':
+            {
+                if (optarg[0] != '/' || m_upload_path_count >= MAX_UPLOAD_PATHS)
+                {
+                    printf("invalid --upload-path: %s\n", optarg);
+                    return false;
+                }
+                m_upload_paths[m_upload_path_count++] = optarg;
+                break;
+            }
+            case 'a':
+            {
+                if (!my_listener::add(optarg))
+                {
+                    printf("invalid --listen: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'p':
+            {
+                if (!my_proxy::add_route(optarg))
+                {
+                    printf("invalid --proxy: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'k':
+            {
+                if (!my_pack::load(optarg))
+                    return false;
+                break;
+            }
+            case 'r':
+            {
+                doc_root = optarg;
+                break;
+            }
+            case 'v':
+            {
+                if (!my_vhost::add(optarg))
+                {
+                    printf("invalid --vhost: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'c':
+            {
+                long long entries = parse_size(optarg);
+                if (entries < 0)
+                {
+                    printf("invalid --cache-entries: %s\n", optarg);
+                    return false;
+                }
+                my_vhost::default_host()->cache().set_capacity(entries);
+                break;
+            }
+            case 'i':
+            {
+                char* end = NULL;
+                m_io_threads = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_io_threads < 0)
+                {
+                    printf("invalid --io-threads: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'd':
+            {
+                if (strcmp(optarg, "hybrid") == 0)
+                    m_dispatch_hybrid = true;
+                else if (strcmp(optarg, "pool") == 0)
+                    m_dispatch_hybrid = false;
+                else
+                {
+                    printf("invalid --dispatch: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'n':
+            {
+                char* end = NULL;
+                m_pool_threads = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_pool_threads <= 0)
+                {
+                    printf("invalid --pool-threads: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'R':
+            {
+                char* end = NULL;
+                m_pool_reserved = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_pool_reserved < 0)
+                {
+                    printf("invalid --pool-reserved: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'W':
+            {
+                char* end = NULL;
+                m_pool_weight = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_pool_weight <= 0)
+                {
+                    printf("invalid --pool-weight: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'B':
+            {
+                m_bulk_size = parse_size(optarg);
+                if (m_bulk_size < 0)
+                {
+                    printf("invalid --bulk-size: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'O':
+            {
+                if (optarg[0] != '/' || m_bulk_path_count >= MAX_BULK_PATHS)
+                {
+                    printf("invalid --bulk-path: %s\n", optarg);
+                    return false;
+                }
+                m_bulk_paths[m_bulk_path_count++] = optarg;
+                break;
+            }
+            case 'b':
+            {
+                char* end = NULL;
+                m_busy_poll = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_busy_poll < 0)
+                {
+                    printf("invalid --busy-poll: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'l':
+            {
+                if (!my_ratelimit::set_client_limit(optarg))
+                {
+                    printf("invalid --rate-limit: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'L':
+            {
+                if (!my_ratelimit::add_path_limit(optarg))
+                {
+                    printf("invalid --rate-limit-path: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'V':
+            {
+                if (!my_ratelimit::set_v6_prefix(optarg))
+                {
+                    printf("invalid --rate-limit-v6-prefix: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'w':
+            {
+                if (optarg[0] != '/')
+                {
+                    printf("invalid --websocket: %s\n", optarg);
+                    return false;
+                }
+                m_websocket_url = optarg;
+                break;
+            }
+            case 'P':
+            {
+                char* end = NULL;
+                m_ws_ping = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_ws_ping < 0)
+                {
+                    printf("invalid --ws-ping: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'U':
+            {
+                m_upgrade_socket = optarg;
+                break;
+            }
+            case 'E':
+            {
+                char* end = NULL;
+                m_drain_timeout = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_drain_timeout < 0)
+                {
+                    printf("invalid --drain-timeout: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'e':
+            {
+                if (optarg[0] != '/')
+                {
+                    printf("invalid --sse: %s\n", optarg);
+                    return false;
+                }
+                m_sse_url = optarg;
+                break;
+            }
+            case 'Q':
+            {
+                m_sse_max_queue = parse_size(optarg);
+                if (m_sse_max_queue <= 0)
+                {
+                    printf("invalid --sse-max-queue: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 't':
+            {
+                char* end = NULL;
+                m_tls_port = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || m_tls_port <= 0 || m_tls_port > 65535)
+                {
+                    printf("invalid --tls-port: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'C':
+            {
+                m_tls_cert = optarg;
+                break;
+            }
+            case 'K':
+            {
+                m_tls_key = optarg;
+                break;
+            }
+            case 'T':
+            {
+                char* end = NULL;
+                long n = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n < 0 || n > 1000000000)
+                {
+                    printf("invalid --trace: %s\n", optarg);
+                    return false;
+                }
+                my_trace::set_sample((int)n);
+                break;
+            }
+            case 'D':
+            {
+                if (optarg[0] != '/')
+                {
+                    printf("invalid --trace-url: %s\n", optarg);
+                    return false;
+                }
+                m_trace_url = optarg;
+                break;
+            }
+            case 'X':
+            {
+                m_capture_file = optarg;
+                break;
+            }
+            case 'M':
+            {
+                m_capture_max = parse_size(optarg);
+                if (m_capture_max <= 0)
+                {
+                    printf("invalid --capture-max: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 's':
+            {
+                if (optarg[0] != '/')
+                {
+                    printf("invalid --stats-url: %s\n", optarg);
+                    return false;
+                }
+                m_stats_url = optarg;
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+    if (m_pool_reserved >= m_pool_threads)
+    {
+        printf("--pool-reserved must be less than --pool-threads\n");
+        return false;
+    }
+    if ((m_tls_port || my_listener::has_tls()) && (!m_tls_cert || !m_tls_key))
+    {
+        printf("--tls-port and tls: listeners need --cert and --key\n");
+        return false;
+    }
+    if (m_tls_port && argc - optind < 2)
+    {
+        printf("--tls-port needs ip_address port_number\n");
+        return false;
+    }
+    /** 还需要 ip_address 与 port_number 两个位置参数，除非已经用 --listen 给出了监听地址 **/
+    return argc - optind >= 2 || (argc == optind && my_listener::count() > 0);
+}
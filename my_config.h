@@ -0,0 +1,64 @@
+#ifndef _MY_CONFIG_H_
+#define _MY_CONFIG_H_
+
+/*
+*   服务器的可选配置，由命令行中 ip_address port_number 之外的 --选项 给出
+*/
+
+class my_config
+{
+public:
+    /** 解析命令行选项，出错时打印用法并返回false；解析完成后optind指向第一个位置参数 **/
+    static bool parse(int argc, char* argv[]);
+    static void usage(const char* prog);
+
+public:
+    /** 上传(PUT/POST)请求体的大小上限，单位字节 **/
+    static long long    m_max_upload;
+    /** 接受上传的路径前缀，没有给出时不接受任何上传 **/
+    static const int    MAX_UPLOAD_PATHS = 16;
+    static const char*  m_upload_paths[MAX_UPLOAD_PATHS];
+    static int          m_upload_path_count;
+    /** 异步文件I/O线程数，0表示不启用 **/
+    static int          m_io_threads;
+    /** 混合调度：不会阻塞的请求直接在事件循环线程上完成，为false时所有请求都交给线程池 **/
+    static bool         m_dispatch_hybrid;
+    /** 线程池的线程数，其中只处理小请求（FAST通道）的线程数；两条通道都有任务时每取一个BULK任务之前取几个FAST任务 **/
+    static int          m_pool_threads;
+    static int          m_pool_reserved;
+    static int          m_pool_weight;
+    /** 进入BULK通道的请求：文件不小于m_bulk_size字节，或者url以某个m_bulk_paths开头；上传总是进入BULK通道 **/
+    static long long    m_bulk_size;
+    static const int    MAX_BULK_PATHS = 16;
+    static const char*  m_bulk_paths[MAX_BULK_PATHS];
+    static int          m_bulk_path_count;
+    /** 忙轮询模式下事件循环阻塞之前空转的时间(微秒)，0表示不忙轮询 **/
+    static int          m_busy_poll;
+    /** 读取运行计数器的URL，为NULL时不提供 **/
+    static const char*  m_stats_url;
+    /** 导出采样的请求区间（Chrome trace JSON）的URL，为NULL时不提供 **/
+    static const char*  m_trace_url;
+    /** 录制请求流量的文件，为NULL时不录制；文件的大小上限 **/
+    static const char*  m_capture_file;
+    static long long    m_capture_max;
+    /** WebSocket的URL，为NULL时不提供；空闲多少秒之后发ping，0表示不发 **/
+    static const char*  m_websocket_url;
+    static int          m_ws_ping;
+    /** Server-Sent Events订阅与发布的URL，为NULL时不提供；订阅者积压超过多少字节时断开 **/
+    static const char*  m_sse_url;
+    static long long    m_sse_max_queue;
+    /** 不停机升级用的本地socket路径，为NULL时不启用；旧进程排空连接的最长时间（秒） **/
+    static const char*  m_upgrade_socket;
+    static int          m_drain_timeout;
+    /** TLS监听端口，0表示不监听，与明文端口使用同一个ip_address **/
+    static int          m_tls_port;
+    /** PEM格式的证书链与私钥 **/
+    static const char*  m_tls_cert;
+    static const char*  m_tls_key;
+
+private:
+    /** 解析带 K/M/G 后缀的大小，出错返回-1 **/
+    static long long parse_size(const char* text);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include <new>
+#include "my_coroutine.h"
+
+thread_local my_frame_pool::block* my_frame_pool::m_free_list[my_frame_pool::CLASS_NUM];
+thread_local int my_frame_pool::m_free_count[my_frame_pool::CLASS_NUM];
+
+int my_frame_pool::size_class(size_t size)
+{
+    int shift = MIN_SHIFT;
+    while (shift <= MAX_SHIFT && ((size_t)1 << shift) < size)
+        shift++;
+    return shift - MIN_SHIFT;            // 超过最大块时返回 CLASS_NUM
+}
+
+void* my_frame_pool::alloc(size_t size)
+{
+    int idx = size_class(size);
+    if (idx >= CLASS_NUM)
+        return ::operator new(size);
+
+    block* b = m_free_list[idx];
+    if (b)
+    {
+        m_free_list[idx] = b->next;      // 命中空闲链表，直接复用
+        m_free_count[idx]--;
+        return b;
+    }
+    return ::operator new((size_t)1 << (idx + MIN_SHIFT));
+}
+
+void my_frame_pool::free(void* ptr, size_t size)
+{
+    int idx = size_class(size);
+    if (idx >= CLASS_NUM || m_free_count[idx] >= MAX_FREE_BLOCKS)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    /** 帧可能在别的线程分配，挂到当前线程的链表上即可，块大小只由分级决定 **/
+    block* b = static_cast<block*>(ptr);
+    b->next = m_free_list[idx];
+    m_free_list[idx] = b;
+    m_free_count[idx]++;
+}
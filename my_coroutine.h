@@ -0,0 +1,146 @@
+#ifndef _MY_COROUTINE_H_
+#define _MY_COROUTINE_H_
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <stddef.h>
+
+/*
+*   基于C++20协程的连接处理框架
+*   每个连接对应一个协程，I/O未就绪时挂起，由事件循环在fd就绪后直接恢复，
+*   不再需要把解析状态拆散到回调和状态字段里
+*/
+
+
+/** 协程帧内存池，按2的幂分级缓存释放的帧，每个线程一份空闲链表，不需要加锁 **/
+class my_frame_pool
+{
+public:
+    static void* alloc(size_t size);
+    static void free(void* ptr, size_t size);
+
+private:
+    /** 最小块64字节，最大块4096字节，更大的帧直接使用operator new **/
+    static const int MIN_SHIFT = 6;
+    static const int MAX_SHIFT = 12;
+    static const int CLASS_NUM = MAX_SHIFT - MIN_SHIFT + 1;
+    /** 每个线程每一级最多缓存的空闲块数，超过的直接归还给系统 **/
+    static const int MAX_FREE_BLOCKS = 1024;
+
+    struct block { block* next; };
+    static int size_class(size_t size);
+
+    static thread_local block*  m_free_list[CLASS_NUM];
+    static thread_local int     m_free_count[CLASS_NUM];
+};
+
+
+/** 所有协程promise的公共部分 **/
+class my_promise_base
+{
+public:
+    /** 协程结束时，若有等待者则对称转移回等待者，否则是被分离的顶层协程，自行销毁 **/
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            std::coroutine_handle<> next = h.promise().m_continuation;
+            if (next)
+                return next;
+            h.destroy();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+
+    /** 协程帧从内存池中分配 **/
+    static void* operator new(size_t size) { return my_frame_pool::alloc(size); }
+    static void operator delete(void* ptr, size_t size) { my_frame_pool::free(ptr, size); }
+
+    /** co_await该协程的上层协程，结束后恢复它 **/
+    std::coroutine_handle<> m_continuation;
+};
+
+template <typename T>
+class my_task;
+
+template <typename T>
+class my_task_promise : public my_promise_base
+{
+public:
+    my_task<T> get_return_object();
+    void return_value(T value) { m_value = std::move(value); }
+    T result() { return std::move(m_value); }
+private:
+    T m_value;
+};
+
+template <>
+class my_task_promise<void> : public my_promise_base
+{
+public:
+    my_task<void> get_return_object();
+    void return_void() { }
+    void result() { }
+};
+
+
+/**
+*   惰性启动的协程任务，可被其他协程co_await（对称转移，不占用额外的栈），
+*   也可以通过start()分离后作为顶层协程运行
+**/
+template <typename T = void>
+class my_task
+{
+public:
+    typedef my_task_promise<T>                   promise_type;
+    typedef std::coroutine_handle<promise_type>  handle_type;
+
+    explicit my_task(handle_type h) : m_handle(h) { }
+    my_task(my_task&& other) : m_handle(std::exchange(other.m_handle, nullptr)) { }
+    my_task(const my_task&) = delete;
+    my_task& operator=(const my_task&) = delete;
+    ~my_task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    /** 分离并开始运行，协程结束时自行释放帧 **/
+    void start()
+    {
+        handle_type h = std::exchange(m_handle, nullptr);
+        h.resume();
+    }
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        m_handle.promise().m_continuation = caller;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+private:
+    handle_type m_handle;
+};
+
+template <typename T>
+my_task<T> my_task_promise<T>::get_return_object()
+{
+    return my_task<T>(std::coroutine_handle<my_task_promise<T> >::from_promise(*this));
+}
+
+inline my_task<void> my_task_promise<void>::get_return_object()
+{
+    return my_task<void>(std::coroutine_handle<my_task_promise<void> >::from_promise(*this));
+}
+
+#endif
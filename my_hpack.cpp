@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <string.h>
+#include "my_hpack.h"
+
+/** RFC 7541 附录A 的静态表，下标从1开始 **/
+static const char* static_table[][2] =
+{
+    { "", "" },
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const uint32_t STATIC_TABLE_LEN = 61;
+
+/** RFC 7541 附录B 的Huffman编码表，下标为符号，256为EOS **/
+static const uint32_t huffman_codes[257] =
+{
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff
+};
+
+static const uint8_t huffman_code_len[257] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+/*
+*   Huffman解码使用按半字节(4位)驱动的状态机：状态为编码树的内部结点，
+*   每输入4位最多输出一个符号(最短的码长为5位)，表在第一次使用时由编码表生成
+*/
+struct huffman_decoder
+{
+    struct node { int16_t child[2]; int16_t sym; };
+    struct entry { uint8_t next; int16_t sym; bool fail; };
+
+    /** 257个叶子的编码树恰好有256个内部结点 **/
+    node    nodes[513];
+    int16_t state_of[513];          // 内部结点 -> 状态号
+    int16_t node_of[256];           // 状态号 -> 内部结点
+    entry   table[256][16];
+    /** 该状态下结束是否合法：只经过了全1的路径且不超过7位(EOS的前缀) **/
+    bool    accept[256];
+
+    huffman_decoder()
+    {
+        int count = 1;
+        memset(nodes, -1, sizeof(nodes));
+        for (int sym = 0; sym <= 256; sym++)
+        {
+            int cur = 0;
+            for (int bit = huffman_code_len[sym] - 1; bit >= 0; bit--)
+            {
+                int b = (huffman_codes[sym] >> bit) & 1;
+                if (nodes[cur].child[b] < 0)
+                    nodes[cur].child[b] = count++;
+                cur = nodes[cur].child[b];
+            }
+            nodes[cur].sym = sym;
+        }
+
+        int states = 0;
+        memset(state_of, -1, sizeof(state_of));
+        for (int i = 0; i < count; i++)
+        {
+            if (nodes[i].sym < 0)
+            {
+                state_of[i] = states;
+                node_of[states++] = i;
+            }
+        }
+
+        memset(accept, 0, sizeof(accept));
+        for (int cur = 0, depth = 0; depth < 8 && nodes[cur].sym < 0; depth++)
+        {
+            accept[state_of[cur]] = true;
+            cur = nodes[cur].child[1];
+        }
+
+        for (int s = 0; s < states; s++)
+        {
+            for (int nibble = 0; nibble < 16; nibble++)
+            {
+                entry& e = table[s][nibble];
+                int cur = node_of[s];
+                e.sym = -1;
+                e.fail = false;
+                for (int bit = 3; bit >= 0; bit--)
+                {
+                    cur = nodes[cur].child[(nibble >> bit) & 1];
+                    if (nodes[cur].sym >= 0)
+                    {
+                        if (nodes[cur].sym == 256)      // 字符串中出现了EOS，是解码错误
+                            e.fail = true;
+                        e.sym = nodes[cur].sym;
+                        cur = 0;
+                    }
+                }
+                e.next = state_of[cur];
+            }
+        }
+    }
+};
+
+bool my_hpack::huffman_decode(const unsigned char* p, size_t len, std::string& out)
+{
+    static const huffman_decoder decoder;
+
+    int state = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        const huffman_decoder::entry& hi = decoder.table[state][p[i] >> 4];
+        if (hi.fail)
+            return false;
+        if (hi.sym >= 0)
+            out += (char)hi.sym;
+        const huffman_decoder::entry& lo = decoder.table[hi.next][p[i] & 0xf];
+        if (lo.fail)
+            return false;
+        if (lo.sym >= 0)
+            out += (char)lo.sym;
+        state = lo.next;
+    }
+    return decoder.accept[state];
+}
+
+void my_hpack::encode_int(std::string& out, uint8_t first, int prefix, uint32_t value)
+{
+    uint32_t max = (1u << prefix) - 1;
+    if (value < max)
+    {
+        out += (char)(first | value);
+        return;
+    }
+    out += (char)(first | max);
+    value -= max;
+    while (value >= 128)
+    {
+        out += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+bool my_hpack::decode_int(const unsigned char*& p, const unsigned char* end, int prefix, uint32_t& value)
+{
+    if (p >= end)
+        return false;
+    uint32_t max = (1u << prefix) - 1;
+    value = *p++ & max;
+    if (value < max)
+        return true;
+    for (int shift = 0; p < end; shift += 7)
+    {
+        if (shift > 21)                 // 超过28位的整数认为是攻击，不可能是合法的长度或下标
+            return false;
+        unsigned char b = *p++;
+        value += (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool my_hpack::decode_string(const unsigned char*& p, const unsigned char* end, std::string& out)
+{
+    if (p >= end)
+        return false;
+    bool huffman = (*p & 0x80) != 0;
+    uint32_t len = 0;
+    if (!decode_int(p, end, 7, len) || len > (size_t)(end - p))
+        return false;
+    out.clear();
+    if (huffman)
+    {
+        if (!huffman_decode(p, len, out))
+            return false;
+    }
+    else
+    {
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+bool my_hpack::lookup(uint32_t index, header& out) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_LEN)
+    {
+        out.name = static_table[index][0];
+        out.value = static_table[index][1];
+        return true;
+    }
+    index -= STATIC_TABLE_LEN + 1;
+    if (index >= m_dynamic.size())
+        return false;
+    out = m_dynamic[index];
+    return true;
+}
+
+void my_hpack::evict(size_t max_size)
+{
+    while (m_size > max_size && !m_dynamic.empty())
+    {
+        const header& h = m_dynamic.back();
+        m_size -= h.name.size() + h.value.size() + 32;
+        m_dynamic.pop_back();
+    }
+}
+
+void my_hpack::insert(const header& h)
+{
+    size_t size = h.name.size() + h.value.size() + 32;
+    evict(m_max_size - (size <= m_max_size ? size : m_max_size));
+    if (size > m_max_size)             // 比整个表都大的表项会清空动态表，自身也不入表
+        return;
+    m_dynamic.push_front(h);
+    m_size += size;
+}
+
+bool my_hpack::decode(const unsigned char* buf, size_t len, std::vector<header>& out, size_t max_list)
+{
+    const unsigned char* p = buf;
+    const unsigned char* end = buf + len;
+    bool allow_size_update = true;      // 动态表大小更新只能出现在头部块的开头
+    size_t list_size = 0;               // 引用动态表的索引只占一个字节，却能展开成很长的头部，按展开后的大小计算
+    header h;
+
+    while (p < end)
+    {
+        unsigned char b = *p;
+        uint32_t index = 0;
+        if (b & 0x80)                                   // 索引头部字段
+        {
+            if (!decode_int(p, end, 7, index) || !lookup(index, h))
+                return false;
+            list_size += h.name.size() + h.value.size() + 32;
+            if (list_size > max_list)
+                return false;
+            out.push_back(h);
+            allow_size_update = false;
+            continue;
+        }
+        if ((b & 0xe0) == 0x20)                         // 动态表大小更新
+        {
+            if (!allow_size_update || !decode_int(p, end, 5, index) || index > DEFAULT_TABLE_SIZE)
+                return false;
+            m_max_size = index;
+            evict(m_max_size);
+            continue;
+        }
+
+        bool incremental = (b & 0xc0) == 0x40;           // 带索引的字面量，要加入动态表
+        if (!decode_int(p, end, incremental ? 6 : 4, index))
+            return false;
+        if (index != 0)
+        {
+            if (!lookup(index, h))
+                return false;
+        }
+        else if (!decode_string(p, end, h.name))
+        {
+            return false;
+        }
+        if (!decode_string(p, end, h.value))
+            return false;
+
+        list_size += h.name.size() + h.value.size() + 32;
+        if (list_size > max_list)
+            return false;
+        if (incremental)
+            insert(h);
+        out.push_back(h);
+        allow_size_update = false;
+    }
+    return true;
+}
+
+void my_hpack::encode_status(std::string& out, int status)
+{
+    switch (status)
+    {
+        case 200: encode_int(out, 0x80, 7, 8);  return;
+        case 204: encode_int(out, 0x80, 7, 9);  return;
+        case 206: encode_int(out, 0x80, 7, 10); return;
+        case 304: encode_int(out, 0x80, 7, 11); return;
+        case 400: encode_int(out, 0x80, 7, 12); return;
+        case 404: encode_int(out, 0x80, 7, 13); return;
+        case 500: encode_int(out, 0x80, 7, 14); return;
+        default: break;
+    }
+    char value[16];
+    snprintf(value, sizeof(value), "%d", status);
+    encode_literal(out, INDEX_STATUS, value);
+}
+
+void my_hpack::encode_literal(std::string& out, int name_index, const char* value)
+{
+    size_t len = strlen(value);
+    encode_int(out, 0x00, 4, name_index);              // 不入表的字面量，名字引用静态表
+    encode_int(out, 0x00, 7, len);                     // 不使用Huffman编码
+    out.append(value, len);
+}
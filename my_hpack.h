@@ -0,0 +1,62 @@
+#ifndef _MY_HPACK_H_
+#define _MY_HPACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+/*
+*   HTTP/2 头部压缩 HPACK (RFC 7541)
+*   解码端维护静态表 + 动态表，支持Huffman解码；编码端只输出索引或不入表的字面量，不需要动态表
+*/
+
+class my_hpack
+{
+public:
+    struct header
+    {
+        std::string name;
+        std::string value;
+    };
+
+    /** 静态表中应答会用到的下标 **/
+    enum STATIC_INDEX { INDEX_STATUS = 8, INDEX_CONTENT_ENCODING = 26, INDEX_CONTENT_LENGTH = 28,
+                        INDEX_CONTENT_TYPE = 31, INDEX_ETAG = 34, INDEX_SERVER = 54, INDEX_VARY = 59 };
+
+    /** 动态表的默认大小，即 SETTINGS_HEADER_TABLE_SIZE 的初始值 **/
+    static const size_t DEFAULT_TABLE_SIZE = 4096;
+
+public:
+    my_hpack() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE) { }
+
+    /** 解码一个完整的头部块，出错或者解码出的头部列表超过max_list字节时返回false，
+        调用者应以COMPRESSION_ERROR关闭连接（解码到一半停下，动态表已经无法与对端同步） **/
+    bool decode(const unsigned char* buf, size_t len, std::vector<header>& out, size_t max_list);
+
+    /** 编码 :status 伪头部，常见状态码直接使用静态表下标 **/
+    static void encode_status(std::string& out, int status);
+    /** 以静态表下标为名字，编码一个不入表的字面量头部 **/
+    static void encode_literal(std::string& out, int name_index, const char* value);
+
+private:
+    static void encode_int(std::string& out, uint8_t first, int prefix, uint32_t value);
+    static bool decode_int(const unsigned char*& p, const unsigned char* end, int prefix, uint32_t& value);
+    static bool decode_string(const unsigned char*& p, const unsigned char* end, std::string& out);
+    static bool huffman_decode(const unsigned char* p, size_t len, std::string& out);
+
+    /** 按HPACK下标查找，1~61为静态表，之后为动态表 **/
+    bool lookup(uint32_t index, header& out) const;
+    void insert(const header& h);
+    void evict(size_t max_size);
+
+private:
+    /** 动态表，新插入的在前面 **/
+    std::deque<header>  m_dynamic;
+    /** 动态表当前大小，每个表项按 name + value + 32 计算 **/
+    size_t              m_size;
+    size_t              m_max_size;
+};
+
+#endif
@@ -0,0 +1,742 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "my_http2.h"
+#include "my_httpconn.h"
+#include "my_ratelimit.h"
+#include "my_stats.h"
+
+extern const char* error_400_form;
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_429_form;
+extern const char* error_500_form;
+
+const char my_http2::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static inline uint32_t get_u32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_u32(char* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+int my_http2::check_preface(const char* buf, int len)
+{
+    int n = len < PREFACE_LEN ? len : PREFACE_LEN;
+    if (memcmp(buf, PREFACE, n) != 0)
+        return -1;
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+my_http2::my_http2(my_httpconn* conn, my_socket* sock) :
+                   m_conn(conn),
+                   m_sock(sock),
+                   m_read_buf(new char[READ_BUFFER_SIZE]),
+                   m_read_idx(0),
+                   m_check_idx(0),
+                   m_last_stream_id(0),
+                   m_header_stream(0),
+                   m_header_end_stream(false),
+                   m_conn_window(DEFAULT_WINDOW_SIZE),
+                   m_peer_initial_window(DEFAULT_WINDOW_SIZE),
+                   m_peer_max_frame(DEFAULT_FRAME_SIZE),
+                   m_goaway_recv(false),
+                   m_closing(false)
+{
+    m_out.set_done(on_sent, this);
+}
+
+my_http2::~my_http2()
+{
+    m_out.clear();                       // 释放发送队列对各stream文件的引用
+    for (std::unordered_map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+        release(it->second);
+    delete [] m_read_buf;
+}
+
+void my_http2::append_frame_header(uint8_t type, uint8_t flags, uint32_t id, size_t len)
+{
+    char header[FRAME_HEADER_LEN];
+    header[0] = len >> 16;
+    header[1] = len >> 8;
+    header[2] = len;
+    header[3] = type;
+    header[4] = flags;
+    put_u32(header + 5, id & 0x7fffffff);
+    m_out.append_copy(header, FRAME_HEADER_LEN);      // 连续的帧合并到同一个分段
+}
+
+void my_http2::append_frame(uint8_t type, uint8_t flags, uint32_t id, const char* payload, size_t len)
+{
+    append_frame_header(type, flags, id, len);
+    if (len > 0)
+        m_out.append_copy(payload, len);
+}
+
+void my_http2::append_file(stream* s, size_t len)
+{
+    m_out.append_file(s->file_fd, s->offset, len, s->file ? s->file->map : NULL, s);
+    s->pending++;
+}
+
+void my_http2::on_sent(void* arg, void* owner)
+{
+    stream* s = (stream*)owner;
+    if (--s->pending == 0 && s->closed)
+        ((my_http2*)arg)->release(s);
+}
+
+void my_http2::rst_stream(uint32_t id, uint32_t code)
+{
+    char payload[4];
+    put_u32(payload, code);
+    append_frame(FRAME_RST_STREAM, 0, id, payload, 4);
+}
+
+void my_http2::goaway(uint32_t code)
+{
+    char payload[8];
+    put_u32(payload, m_last_stream_id);
+    put_u32(payload + 4, code);
+    append_frame(FRAME_GOAWAY, 0, 0, payload, 8);
+    m_closing = true;
+}
+
+void my_http2::release(stream* s)
+{
+    if (s->pack)
+    {
+        s->pack->release();
+        s->pack = NULL;
+    }
+    if (s->file)
+    {
+        s->vhost->cache().release(s->file);
+        s->file = NULL;
+        s->file_fd = -1;
+    }
+    delete s;
+}
+
+void my_http2::close_stream(stream* s)
+{
+    m_streams.erase(s->id);
+    s->closed = true;
+    if (s->pending == 0)                 // 发送队列里还有它的文件分段时，等发完再关闭文件
+        release(s);
+}
+
+bool my_http2::on_settings(uint8_t flags, const unsigned char* p, uint32_t len)
+{
+    if (flags & FLAG_ACK)
+        return true;
+    if (len % 6 != 0)
+    {
+        goaway(ERR_FRAME_SIZE);
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i += 6)
+    {
+        uint16_t id = (p[i] << 8) | p[i + 1];
+        uint32_t value = get_u32(p + i + 2);
+        if (id == SETTINGS_INITIAL_WINDOW_SIZE)
+        {
+            if (value > (uint32_t)MAX_WINDOW_SIZE)
+            {
+                goaway(ERR_FLOW_CONTROL);
+                return false;
+            }
+            int64_t delta = (int64_t)value - m_peer_initial_window;    // 已打开的stream窗口按差值调整
+            for (std::unordered_map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+            {
+                if (it->second->window + delta > MAX_WINDOW_SIZE)   // RFC 9113 6.9.2：调整后超过2^31-1是连接错误
+                {
+                    goaway(ERR_FLOW_CONTROL);
+                    return false;
+                }
+            }
+            m_peer_initial_window = value;
+            for (std::unordered_map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+                it->second->window += delta;
+        }
+        else if (id == SETTINGS_MAX_FRAME_SIZE)
+        {
+            if (value < DEFAULT_FRAME_SIZE || value > 0xffffff)
+            {
+                goaway(ERR_PROTOCOL);
+                return false;
+            }
+            m_peer_max_frame = value;
+        }
+        else if (id == SETTINGS_ENABLE_PUSH && value > 1)
+        {
+            goaway(ERR_PROTOCOL);
+            return false;
+        }
+    }
+    append_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+bool my_http2::on_window_update(uint32_t id, const unsigned char* p, uint32_t len)
+{
+    if (len != 4)
+    {
+        goaway(ERR_FRAME_SIZE);
+        return false;
+    }
+    uint32_t increment = get_u32(p) & 0x7fffffff;
+    if (id == 0)
+    {
+        if (increment == 0 || m_conn_window + increment > MAX_WINDOW_SIZE)
+        {
+            goaway(increment == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+            return false;
+        }
+        m_conn_window += increment;
+        return true;
+    }
+
+    std::unordered_map<uint32_t, stream*>::iterator it = m_streams.find(id);
+    if (it == m_streams.end())          // 已经关闭的stream，忽略
+        return true;
+    stream* s = it->second;
+    if (increment == 0 || s->window + increment > MAX_WINDOW_SIZE)
+    {
+        rst_stream(id, increment == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+        close_stream(s);
+        return true;
+    }
+    s->window += increment;
+    if (s->remain > 0 && !s->queued)
+    {
+        s->queued = true;               // 因窗口耗尽而暂停的stream重新加入调度
+        m_ready.push_back(id);
+    }
+    return true;
+}
+
+bool my_http2::on_data(uint32_t id, uint32_t len)
+{
+    if (id == 0)                        // DATA必须属于某个stream
+    {
+        goaway(ERR_PROTOCOL);
+        return false;
+    }
+    /** 不接收请求体，收到多少就立即归还多少窗口，避免对端因窗口耗尽而阻塞 **/
+    if (len == 0)
+        return true;
+    char payload[4];
+    put_u32(payload, len);
+    append_frame(FRAME_WINDOW_UPDATE, 0, 0, payload, 4);
+    if (m_streams.count(id))
+        append_frame(FRAME_WINDOW_UPDATE, 0, id, payload, 4);
+    return true;
+}
+
+bool my_http2::on_rst_stream(uint32_t id, uint32_t len)
+{
+    if (len != 4)
+    {
+        goaway(ERR_FRAME_SIZE);
+        return false;
+    }
+    if (id == 0)
+    {
+        goaway(ERR_PROTOCOL);
+        return false;
+    }
+    std::unordered_map<uint32_t, stream*>::iterator it = m_streams.find(id);
+    if (it != m_streams.end())
+        close_stream(it->second);
+    return true;
+}
+
+bool my_http2::on_headers(uint32_t id, uint8_t flags, const unsigned char* p, uint32_t len)
+{
+    if (id == 0 || (id & 1) == 0)
+    {
+        goaway(ERR_PROTOCOL);
+        return false;
+    }
+    uint32_t pad = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1)
+        {
+            goaway(ERR_PROTOCOL);
+            return false;
+        }
+        pad = p[0];
+        p++;
+        len--;
+    }
+    if (flags & FLAG_PRIORITY)          // 不使用优先级，跳过依赖关系与权重
+    {
+        if (len < 5)
+        {
+            goaway(ERR_PROTOCOL);
+            return false;
+        }
+        p += 5;
+        len -= 5;
+    }
+    if (pad > len)
+    {
+        goaway(ERR_PROTOCOL);
+        return false;
+    }
+
+    m_header_block.assign((const char*)p, len - pad);
+    m_header_stream = id;
+    m_header_end_stream = (flags & FLAG_END_STREAM) != 0;
+    if (flags & FLAG_END_HEADERS)
+        return on_header_block(id, m_header_end_stream);
+    return true;
+}
+
+bool my_http2::on_header_block(uint32_t id, bool end_stream)
+{
+    m_header_stream = 0;
+
+    /** 无论是否接受这个stream，头部块都必须解码，否则HPACK动态表会与对端失去同步 **/
+    std::vector<my_hpack::header> headers;
+    if (!m_hpack.decode((const unsigned char*)m_header_block.data(), m_header_block.size(), headers, MAX_HEADER_LIST_SIZE))
+    {
+        goaway(ERR_COMPRESSION);
+        return false;
+    }
+
+    if (m_streams.count(id))            // 已有stream上的头部块（trailer），不需要处理
+        return true;
+    if (id <= m_last_stream_id)
+    {
+        goaway(ERR_PROTOCOL);
+        return false;
+    }
+    m_last_stream_id = id;
+    if (m_goaway_recv)
+        return true;
+    if (m_streams.size() >= MAX_CONCURRENT_STREAMS)
+    {
+        rst_stream(id, ERR_REFUSED_STREAM);
+        return true;
+    }
+
+    stream* s = new stream();
+    s->id = id;
+    s->window = m_peer_initial_window;
+    s->accept_gzip = false;
+    s->vhost = NULL;
+    s->pack = NULL;
+    s->file = NULL;
+    s->file_fd = -1;
+    s->offset = 0;
+    s->remain = 0;
+    s->body = NULL;
+    s->queued = false;
+    s->closed = false;
+    s->pending = 0;
+    for (size_t i = 0; i < headers.size(); i++)
+    {
+        if (headers[i].name == ":method")
+            s->method = headers[i].value;
+        else if (headers[i].name == ":path")
+            s->path = headers[i].value;
+        else if (headers[i].name == ":authority" || (headers[i].name == "host" && s->authority.empty()))
+            s->authority = headers[i].value;
+        else if (headers[i].name == "accept-encoding")
+            s->accept_gzip = (headers[i].value.find("gzip") != std::string::npos);
+        else if (headers[i].name == "if-none-match")
+            s->if_none_match = headers[i].value;
+    }
+    s->head_only = (s->method == "HEAD");
+    s->limited = my_ratelimit::enabled() && !my_ratelimit::allow(m_conn->peer(), s->path.c_str());
+    (void)end_stream;                   // 只支持GET/HEAD，请求体即使存在也只是被丢弃
+    m_streams[id] = s;
+    m_opened.push_back(id);
+    return true;
+}
+
+bool my_http2::process_frames()
+{
+    while (m_read_idx - m_check_idx >= FRAME_HEADER_LEN)
+    {
+        const unsigned char* h = (const unsigned char*)m_read_buf + m_check_idx;
+        uint32_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+        uint8_t type = h[3];
+        uint8_t flags = h[4];
+        uint32_t id = get_u32(h + 5) & 0x7fffffff;
+        if (len > DEFAULT_FRAME_SIZE)   // 没有通过SETTINGS调大过帧长度上限
+        {
+            goaway(ERR_FRAME_SIZE);
+            return false;
+        }
+        if ((uint32_t)(m_read_idx - m_check_idx) < FRAME_HEADER_LEN + len)
+            break;                      // 帧还没有读完整
+        const unsigned char* p = h + FRAME_HEADER_LEN;
+        m_check_idx += FRAME_HEADER_LEN + len;
+
+        /** 头部块没有结束时，只能收到同一个stream的CONTINUATION帧 **/
+        if (m_header_stream != 0 && (type != FRAME_CONTINUATION || id != m_header_stream))
+        {
+            goaway(ERR_PROTOCOL);
+            return false;
+        }
+
+        bool ok = true;
+        switch (type)
+        {
+            case FRAME_DATA:
+            {
+                ok = on_data(id, len);
+                break;
+            }
+            case FRAME_HEADERS:
+            {
+                ok = on_headers(id, flags, p, len);
+                break;
+            }
+            case FRAME_CONTINUATION:
+            {
+                if (m_header_stream == 0)
+                {
+                    goaway(ERR_PROTOCOL);
+                    return false;
+                }
+                if (m_header_block.size() + len > MAX_HEADER_BLOCK)
+                {
+                    goaway(ERR_ENHANCE_YOUR_CALM);  // 不停地发没有END_HEADERS的CONTINUATION帧
+                    return false;
+                }
+                m_header_block.append((const char*)p, len);
+                if (flags & FLAG_END_HEADERS)
+                    ok = on_header_block(id, m_header_end_stream);
+                break;
+            }
+            case FRAME_SETTINGS:
+            {
+                ok = on_settings(flags, p, len);
+                break;
+            }
+            case FRAME_WINDOW_UPDATE:
+            {
+                ok = on_window_update(id, p, len);
+                break;
+            }
+            case FRAME_RST_STREAM:
+            {
+                ok = on_rst_stream(id, len);
+                break;
+            }
+            case FRAME_PING:
+            {
+                if (len != 8)
+                {
+                    goaway(ERR_FRAME_SIZE);
+                    return false;
+                }
+                if (!(flags & FLAG_ACK))
+                    append_frame(FRAME_PING, FLAG_ACK, 0, (const char*)p, 8);
+                break;
+            }
+            case FRAME_GOAWAY:
+            {
+                m_goaway_recv = true;
+                break;
+            }
+            case FRAME_PRIORITY:        // 不使用优先级，只检查长度
+            {
+                if (id == 0)
+                {
+                    goaway(ERR_PROTOCOL);
+                    return false;
+                }
+                if (len != 5)           // 长度错误只是stream错误
+                {
+                    rst_stream(id, ERR_FRAME_SIZE);
+                    std::unordered_map<uint32_t, stream*>::iterator it = m_streams.find(id);
+                    if (it != m_streams.end())
+                        close_stream(it->second);
+                }
+                break;
+            }
+            case FRAME_PUSH_PROMISE:    // 客户端不能推送
+            {
+                goaway(ERR_PROTOCOL);
+                return false;
+            }
+            default:                    // 未知类型的帧直接忽略
+            {
+                break;
+            }
+        }
+        if (!ok)
+            return false;
+    }
+
+    /** 把未处理完的数据移到缓冲区开头 **/
+    if (m_check_idx > 0)
+    {
+        memmove(m_read_buf, m_read_buf + m_check_idx, m_read_idx - m_check_idx);
+        m_read_idx -= m_check_idx;
+        m_check_idx = 0;
+    }
+    return true;
+}
+
+bool my_http2::open_streams(bool nonblocking)
+{
+    size_t blocked = 0;
+    for (size_t i = 0; i < m_opened.size(); i++)
+    {
+        std::unordered_map<uint32_t, stream*>::iterator it = m_streams.find(m_opened[i]);
+        if (it == m_streams.end())      // 在打开文件之前就被对端重置了
+            continue;
+        stream* s = it->second;
+
+        my_parse::HTTP_CODE code = my_parse::BAD_REQUEST;
+        my_pack::asset asset;
+        s->vhost = my_vhost::find(s->authority.empty() ? NULL : s->authority.c_str());
+        if (s->limited)
+        {
+            code = my_parse::TOO_MANY_REQUESTS;
+            my_stats::add(my_stats::RATE_LIMITED);
+        }
+        else if ((s->method == "GET" || s->head_only) && !s->path.empty() && s->path[0] == '/')
+        {
+            if (s->vhost == my_vhost::default_host())      // 先查资源包，DATA帧直接从映射中取内容
+                s->pack = my_pack::acquire();
+            if (s->pack && s->pack->find(s->path.c_str(), s->accept_gzip, asset))
+            {
+                code = my_parse::PACK_REQUEST;
+                if (!s->if_none_match.empty() && (s->if_none_match.find(asset.etag) != std::string::npos || s->if_none_match == "*"))
+                    code = my_parse::NOT_MODIFIED;
+            }
+            else
+            {
+                if (s->pack)
+                {
+                    s->pack->release();
+                    s->pack = NULL;
+                }
+                code = my_parse::open_file(s->vhost, s->path.c_str(), &s->file, nonblocking);
+                if (code == my_parse::GET_REQUEST)
+                    s->file_fd = s->file->fd;
+            }
+        }
+        if (code == my_parse::OFFLOAD_REQUEST)     // 留到工作线程中再打开
+        {
+            m_opened[blocked++] = s->id;
+            continue;
+        }
+        my_httpconn::count_request();
+
+        int status = 200;
+        switch (code)
+        {
+            case my_parse::GET_REQUEST:       status = 200; s->remain = s->file->st.st_size; break;
+            case my_parse::PACK_REQUEST:      status = 200; s->body = asset.body; s->remain = asset.body_len; break;
+            case my_parse::NOT_MODIFIED:      status = 304; break;
+            case my_parse::NO_RESOURCE:       status = 404; s->body = error_404_form; break;
+            case my_parse::FORBIDDEN_REQUEST: status = 403; s->body = error_403_form; break;
+            case my_parse::TOO_MANY_REQUESTS: status = 429; s->body = error_429_form; break;
+            case my_parse::INTERNAL_ERROR:    status = 500; s->body = error_500_form; break;
+            default:                          status = 400; s->body = error_400_form; break;
+        }
+        if (s->body && code != my_parse::PACK_REQUEST)
+            s->remain = strlen(s->body);
+
+        char length[32];
+        snprintf(length, sizeof(length), "%zu", s->remain);
+        std::string block;
+        my_hpack::encode_status(block, status);
+        if (code != my_parse::NOT_MODIFIED)
+            my_hpack::encode_literal(block, my_hpack::INDEX_CONTENT_LENGTH, length);
+        if (code == my_parse::PACK_REQUEST || code == my_parse::NOT_MODIFIED)
+        {
+            if (code == my_parse::PACK_REQUEST)
+                my_hpack::encode_literal(block, my_hpack::INDEX_CONTENT_TYPE, asset.type);
+            my_hpack::encode_literal(block, my_hpack::INDEX_ETAG, asset.etag);
+            if (asset.gzip)
+                my_hpack::encode_literal(block, my_hpack::INDEX_CONTENT_ENCODING, "gzip");
+            if (asset.vary)
+                my_hpack::encode_literal(block, my_hpack::INDEX_VARY, "Accept-Encoding");
+        }
+
+        if (s->head_only)
+            s->remain = 0;
+        uint8_t flags = FLAG_END_HEADERS | (s->remain == 0 ? FLAG_END_STREAM : 0);
+        append_frame(FRAME_HEADERS, flags, s->id, block.data(), block.size());
+        if (s->remain == 0)
+        {
+            close_stream(s);
+            continue;
+        }
+        s->queued = true;
+        m_ready.push_back(s->id);
+    }
+    m_opened.resize(blocked);
+    return blocked == 0;
+}
+
+bool my_http2::sendable() const
+{
+    if (m_conn_window <= 0)
+        return false;
+    for (size_t i = 0; i < m_ready.size(); i++)
+    {
+        std::unordered_map<uint32_t, stream*>::const_iterator it = m_streams.find(m_ready[i]);
+        if (it != m_streams.end() && it->second->window > 0)
+            return true;
+    }
+    return false;
+}
+
+void my_http2::schedule()
+{
+    size_t budget = SCHEDULE_BUDGET;
+    size_t rounds = m_ready.size();
+    size_t idle = 0;                    // 连续没能发送的stream数，转满一圈就停止
+
+    while (budget > 0 && !m_ready.empty() && m_conn_window > 0 && idle < rounds)
+    {
+        uint32_t id = m_ready.front();
+        m_ready.pop_front();
+        std::unordered_map<uint32_t, stream*>::iterator it = m_streams.find(id);
+        if (it == m_streams.end())      // 已经被重置
+        {
+            rounds--;
+            continue;
+        }
+        stream* s = it->second;
+        if (s->window <= 0)             // stream窗口耗尽，等WINDOW_UPDATE再重新加入调度
+        {
+            s->queued = false;
+            rounds--;
+            continue;
+        }
+
+        /** 一次最多发送一帧，保证多个stream之间的公平 **/
+        size_t n = s->remain;
+        if (n > m_peer_max_frame)
+            n = m_peer_max_frame;
+        if ((int64_t)n > s->window)
+            n = s->window;
+        if ((int64_t)n > m_conn_window)
+            n = m_conn_window;
+        if (n > budget)
+            n = budget;
+        if (n == 0)
+        {
+            m_ready.push_back(id);
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        uint8_t flags = (n == s->remain) ? FLAG_END_STREAM : 0;
+        if (s->body)
+        {
+            append_frame(FRAME_DATA, flags, id, s->body, n);
+            s->body += n;
+        }
+        else
+        {
+            append_frame_header(FRAME_DATA, flags, id, n);
+            append_file(s, n);          // 帧头之后紧跟文件内容，由sendfile发送，不拷贝进缓冲区
+        }
+        s->offset += n;
+        s->remain -= n;
+        s->window -= n;
+        m_conn_window -= n;
+        budget -= n;
+
+        if (s->remain == 0)
+        {
+            s->queued = false;
+            close_stream(s);
+            rounds--;
+        }
+        else
+        {
+            m_ready.push_back(id);
+        }
+    }
+}
+
+int my_http2::fill()
+{
+    while (m_read_idx < READ_BUFFER_SIZE)
+    {
+        ssize_t n = m_sock->recv_some(m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        if (n == 0)
+            return -1;
+        m_read_idx += n;
+    }
+    return 1;
+}
+
+my_task<> my_http2::run(const char* data, int len)
+{
+    /** 前言之后可能已经跟着客户端的第一批帧 **/
+    m_read_idx = len - PREFACE_LEN;
+    memcpy(m_read_buf, data + PREFACE_LEN, m_read_idx);
+
+    char settings[12];
+    settings[0] = 0;
+    settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(settings + 2, MAX_CONCURRENT_STREAMS);
+    settings[6] = 0;
+    settings[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    put_u32(settings + 8, MAX_HEADER_LIST_SIZE);
+    append_frame(FRAME_SETTINGS, 0, 0, settings, 12);
+
+    while (1)
+    {
+        if (!m_closing && !process_frames())
+            m_closing = true;
+
+        if (!m_closing && !m_opened.empty() && !open_streams(my_httpconn::nonblocking()))
+        {
+            co_await m_conn->offload();             // 需要stat/open的stream在工作线程中打开
+            open_streams(false);
+        }
+        if (!m_closing && m_out.pending() < LOW_WATERMARK)
+            schedule();
+
+        if (!co_await m_out.prefetch(m_sock))
+            break;
+        int wret = m_out.flush(m_sock);
+        if (wret == my_outqueue::FLUSH_ERROR)
+            break;
+        if (wret == my_outqueue::FLUSH_PREFETCH)
+            continue;
+        if (wret == my_outqueue::FLUSH_DONE && (m_closing || (m_goaway_recv && m_streams.empty() && m_opened.empty())))
+            break;
+
+        /** 发送队列已经排空且还有可发送的数据时直接进入下一轮，否则等待socket就绪 **/
+        if (wret == my_outqueue::FLUSH_DONE && sendable())
+        {
+            if (fill() < 0)
+                break;
+            continue;
+        }
+        if (!co_await m_sock->wait(wret == my_outqueue::FLUSH_AGAIN ? (EPOLLIN | EPOLLOUT) : EPOLLIN))
+            break;
+        if (fill() < 0)
+            break;
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef _MY_HTTP2_H_
+#define _MY_HTTP2_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_outqueue.h"
+#include "my_hpack.h"
+#include "my_pack.h"
+#include "my_vhost.h"
+
+/*
+*   明文HTTP/2 (h2c, prior knowledge)
+*   由连接前言识别，在同一个连接协程里运行：一个socket上多路复用多个stream，
+*   按stream轮转调度DATA帧，遵守连接级与stream级的流量控制。
+*   静态文件的DATA帧只把9字节帧头放进缓冲区，帧体仍由sendfile直接从文件发送
+*/
+
+class my_httpconn;
+
+class my_http2
+{
+public:
+    /** 连接前言 **/
+    static const char PREFACE[];
+    static const int PREFACE_LEN = 24;
+
+    /** 检查读到的数据是否为连接前言：返回1表示是，0表示数据还不够判断，-1表示不是 **/
+    static int check_preface(const char* buf, int len);
+
+public:
+    my_http2(my_httpconn* conn, my_socket* sock);
+    ~my_http2();
+
+    /** 运行HTTP/2会话直到连接结束，data为已经读到的数据（以前言开头） **/
+    my_task<> run(const char* data, int len);
+
+private:
+    /** 帧类型 **/
+    enum FRAME_TYPE { FRAME_DATA = 0, FRAME_HEADERS, FRAME_PRIORITY, FRAME_RST_STREAM, FRAME_SETTINGS,
+                      FRAME_PUSH_PROMISE, FRAME_PING, FRAME_GOAWAY, FRAME_WINDOW_UPDATE, FRAME_CONTINUATION };
+    /** 帧标志 **/
+    enum FRAME_FLAG { FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4,
+                      FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20 };
+    /** 错误码 **/
+    enum ERROR_CODE { ERR_NO_ERROR = 0, ERR_PROTOCOL, ERR_INTERNAL, ERR_FLOW_CONTROL, ERR_SETTINGS_TIMEOUT,
+                      ERR_STREAM_CLOSED, ERR_FRAME_SIZE, ERR_REFUSED_STREAM, ERR_CANCEL, ERR_COMPRESSION,
+                      ERR_CONNECT, ERR_ENHANCE_YOUR_CALM };
+    /** SETTINGS参数 **/
+    enum SETTING_ID { SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH, SETTINGS_MAX_CONCURRENT_STREAMS,
+                      SETTINGS_INITIAL_WINDOW_SIZE, SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE };
+
+    static const int FRAME_HEADER_LEN = 9;
+    static const uint32_t DEFAULT_FRAME_SIZE = 16384;
+    static const int32_t DEFAULT_WINDOW_SIZE = 65535;
+    static const int32_t MAX_WINDOW_SIZE = 0x7fffffff;
+    /** 同时打开的stream上限，通过SETTINGS告知对端 **/
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100;
+    /** HEADERS与CONTINUATION拼起来的头部块（压缩后）的上限，超过时以ENHANCE_YOUR_CALM关闭连接 **/
+    static const size_t MAX_HEADER_BLOCK = 65536;
+    /** 解码后的头部列表的上限（每个头部按 name + value + 32 计算），通过SETTINGS告知对端 **/
+    static const uint32_t MAX_HEADER_LIST_SIZE = 16384;
+    /** 每一轮调度最多排入的DATA字节数，发送队列降到LOW_WATERMARK以下才排入下一轮，保证各stream轮转 **/
+    static const size_t SCHEDULE_BUDGET = 65536;
+    /** 发送队列中待发送的数据少于该值时才排入新的DATA帧，socket一直有数据可写又不会积压太多 **/
+    static const size_t LOW_WATERMARK = 16384;
+    /** 读缓冲区，至少能放下一个最大帧 **/
+    static const int READ_BUFFER_SIZE = 2 * (FRAME_HEADER_LEN + DEFAULT_FRAME_SIZE);
+
+    struct stream
+    {
+        uint32_t        id;
+        /** 发送窗口，对端调小INITIAL_WINDOW_SIZE时可能为负 **/
+        int64_t         window;
+        bool            head_only;
+        /** 超过限速，直接应答429 **/
+        bool            limited;
+        /** 请求方法与路径 **/
+        std::string     method;
+        std::string     path;
+        /** :authority 对应的虚拟主机 **/
+        std::string     authority;
+        my_vhost*       vhost;
+        /** 是否接受gzip编码，以及客户端缓存的ETag **/
+        bool            accept_gzip;
+        std::string     if_none_match;
+        /** 应答体：文件、资源包的映射或内存中的错误页面；使用资源包时持有它的引用，
+            文件的fd属于虚拟主机的文件缓存表项 **/
+        my_pack*        pack;
+        my_cache::entry* file;
+        int             file_fd;
+        off_t           offset;
+        size_t          remain;
+        const char*     body;
+        /** 是否已在调度队列中 **/
+        bool            queued;
+        /** 已结束（发完或被重置），待发送队列中不再引用它时释放 **/
+        bool            closed;
+        /** 发送队列中引用该stream文件的分段数 **/
+        int             pending;
+    };
+
+private:
+    /** 解析读缓冲区中的完整帧，出现连接级错误时返回false（已排入GOAWAY） **/
+    bool process_frames();
+    bool on_headers(uint32_t id, uint8_t flags, const unsigned char* p, uint32_t len);
+    bool on_header_block(uint32_t id, bool end_stream);
+    bool on_settings(uint8_t flags, const unsigned char* p, uint32_t len);
+    bool on_window_update(uint32_t id, const unsigned char* p, uint32_t len);
+    bool on_data(uint32_t id, uint32_t len);
+    bool on_rst_stream(uint32_t id, uint32_t len);
+
+    /** 为请求头已完整的stream打开文件，生成应答头；nonblocking为true时只处理不需要访问文件系统的，
+        其余的留在m_opened中，全部处理完时返回true **/
+    bool open_streams(bool nonblocking);
+    /** 轮转地为各stream生成DATA帧，受窗口与本轮预算限制 **/
+    void schedule();
+    /** 是否还有stream可以在窗口内发送数据 **/
+    bool sendable() const;
+
+    void append_frame_header(uint8_t type, uint8_t flags, uint32_t id, size_t len);
+    void append_frame(uint8_t type, uint8_t flags, uint32_t id, const char* payload, size_t len);
+    void append_file(stream* s, size_t len);
+    void rst_stream(uint32_t id, uint32_t code);
+    void goaway(uint32_t code);
+    void close_stream(stream* s);
+    void release(stream* s);
+
+    /** 发送队列中一个stream的文件分段发完 **/
+    static void on_sent(void* arg, void* owner);
+
+    /** 非阻塞地读：返回1表示读满缓冲区，0表示EAGAIN，-1表示出错或对端关闭 **/
+    int fill();
+
+private:
+    my_httpconn*                            m_conn;
+    my_socket*                              m_sock;
+    my_hpack                                m_hpack;
+
+    char*                                   m_read_buf;
+    int                                     m_read_idx;
+    int                                     m_check_idx;
+    my_outqueue                             m_out;
+
+    std::unordered_map<uint32_t, stream*>   m_streams;
+    /** 等待打开文件的stream **/
+    std::vector<uint32_t>                   m_opened;
+    /** 有数据待发送的stream，轮转调度 **/
+    std::deque<uint32_t>                    m_ready;
+    uint32_t                                m_last_stream_id;
+
+    /** 跨CONTINUATION帧累积的头部块 **/
+    std::string                             m_header_block;
+    uint32_t                                m_header_stream;
+    bool                                    m_header_end_stream;
+
+    /** 连接级发送窗口与对端的SETTINGS **/
+    int64_t                                 m_conn_window;
+    int64_t                                 m_peer_initial_window;
+    uint32_t                                m_peer_max_frame;
+
+    /** 收到GOAWAY后不再接受新stream，发完已有的应答后结束 **/
+    bool                                    m_goaway_recv;
+    /** 已发送GOAWAY，发完缓冲区后关闭连接 **/
+    bool                                    m_closing;
+};
+
+#endif
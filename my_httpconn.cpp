@@ -1,4 +1,14 @@
 #include "my_httpconn.h"
+#include "my_threadpool.h"
+#include "my_http2.h"
+#include "my_upload.h"
+#include "my_proxy.h"
+#include "my_aio.h"
+#include "my_config.h"
+#include "my_stats.h"
+#include "my_tls.h"
+#include "my_websocket.h"
+#include "my_sse.h"
 
 int setnobolcking(int fd)
 {
@@ -18,6 +28,7 @@ void addfd(int epollfd, int fd, bool one_shot)
         event.events = event.events | EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    setnobolcking(fd);                  // 边沿触发必须配合非阻塞fd，否则读写到没有数据时会阻塞住整个线程
 }
 
 void removefd(int epollfd, int fd)
@@ -34,125 +45,396 @@ void modfd(int epollfd, int fd, int ev)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int my_httpconn::m_user_count = 0;
+std::atomic<int> my_httpconn::m_user_count(0);
 int my_httpconn::m_epollfd = -1;
+threadpool<my_httpconn>* my_httpconn::m_pool = NULL;
+std::atomic<bool> my_httpconn::m_draining(false);
+thread_local bool my_httpconn::m_on_worker = false;
 
 void my_httpconn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
-        removefd(m_epollfd, m_sockfd);
+        my_capture::record(m_capture, my_capture::CLOSE);
+        m_capture = 0;
+        m_sock.detach();
+        /** 协程可能在工作线程上结束：fd一关闭，事件循环就可能accept到同一个fd并重新init这个槽位，
+            所以先清掉m_sockfd、减少计数，最后才关闭fd **/
+        int fd = m_sockfd;
         m_sockfd = -1;
-        m_user_count--;
+        m_user_count.fetch_sub(1, std::memory_order_release);
+        removefd(m_epollfd, fd);
     }
 }
 
-void my_httpconn::init(int sockfd, const sockaddr_in& addr)
+void my_httpconn::init(int sockfd, const struct sockaddr* addr, socklen_t addr_len, bool tls)
 {
     m_sockfd = sockfd;
-    m_address = addr;
+    m_trace = 0;
+    m_accepted = my_trace::enabled() ? my_trace::now() : 0;
+    m_capture = my_capture::open_conn();
+    m_responses = m_answered = 0;
+    MY_PROBE(accept, sockfd, 0);
+    memset(&m_address, 0, sizeof(m_address));
+    memcpy(&m_address, addr, addr_len < sizeof(m_address) ? addr_len : sizeof(m_address));
+    m_address.ss_family = addr->sa_family;      // 本地socket上匿名的客户端只返回地址族
+    const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+    if (addr->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+    {
+        /** 双栈监听上的IPv4客户端（::ffff:a.b.c.d）按IPv4对待，限速与X-Forwarded-For都和IPv4监听上一致 **/
+        struct sockaddr_in* in = (struct sockaddr_in*)&m_address;
+        uint16_t port = in6->sin6_port;
+        struct in_addr v4;
+        memcpy(&v4, &in6->sin6_addr.s6_addr[12], 4);
+        memset(&m_address, 0, sizeof(m_address));
+        in->sin_family = AF_INET;
+        in->sin_port = port;
+        in->sin_addr = v4;
+    }
 
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (addr->sa_family != AF_UNIX)
+    {
+        /** 发送队列自己用MSG_MORE把应答头与应答体合并成完整的报文段，应答的最后一段应该立即发出，
+            不能让Nagle算法等对端的延迟确认 **/
+        int nodelay = 1;
+        setsockopt(m_sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    if (my_config::m_busy_poll > 0)     // 忙轮询模式下读socket时直接轮询网卡队列，而不是等中断；没有权限时内核会拒绝，忽略即可
+    {
+        setsockopt(m_sockfd, SOL_SOCKET, SO_BUSY_POLL, &my_config::m_busy_poll, sizeof(my_config::m_busy_poll));
+#ifdef SO_PREFER_BUSY_POLL
+        int prefer = 1;
+        setsockopt(m_sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+    }
 
     addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    m_sock.attach(sockfd);
+    m_user_count.fetch_add(1, std::memory_order_relaxed);
+    if (tls)
+    {
+        struct ssl_st* ssl = my_tls::create(sockfd);
+        if (!ssl)
+        {
+            close_conn();
+            return;
+        }
+        m_sock.set_tls(ssl);
+    }
+
+    if (!m_parse)                       // 解析器只在第一次使用该槽位时分配，之后复用
+        m_parse = new my_parse();
+    else
+        m_parse->init();
+    m_parse->m_peer = (const struct sockaddr*)&m_address;
 
-    m_parse = new my_parse();
+    serve().start();                    // 在事件循环线程上启动协程，它会一直运行到第一次需要等待数据
 }
 
-bool my_httpconn::read()
+void my_httpconn::close_idle()
 {
-    if (m_parse->m_read_idx > m_parse->READ_BUFFER_SIZE)
-        return false;
-    
-    int byte_read = 0;
-    while (1)
-    {
-        byte_read = recv(m_sockfd, m_parse->m_read_buf + m_parse->m_read_idx, 
-                        m_parse->READ_BUFFER_SIZE - m_parse->m_read_idx, 0);
-        if (byte_read == -1)
-        {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                break;
-            return false;
-        }
-        else if (byte_read == 0)
-        {
-            return false;
-        }
+    /** 关闭读方向，挂起的读取返回0，连接协程自己走正常的关闭流程 **/
+    if (m_sockfd != -1 && m_idle.load(std::memory_order_acquire))
+        shutdown(m_sockfd, SHUT_RD);
+}
 
-        m_parse->m_read_idx += byte_read;
-    }
-    return true;
+void my_httpconn::peer_name(char* buf, size_t len) const
+{
+    if (m_address.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((const struct sockaddr_in*)&m_address)->sin_addr, buf, len);
+    else if (m_address.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6*)&m_address)->sin6_addr, buf, len);
+    else
+        snprintf(buf, len, "unix:");
 }
 
+bool my_httpconn::offload_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    m_conn->m_resume = h;
+    m_conn->m_bulk = m_bulk;
+    m_conn->m_queued = my_trace::now();
+    MY_PROBE(queue__enter, m_conn->m_sockfd, m_conn->m_trace);
+    if (m_pool->append(m_conn, m_bulk ? LANE_BULK : LANE_FAST))
+        return true;
+    my_stats::add(my_stats::POOL_FULL);
+    return false;                       // 请求队列满时协程直接在当前线程继续执行
+}
+
+bool my_httpconn::nonblocking()
+{
+    return my_config::m_dispatch_hybrid && !m_on_worker && m_pool;
+}
+
+void my_httpconn::count_request()
+{
+    my_stats::add(m_on_worker ? my_stats::REQUESTS_OFFLOADED : my_stats::REQUESTS_INLINE);
+}
+
+/** 由线程池的工作线程调用 **/
+void my_httpconn::process()
+{
+    m_on_worker = true;
+    MY_PROBE(queue__leave, m_sockfd, m_trace);
+    uint64_t now = my_trace::now();
+    uint64_t waited = (now - m_queued) / 1000;
+    my_stats::add(m_bulk ? my_stats::POOL_BULK_JOBS : my_stats::POOL_FAST_JOBS);
+    my_stats::add(m_bulk ? my_stats::POOL_BULK_WAIT_US : my_stats::POOL_FAST_WAIT_US, waited);
+    if (waited >= 1000)
+        my_stats::add(m_bulk ? my_stats::POOL_BULK_WAIT_1MS : my_stats::POOL_FAST_WAIT_1MS);
+    if (m_trace)
+        my_trace::record(my_trace::QUEUE, m_trace, m_queued, now);
+    std::coroutine_handle<> h = m_resume;
+    m_resume = nullptr;
+    h.resume();
+}
 
-bool my_httpconn::write()
+/** 这是处理HTTP连接的入口协程 **/
+my_task<> my_httpconn::serve()
 {
-    int temp = 0;
-    int byte_have_send = 0;
-    int byte_to_send = m_parse->m_write_idx;
-    
-    if (byte_to_send == 0)
+    if (m_sock.tls() && !co_await handshake())
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        m_parse->init();
-        return true;
+        close_conn();
+        co_return;
     }
 
+    bool first = true;                  // 只有连接上的第一个请求可能是HTTP/2前言
     while (1)
     {
-        temp = writev(m_sockfd, m_parse->m_iv, m_parse->m_iv_count);
-        if (temp <= -1)
+        /** 读取并解析，直到得到一个完整的请求。缓冲区里还有流水线请求的剩余数据时先直接解析 **/
+        my_parse::HTTP_CODE read_ret = my_parse::NO_REQUEST;
+        bool need_read = (m_parse->m_check_idx >= m_parse->m_read_idx);
+        bool started = false;
+        uint64_t request_start = 0;
+        while (read_ret == my_parse::NO_REQUEST)
         {
-            if (errno == EAGAIN)
+            if (need_read)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
-                return true;
+                if (m_parse->m_read_idx >= my_parse::READ_BUFFER_SIZE)
+                {
+                    read_ret = my_parse::BAD_REQUEST;     // 请求头超过了读缓冲区
+                    break;
+                }
+                m_idle.store(!started && !first, std::memory_order_release);   // 刚accept的连接请求马上就到，不算空闲
+                ssize_t byte_read = co_await read(m_parse->m_read_buf + m_parse->m_read_idx,
+                                                  my_parse::READ_BUFFER_SIZE - m_parse->m_read_idx);
+                m_idle.store(false, std::memory_order_release);
+                if (byte_read <= 0)                       // 对端关闭或出错
+                {
+                    close_conn();
+                    co_return;
+                }
+                m_parse->m_read_idx += byte_read;
             }
-            m_parse->unmap();                    // 如果是其他错误导致的writev返回-1，则解除内存映射，返回false
-            return false;
-        }
-        
-        byte_to_send -= temp;
-        byte_have_send += temp;
-        if (byte_to_send <= byte_have_send)             
-        {
-            m_parse->unmap();
-            if (m_parse->m_linger)
+            need_read = true;
+
+            if (!started)                   // 请求的第一批数据已经在缓冲区里，从这里开始计时
             {
-                m_parse->init();
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return true;
+                started = true;
+                m_trace = my_trace::sample();
+                request_start = trace_now();
+                if (first)
+                    trace(my_trace::CONNECT, m_accepted);
+                MY_PROBE(request__start, m_sockfd, m_trace);
             }
-            else 
+
+            if (first)
+            {
+                int preface = my_http2::check_preface(m_parse->m_read_buf, m_parse->m_read_idx);
+                if (preface == 0)                         // 还不能确定是不是前言，继续读
+                    continue;
+                if (preface == 1)
+                {
+                    capture_abandon();
+                    co_await serve_h2();
+                    close_conn();
+                    co_return;
+                }
+            }
+
+            /** 混合调度时先在当前线程解析，缓存命中、资源包、错误应答直接在这里完成，
+                只有需要stat/open的请求才切换到工作线程，省掉一次线程切换 **/
+            if (!my_config::m_dispatch_hybrid)
+                co_await offload();
+            uint64_t start = trace_now();
+            read_ret = m_parse->process_read(nonblocking());
+            trace(my_trace::PARSE, start);
+            MY_PROBE(parse__done, m_sockfd, m_trace);
+            if (read_ret == my_parse::OFFLOAD_REQUEST)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return false;
+                co_await offload(m_parse->bulk_request());
+                start = trace_now();
+                read_ret = m_parse->do_request(false);
+                trace(my_trace::DO_REQUEST, start);
+                MY_PROBE(request__done, m_sockfd, m_trace);
             }
         }
+        count_request();
+
+        if (read_ret == my_parse::UPLOAD_REQUEST)
+        {
+            capture_abandon();                            // 请求体直接splice进文件，不经过读缓冲区
+            co_await offload(true);                       // 创建临时文件、写文件都在工作线程中进行，占用线程较久
+            uint64_t start = trace_now();
+            read_ret = co_await serve_upload();
+            trace(my_trace::UPLOAD, start);
+        }
+        else if (read_ret == my_parse::PROXY_REQUEST)
+        {
+            if (m_parse->m_chunked || m_parse->m_content_length > 0)
+                capture_abandon();                        // 请求体由转发直接从socket读走
+            uint64_t start = trace_now();
+            read_ret = co_await serve_proxy();
+            trace(my_trace::PROXY, start);
+        }
+        else if (read_ret == my_parse::SSE_PUBLISH)
+            co_await serve_publish();
+
+        if (m_draining.load(std::memory_order_acquire))
+            m_parse->m_linger = false;                    // 应答带上Connection: close，客户端下一个请求会连到新进程
+        if (!m_parse->process_write(read_ret))
+            break;
+
+        uint64_t write_start = trace_now();
+        MY_PROBE(write__start, m_sockfd, m_trace);
+        /** 应答还没有开始发socket里就有数据，客户端没有等这个应答（流水线），之后读到的数据不依赖它 **/
+        char peek;
+        bool pipelined = m_capture && recv(m_sockfd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+
+        /** 资源包的应答体在映射的内存中，发送之前先确认这些页已经读入，避免事件循环线程缺页等待磁盘 **/
+        if (read_ret == my_parse::PACK_REQUEST &&
+            !co_await my_aio::prefetch(&m_sock, -1, 0, m_parse->m_asset.body, m_parse->m_asset.body_len))
+            break;
+        for (int i = 0; i < m_parse->m_iv_count; i++)
+            m_out.append(m_parse->m_iv[i].iov_base, m_parse->m_iv[i].iov_len);
+        if (m_parse->m_file_fd != -1)
+            m_out.append_file(m_parse->m_file_fd, 0, m_parse->m_file_stat.st_size, m_parse->m_cache_entry->map);
+        if (!co_await m_out.drain(&m_sock))
+            break;
+        trace(my_trace::WRITE, write_start);
+        trace(my_trace::REQUEST, request_start);
+        MY_PROBE(write__done, m_sockfd, m_trace);
+        m_responses++;
+        if (!pipelined)
+            m_answered = m_responses;
+        if (read_ret == my_parse::WEBSOCKET_REQUEST)
+        {
+            capture_abandon();
+            co_await serve_websocket();
+            break;
+        }
+        if (read_ret == my_parse::SSE_SUBSCRIBE)
+        {
+            capture_abandon();
+            co_await serve_sse();
+            break;
+        }
+
+        m_parse->close_file();
+        if (!m_parse->m_linger)
+            break;
+        m_parse->next_request();
+        first = false;
     }
+
+    m_out.clear();                      // 没发完的分段还引用着解析器的缓冲区与文件
+    m_parse->close_file();
+    close_conn();
 }
 
-/** 由线程池的工作线程调用，这是处理HTTP请求的入口函数 **/
-void my_httpconn::process()
+my_task<ssize_t> my_httpconn::read(char* buf, size_t len)
 {
-    my_parse::HTTP_CODE read_ret = m_parse->process_read();
-    if (read_ret == my_parse::NO_REQUEST)
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return ;
-    }
+    ssize_t n = co_await m_sock.read(buf, len);
+    if (n > 0 && m_capture)
+        my_capture::record(m_capture, my_capture::DATA, buf, n, m_answered);
+    co_return n;
+}
 
-    bool write_ret = m_parse->process_write(read_ret);
-    if (!write_ret)
+my_task<bool> my_httpconn::handshake()
+{
+    while (1)
     {
-        close_conn();
+        co_await offload();             // 密钥交换与证书签名的计算量大，每一步都放到工作线程上
+        int events = m_sock.accept_tls();
+        if (events == 0)
+            co_return true;
+        if (events < 0 || !co_await m_sock.wait(events))
+            co_return false;
     }
+}
 
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+my_task<my_parse::HTTP_CODE> my_httpconn::serve_upload()
+{
+    my_upload upload(this, &m_sock, m_parse);
+    co_return co_await upload.run();
+}
+
+my_task<my_parse::HTTP_CODE> my_httpconn::serve_proxy()
+{
+    char client_ip[INET6_ADDRSTRLEN];
+    peer_name(client_ip, sizeof(client_ip));
+    my_proxy proxy(this, &m_sock, m_parse, client_ip);
+    co_return co_await proxy.run();
+}
+
+my_task<bool> my_httpconn::to_loop()
+{
+    /** 在工作线程上时先等一次可写，socket总是可写的，事件循环马上就会在它自己的线程上恢复协程 **/
+    if (m_on_worker)
+        co_return co_await m_sock.wait(EPOLLOUT);
+    co_return true;
+}
+
+my_task<> my_httpconn::serve_websocket()
+{
+    /** 会话的定时器与缓冲区池只在事件循环线程上使用 **/
+    if (!co_await to_loop())
+        co_return;
+    my_websocket ws(&m_sock, m_parse);
+    co_await ws.run();
+}
+
+my_task<> my_httpconn::serve_sse()
+{
+    /** 订阅者链表只在事件循环线程上访问 **/
+    if (!co_await to_loop())
+        co_return;
+    my_sse sub(&m_sock, &m_out);
+    co_await sub.run();
 }
 
+my_task<> my_httpconn::serve_publish()
+{
+    /** 事件名取自查询串中的 event=NAME，只接受字母、数字与 _ - . **/
+    char event[65] = "";
+    const char* query = strchr(m_parse->m_url, '?');
+    const char* name = query ? strstr(query, "event=") : NULL;
+    if (name && (name[-1] == '?' || name[-1] == '&'))
+    {
+        name += 6;
+        size_t len = 0;
+        while (len < sizeof(event) - 1)
+        {
+            char c = name[len];
+            if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.')
+                break;
+            event[len++] = c;
+        }
+        event[len] = '\0';
+    }
 
+    /** 发布与订阅者都在事件循环线程上，广播时订阅者都挂起着，直接把事件放进它们的队列 **/
+    co_await to_loop();                 // 等待出错时同样是由事件循环恢复的
+    int delivered = my_sse::publish(event, m_parse->m_content, m_parse->m_content_length);
+    char body[64];
+    snprintf(body, sizeof(body), "delivered to %d subscribers\n", delivered < 0 ? 0 : delivered);
+    m_parse->m_body = body;
+}
 
+my_task<> my_httpconn::serve_h2()
+{
+    my_http2* h2 = new my_http2(this, &m_sock);
+    co_await h2->run(m_parse->m_read_buf, m_parse->m_read_idx);
+    delete h2;
+}
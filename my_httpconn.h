@@ -6,39 +6,106 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <atomic>
 #include "my_locker.h"
 #include "my_parse.h"
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_outqueue.h"
+#include "my_trace.h"
+#include "my_capture.h"
+
+template <typename T>
+class threadpool;
 
 class my_httpconn
 {
     friend class my_parse;
 public:
-    my_httpconn() { }   
+    my_httpconn() : m_sockfd(-1), m_parse(NULL), m_idle(false), m_bulk(false), m_trace(0), m_accepted(0), m_queued(0), m_capture(0), m_responses(0), m_answered(0) { }   
     ~my_httpconn() { delete m_parse; } 
 
-    /** 初始化新的连接 **/
-    void init(int sockfd, const sockaddr_in& addr);
+    /** 初始化新的连接，并启动该连接的处理协程；tls为true时连接先做TLS握手 **/
+    void init(int sockfd, const struct sockaddr* addr, socklen_t addr_len, bool tls = false);
     /** 关闭连接 **/
     void close_conn(bool real_close = true);
-    /** 处理客户请求 **/
+    /** 由线程池的工作线程调用，在工作线程上恢复连接协程 **/
     void process();
 
-    /** 非阻塞读操作 **/
-    bool read();
-    /** 非阻塞写操作 **/
-    bool write();
+    /** 把协程调度到线程池上继续执行，已经在工作线程上时不再切换；bulk为true时进入线程池的BULK通道 **/
+    struct offload_awaiter
+    {
+        my_httpconn* m_conn;
+        bool         m_bulk;
+
+        bool await_ready() { return m_on_worker || !m_pool; }
+        bool await_suspend(std::coroutine_handle<> h);
+        void await_resume() { }
+    };
+    offload_awaiter offload(bool bulk = false) { return offload_awaiter{this, bulk}; }
+
+    /** 混合调度时，在事件循环线程上只做不会阻塞的工作，需要访问文件系统时再交给线程池 **/
+    static bool nonblocking();
+    /** 当前请求是在哪里完成的，计入运行计数器 **/
+    static void count_request();
+    /** 升级后排空时由事件循环调用：连接正在等下一个请求时关闭它 **/
+    void close_idle();
+    /** 客户端的地址，双栈监听上的IPv4客户端已经还原成IPv4地址 **/
+    const struct sockaddr* peer() const { return (const struct sockaddr*)&m_address; }
+    /** 客户端地址的文本形式，本地socket上的客户端为 "unix:" **/
+    void peer_name(char* buf, size_t len) const;
+
+private:
+    /** 连接协程：读请求、解析、发送应答，循环直到连接关闭 **/
+    my_task<> serve();
+    /** TLS握手，失败时返回false **/
+    my_task<bool> handshake();
+    /** 连接以HTTP/2前言开头时，转入HTTP/2会话 **/
+    my_task<> serve_h2();
+    /** 流式接收PUT/POST的请求体 **/
+    my_task<my_parse::HTTP_CODE> serve_upload();
+    /** 把请求转发给反向代理的上游 **/
+    my_task<my_parse::HTTP_CODE> serve_proxy();
+    /** 握手完成后运行WebSocket会话，直到连接关闭 **/
+    my_task<> serve_websocket();
+    /** 应答头发出后把广播的事件发给订阅者，直到连接关闭 **/
+    my_task<> serve_sse();
+    /** 把读缓冲区中的请求体作为事件广播给所有订阅者 **/
+    my_task<> serve_publish();
+    /** 在工作线程上时切换回事件循环线程，出错时返回false **/
+    my_task<bool> to_loop();
+
+    /** 读取请求数据，录制时连同它依赖的应答数记进录制文件 **/
+    my_task<ssize_t> read(char* buf, size_t len);
+    /** 连接离开了HTTP/1.1请求应答的路径，录制的会话不能回放 **/
+    void capture_abandon()
+    {
+        my_capture::record(m_capture, my_capture::ABANDON);
+        m_capture = 0;
+    }
+
+    /** 当前请求被采样时取时间戳，否则返回0，不调用clock_gettime **/
+    uint64_t trace_now() const { return m_trace ? my_trace::now() : 0; }
+    /** 当前请求被采样时记一个从start到现在的区间 **/
+    void trace(my_trace::STAGE stage, uint64_t start) const
+    {
+        if (m_trace)
+            my_trace::record(stage, m_trace, start, my_trace::now());
+    }
 
 
 public: 
@@ -46,15 +113,40 @@ public:
     /** 所有的请求连接都会分配一个类的实例，而epollfd显然不希望与每个对象相关，只需要与类本身即可 **/
     /** 所有的连接的事件都被注册到同一个epoll事件内核表，而不是每个连接都会有自己的epoll事件内核表**/
     static int m_epollfd;
-    /** 统计用户数量 **/
-    static int m_user_count;
+    /** 统计用户数量；连接可能在工作线程上关闭，与事件循环上的accept并发增减 **/
+    static std::atomic<int> m_user_count;
+    /** 执行解析与磁盘操作的线程池 **/
+    static threadpool<my_httpconn>* m_pool;
+    /** 监听socket已经交给新进程，当前请求应答完就关闭连接 **/
+    static std::atomic<bool> m_draining;
 
 private:
-    /** 与http服务器连接的对方的sockfd和地址 **/
+    /** 与http服务器连接的对方的sockfd和地址（IPv4、IPv6或者本地socket） **/
     int                         m_sockfd;
-    sockaddr_in                 m_address;
+    sockaddr_storage            m_address;
+    /** 可等待的socket，协程通过它挂起与恢复 **/
+    my_socket                   m_sock;
+    /** 应答的发送队列：应答头与文件内容 **/
+    my_outqueue                 m_out;
     /** 用于解析http头部信息 **/
     my_parse*                   m_parse;
+    /** 等待线程池调度的协程 **/
+    std::coroutine_handle<>     m_resume;
+    /** 连接空闲：上一个请求已经应答，正在等下一个请求的第一批数据；协程可能在工作线程上写它，事件循环读它 **/
+    std::atomic<bool>           m_idle;
+    /** 在线程池的哪条通道里排队，取出时按通道统计等待时间 **/
+    bool                        m_bulk;
+    /** 当前请求的采样编号（0表示没有采样），accept的时间，进入线程池队列的时间（不论是否采样都记下） **/
+    uint32_t                    m_trace;
+    uint64_t                    m_accepted;
+    uint64_t                    m_queued;
+    /** 录制的连接编号（0表示没有录制），已经发完的应答数，之后读到的数据依赖的应答数 **/
+    uint32_t                    m_capture;
+    uint32_t                    m_responses;
+    uint32_t                    m_answered;
+
+    /** 当前线程是否为线程池的工作线程 **/
+    static thread_local bool    m_on_worker;
 };
 
 #endif 
\ No newline at end of file
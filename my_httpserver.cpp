@@ -9,10 +9,21 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <time.h>
 
 #include "my_locker.h"
 #include "my_threadpool.h"
 #include "my_httpconn.h"
+#include "my_config.h"
+#include "my_proxy.h"
+#include "my_pack.h"
+#include "my_aio.h"
+#include "my_tls.h"
+#include "my_timer.h"
+#include "my_listener.h"
+#include "my_trace.h"
+#include "my_upgrade.h"
+#include "my_capture.h"
 
 #define MAX_FD              65536
 #define MAX_EVENT_NUMBER    10000
@@ -33,6 +44,42 @@ void addsig(int sig, void(handler)(int), bool restart = true)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
+/** 收到SIGHUP时由事件循环重新加载资源包 **/
+static volatile sig_atomic_t reload_pack = 0;
+
+void sig_reload(int sig)
+{
+    reload_pack = 1;
+}
+
+/** 收到SIGUSR1时由事件循环把采样的请求区间写到文件 **/
+static volatile sig_atomic_t dump_trace = 0;
+
+void sig_dump_trace(int sig)
+{
+    dump_trace = 1;
+}
+
+/** 等待事件；忙轮询模式下先以0超时反复查询，空转budget微秒仍没有事件时才阻塞 **/
+static int wait_events(int epollfd, epoll_event* events, int budget)
+{
+    if (budget > 0)
+    {
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (1)
+        {
+            int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 0);
+            if (number != 0)
+                return number;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 >= budget)
+                break;
+        }
+    }
+    return epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+}
+
 void show_error(int connfd, const char* info)
 {
     printf("%s", info);
@@ -40,126 +87,173 @@ void show_error(int connfd, const char* info)
     close(connfd);
 }
 
+/** 监听socket是边沿触发的，一次可读事件之后要一直accept到EAGAIN，否则突发的连接会留在队列里直到下一个连接到来 **/
+static void accept_all(my_listener* listener, my_httpconn* users)
+{
+    while (1)
+    {
+        struct sockaddr_storage client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept(listener->m_fd, (struct sockaddr*)&client_address, &client_addrlen);   // 接收连接请求
+
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                printf("accept on %s: %s\n", listener->m_name, strerror(errno));
+            if (errno == EINTR)
+                continue;
+            break;                          // 队列已经取空，或者出错（比如fd用完），等下一次可读事件
+        }
+        if (my_httpconn::m_user_count.load(std::memory_order_relaxed) >= MAX_FD || connfd >= MAX_FD)
+        {
+            show_error(connfd, "Internal server busy");
+            continue;                       // 如果已连接的用户已经超过了描述符的最大值
+        }                                   // 说明此时已经肯定无法建立更多的连接了
+
+        /* 都没有问题的话，就给该连接请求分配一个连接处理实例 */ 
+        users[connfd].init(connfd, (struct sockaddr*)&client_address, client_addrlen, listener->m_tls);
+    }
+}
+
+/** 排空的期限到了 **/
+static bool drain_expired = false;
+
+static void on_drain_timeout(void* arg)
+{
+    drain_expired = true;
+}
+
+/** 监听socket已经交给新进程：停止accept，关闭空闲的连接，其余的连接应答完当前请求后关闭 **/
+static void start_drain(int epollfd, my_httpconn* users)
+{
+    static my_timer::entry deadline;
+    my_listener::close_all(epollfd);
+    my_httpconn::m_draining.store(true, std::memory_order_release);
+    for (int i = 0; i < MAX_FD; i++)
+        users[i].close_idle();
+    deadline.fn = on_drain_timeout;
+    my_timer::add(&deadline, (uint64_t)my_config::m_drain_timeout * 1000 / my_timer::TICK_MS);
+    printf("upgrade: stopped accepting, draining %d connections for up to %d seconds\n",
+           my_httpconn::m_user_count.load(std::memory_order_acquire), my_config::m_drain_timeout);
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc <= 2)
+    if (!my_config::parse(argc, argv))
     {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+        my_config::usage(basename(argv[0]));
         return 1;
     }
-    const char* ip = argv[1];    
-    int port = atoi(argv[2]);
+    if (argc - optind >= 2)             // 位置参数 ip_address port_number，以及同一个地址上的TLS端口
+    {
+        const char* ip = argv[optind];
+        if (!my_listener::add(ip, atoi(argv[optind + 1]), false) ||
+            (my_config::m_tls_port && !my_listener::add(ip, my_config::m_tls_port, true)))
+        {
+            printf("invalid ip_address: %s\n", ip);
+            return 1;
+        }
+    }
 
     addsig(SIGPIPE, SIG_IGN);
+    addsig(SIGHUP, sig_reload);
+    addsig(SIGUSR1, sig_dump_trace);
 
     threadpool<my_httpconn>* pool = NULL;
     try 
     {
-        pool = new threadpool<my_httpconn>;
+        pool = new threadpool<my_httpconn>(my_config::m_pool_threads, 10000, my_config::m_pool_reserved, my_config::m_pool_weight);
     }
     catch(...)
     {
         return 1;
     }
+    my_aio::start(my_config::m_io_threads);    // 读取不在页缓存中的文件的I/O线程
 
     /** 预先为每一个可能连接的客户分配一个http_conn对象 **/
     my_httpconn* users = new my_httpconn[MAX_FD];
     assert(users);                              // 如果分配失败，users为空，则将会异常
     int user_count = 0;                         // 记录当前用户连接数量
 
-    int listenfd  = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);                      // listenfd小于0的话说明发生了错误，发出异常
-    struct linger tmp = {1, 0};                 // 作为sock选项设置的参数，用于设置优雅退出，还是强制退出
-    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
-
-    int ret = 0;
-    struct sockaddr_in address;                 // 设置服务器的地址
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
-
-    ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-    assert(ret >= 0);
-
-    ret = listen(listenfd, 5);          // 5指的是LISTENQ监听队列的长度，即表示已完成连接数与正在完成连接数之和不超过5
-    assert(ret >= 0);                   // 我们要知道，内核为我们维护两个队列，一个是连接已完成队列，另一个是连接未完成队列
-                                        // 这两个队列对应的是TCP的握手过程，三次握手
-                                        // 1）客户端往服务器发送SYN报文，服务器处于SYN_RCVD，该客户端的请求即处于连接未完成队列
-                                        // 2）服务器往客户端发送SYNACK报文
-                                        // 3）客户端往服务器发送ACK报文。此时三次握手完成，连接建立，该请求转移到连接已完成队列
-                                        // 而只有当连接已完成时，该listenfd才处于可读状态，epoll通过这个状态来判断listenfd是否可读
-                                        // 已完成队列与未完成队列的总数量不超过5，若超过5，还有连接请求，那将会返回错误
-    
-    
+    /** 不停机升级：先从正在运行的旧进程那里接过监听socket **/
+    if (my_config::m_upgrade_socket && !my_upgrade::take_over(my_config::m_upgrade_socket))
+        return 1;
+    if (my_listener::has_tls() && !my_tls::init(my_config::m_tls_cert, my_config::m_tls_key))
+        return 1;                       // TLS监听地址上accept的连接先做握手
+
     epoll_event events[MAX_EVENT_NUMBER];   // 用于epoll_wait函数返回已经准备好的事件
     int epollfd = epoll_create(5);      // 5只是告诉内核，epoll表大概需要多大
     assert(epollfd != -1);
-    addfd(epollfd, listenfd, false);    // 把listenfd加入了监听表中，当有连接完成了，epoll就返回
+    if (!my_listener::open_all(epollfd))    // 把所有的监听socket加入监听表中
+        return 1;
     my_httpconn::m_epollfd = epollfd;
+    my_httpconn::m_pool = pool;
+    my_socket::m_epollfd = epollfd;
+    my_proxy::start();                  // 上游连接也注册在这个epoll上
+    if (!my_timer::start(epollfd))      // 定时器由事件循环驱动，回调都在这个线程上执行
+        return 1;
+    if (my_config::m_capture_file && !my_capture::open(my_config::m_capture_file, my_config::m_capture_max))
+        return 1;                       // 每个tick把录制的数据写一次文件
+    if (my_config::m_upgrade_socket && !my_upgrade::listen(my_config::m_upgrade_socket, epollfd))
+        return 1;                       // 已经在accept，通知旧进程停止，然后等待下一次升级
 
-    while (1)
+    while (!my_httpconn::m_draining.load(std::memory_order_acquire) ||
+           (my_httpconn::m_user_count.load(std::memory_order_acquire) > 0 && !drain_expired))
     {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);     // 开始监听，若没有连接发生，将阻塞于此
+        int number = wait_events(epollfd, events, my_config::m_busy_poll);  // 开始监听，若没有连接发生，将阻塞于此
         if ((number < 0) && (errno != EINTR))       // epoll_wait出错了
         {
             printf("epoll failure!\n");
             break;
         }
+        if (reload_pack)
+        {
+            reload_pack = 0;
+            my_pack::reload();
+        }
+        if (dump_trace)
+        {
+            dump_trace = 0;
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/my_httpserver.%d.trace.json", (int)getpid());
+            printf("%s trace to %s\n", my_trace::dump(path) ? "dumped" : "failed to dump", path);
+        }
 
         for (int i = 0; i < number; i++)            // 循环处理已准备好的事件
         {
             int sockfd = events[i].data.fd;         // 将sockfd赋值为此次事件的fd
-            if (sockfd == listenfd)                 // 如果是listenfd准备好了，即有连接已完成
+            if (i + 1 < number)
+                my_socket::prefetch(events[i + 1].data.fd);
+            if (sockfd == my_timer::fd())
             {
-                struct sockaddr_in client_address;  
-                socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);   // 接收连接请求
-
-                if (connfd < 0)
-                {
-                    printf("errno is: %d", errno);
-                    continue;                       // 如果出错了，则继续处理下一个已准备的事件
-                }
-                if (my_httpconn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server busy");
-                    continue;                       // 如果已连接的用户已经超过了描述符的最大值
-                }                                   // 说明此时已经肯定无法建立更多的连接了
-
-                /* 都没有问题的话，就给该连接请求分配一个连接处理实例 */ 
-                users[connfd].init(connfd, client_address);
+                my_timer::tick();
             }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            else if (my_upgrade::owns(sockfd))
             {
-                users[sockfd].close_conn();         // 如果发现有异常情况，则直接关闭与客户端的连接
-                                                    // 用的是close(fd)，优雅关闭方式
+                if (my_upgrade::on_event(sockfd, epollfd))
+                    start_drain(epollfd, users);
             }
-            else if (events[i].events & EPOLLIN)    // 如果是读事件就绪了
+            else if (my_listener* listener = my_listener::find(sockfd))   // 如果是监听socket准备好了，即有连接已完成
             {
-                if (users[sockfd].read())           // 根据读的结果来判断是否要把任务添加到线程池，还是关闭连接
-                {                                   // 因为只有当真正读入了数据时，read才会返回1，出错或者为空等返回0
-                    pool->append(users + sockfd);   // 把任务加入到线程池，当线程池为空时，将会阻塞等待任务的到来 
-                }                                   // 当把任务加进线程池后，线程池
-                else 
-                {
-                    users[sockfd].close_conn();     // 如果read返回的是0，则直接关闭连接
-                }
+                accept_all(listener, users);
             }
-            else if (events[i].events & EPOLLOUT)   // 如果是写时间就绪了
+            else
             {
-                if (!users[sockfd].write())         // 那就执行写操作，根据写操作的执行结果来决定是否关闭这个连接
-                {
-                    users[sockfd].close_conn();     // 如果写操作返回错误，则关闭该连接
-                }
-                else 
-                {   }                               // 如果写入成功，则什么也不用做
-            }
+                my_socket::dispatch(sockfd, events[i].events);  // 其余的读写事件和异常事件，直接恢复挂起在该fd上的连接协程
+            }                                                   // 协程自己决定继续读写、交给线程池还是关闭连接
         }
     }
 
+    if (my_httpconn::m_draining.load(std::memory_order_acquire))
+    {
+        /** 工作线程与期限到了还没有结束的连接协程都还挂着，不去析构它们，直接退出 **/
+        printf("upgrade: drained, %d connections left, exiting\n", my_httpconn::m_user_count.load(std::memory_order_acquire));
+        my_capture::flush();
+        fflush(stdout);
+        _exit(0);
+    }
+
     close(epollfd);
-    close(listenfd);
     delete [] users;
     delete [] pool;
     
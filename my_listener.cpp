@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string>
+#include "my_listener.h"
+#include "my_upgrade.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+extern void removefd(int epollfd, int fd);
+
+my_listener my_listener::m_listeners[my_listener::MAX_LISTENERS];
+int my_listener::m_count = 0;
+
+bool my_listener::add(const char* spec)
+{
+    if (m_count >= MAX_LISTENERS)
+        return false;
+    my_listener& l = m_listeners[m_count];
+    snprintf(l.m_name, sizeof(l.m_name), "%s", spec);
+    memset(&l.m_addr, 0, sizeof(l.m_addr));
+    l.m_fd = -1;
+    l.m_tls = false;
+    if (strncmp(spec, "tls:", 4) == 0)
+    {
+        l.m_tls = true;
+        spec += 4;
+    }
+
+    if (strncmp(spec, "unix:", 5) == 0)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)&l.m_addr;
+        const char* path = spec + 5;
+        if (*path == '\0' || strlen(path) >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        l.m_addr_len = sizeof(struct sockaddr_un);
+        m_count++;
+        return true;
+    }
+
+    const char* colon = strrchr(spec, ':');
+    if (!colon || colon == spec || colon[1] == '\0')
+        return false;
+    std::string host(spec, colon - spec);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')    // [::]:8080
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0)
+        return false;
+    memcpy(&l.m_addr, res->ai_addr, res->ai_addrlen);
+    l.m_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    m_count++;
+    return true;
+}
+
+bool my_listener::add(const char* ip, int port, bool tls)
+{
+    char spec[128];
+    snprintf(spec, sizeof(spec), strchr(ip, ':') ? "%s[%s]:%d" : "%s%s:%d", tls ? "tls:" : "", ip, port);
+    return add(spec);
+}
+
+bool my_listener::has_tls()
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        if (m_listeners[i].m_tls)
+            return true;
+    }
+    return false;
+}
+
+bool my_listener::open(int epollfd)
+{
+    m_fd = my_upgrade::inherited(m_name);
+    if (m_fd != -1)                     // 旧进程交过来的，已经在监听，连接队列中的连接都还在
+    {
+        addfd(epollfd, m_fd, false);
+        return true;
+    }
+
+    int family = m_addr.ss_family;
+    m_fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        printf("listen %s: socket: %s\n", m_name, strerror(errno));
+        return false;
+    }
+
+    if (family == AF_UNIX)
+    {
+        /** 上次运行留下的socket文件会让bind失败，只删除socket，不碰同名的其他文件 **/
+        const char* path = ((struct sockaddr_un*)&m_addr)->sun_path;
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+    }
+    else
+    {
+        struct linger tmp = {0, 0};             // 作为sock选项设置的参数，用于设置优雅退出，还是强制退出
+                                                // accept得到的socket会继承该选项，{1, 0}会让close直接发RST，丢掉还没发出去的应答，所以用优雅退出
+        setsockopt(m_fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        int reuse = 1;                          // 重启时上一个进程留下的TIME_WAIT连接不妨碍bind
+        setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (family == AF_INET6)
+        {
+            int v6only = 0;                     // 双栈：[::]上同时接受IPv4的连接，对端地址是::ffff:a.b.c.d
+            setsockopt(m_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        }
+    }
+
+    if (bind(m_fd, (struct sockaddr*)&m_addr, m_addr_len) < 0)
+    {
+        printf("listen %s: bind: %s\n", m_name, strerror(errno));
+        return false;
+    }
+
+    // 内核为每个监听socket维护两个队列，一个是连接已完成队列，另一个是连接未完成队列
+    // 这两个队列对应的是TCP的握手过程，三次握手
+    // 1）客户端往服务器发送SYN报文，服务器处于SYN_RCVD，该客户端的请求即处于连接未完成队列
+    // 2）服务器往客户端发送SYNACK报文
+    // 3）客户端往服务器发送ACK报文。此时三次握手完成，连接建立，该请求转移到连接已完成队列
+    // 而只有当连接已完成时，该listenfd才处于可读状态，epoll通过这个状态来判断listenfd是否可读
+    // backlog是已完成队列的长度，队列满了之后新的连接会被内核丢弃或者推迟，突发的连接很容易超过一个很小的值
+    if (listen(m_fd, SOMAXCONN) < 0)
+    {
+        printf("listen %s: listen: %s\n", m_name, strerror(errno));
+        return false;
+    }
+    addfd(epollfd, m_fd, false);        // 当有连接完成了，epoll就返回
+    return true;
+}
+
+bool my_listener::open_all(int epollfd)
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        if (!m_listeners[i].open(epollfd))
+            return false;
+    }
+    return true;
+}
+
+void my_listener::close_all(int epollfd)
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        if (m_listeners[i].m_fd != -1)
+        {
+            removefd(epollfd, m_listeners[i].m_fd);     // 其他进程还持有这个socket，必须先从epoll中删除再关闭
+            m_listeners[i].m_fd = -1;
+        }
+    }
+}
+
+my_listener* my_listener::find(int fd)
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        if (m_listeners[i].m_fd == fd)
+            return &m_listeners[i];
+    }
+    return NULL;
+}
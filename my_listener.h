@@ -0,0 +1,52 @@
+#ifndef _MY_LISTENER_H_
+#define _MY_LISTENER_H_
+
+#include <sys/socket.h>
+
+/*
+*   监听socket：命令行的 ip_address port_number、--tls-port 与每个 --listen 各是一个
+*   地址可以是 host:port（IPv4）、[v6]:port（IPv6，[::]同时接受IPv4的连接）或者 unix:/path（本地socket），
+*   前面加 tls: 表示在它上面accept的连接先做TLS握手。
+*   所有监听socket都注册在同一个epoll上，accept出来的连接进入同一张连接表，由同一个事件循环驱动；
+*   监听socket是边沿触发的，每次可读时要一直accept到EAGAIN。
+*   不停机升级时（my_upgrade.h）地址相同的监听socket直接从旧进程接过来，不再创建
+*/
+
+class my_listener
+{
+public:
+    static const int MAX_LISTENERS = 16;
+
+    /** 解析 [tls:]ADDR 并加入监听列表，出错返回false **/
+    static bool add(const char* spec);
+    /** 加入ip:port，ip中含有':'时为IPv6 **/
+    static bool add(const char* ip, int port, bool tls);
+    static int count() { return m_count; }
+    static my_listener* at(int i) { return &m_listeners[i]; }
+    /** 是否有需要TLS的监听地址 **/
+    static bool has_tls();
+
+    /** 创建所有的监听socket并加入epoll，出错时打印原因并返回false **/
+    static bool open_all(int epollfd);
+    /** 停止accept：从epoll中移除并关闭所有的监听socket（交接给新进程之后） **/
+    static void close_all(int epollfd);
+    /** fd是监听socket时返回它，否则返回NULL **/
+    static my_listener* find(int fd);
+
+public:
+    int                     m_fd;
+    bool                    m_tls;
+    struct sockaddr_storage m_addr;
+    socklen_t               m_addr_len;
+    /** 配置中的原文，用于出错信息 **/
+    char                    m_name[128];
+
+private:
+    bool open(int epollfd);
+
+private:
+    static my_listener  m_listeners[MAX_LISTENERS];
+    static int          m_count;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "my_outqueue.h"
+#include "my_aio.h"
+
+void my_outqueue::append(const void* data, size_t len, void* owner)
+{
+    if (len == 0)
+        return;
+    segment seg = { (const char*)data, std::string(), -1, 0, len, NULL, 0, owner };
+    m_segments.push_back(seg);
+    m_pending += len;
+}
+
+void my_outqueue::append_copy(const void* data, size_t len)
+{
+    if (m_segments.empty() || m_segments.back().fd != -1 || m_segments.back().data)
+    {
+        segment seg = { NULL, std::string(), -1, 0, 0, NULL, 0, NULL };
+        m_segments.push_back(seg);
+    }
+    segment& seg = m_segments.back();
+    seg.buf.append((const char*)data, len);         // 可能重新分配，发送时每次都从buf.data()重新取地址
+    seg.len += len;
+    m_pending += len;
+}
+
+void my_outqueue::append_file(int fd, off_t offset, size_t len, const char* map, void* owner)
+{
+    segment seg = { NULL, std::string(), fd, offset, len, map, offset, owner };
+    m_segments.push_back(seg);
+    m_pending += len;
+}
+
+void my_outqueue::pop()
+{
+    void* owner = m_segments.front().owner;
+    m_pending -= m_segments.front().len;
+    m_segments.pop_front();
+    if (owner && m_done)
+        m_done(m_done_arg, owner);
+}
+
+void my_outqueue::clear()
+{
+    while (!m_segments.empty())
+        pop();
+}
+
+void my_outqueue::advance(size_t n)
+{
+    while (n > 0)
+    {
+        segment& seg = m_segments.front();
+        size_t step = n < seg.len ? n : seg.len;
+        seg.offset += step;
+        seg.len -= step;
+        m_pending -= step;
+        n -= step;
+        if (seg.len == 0)
+            pop();
+    }
+}
+
+int my_outqueue::flush(my_socket* sock)
+{
+    while (!m_segments.empty())
+    {
+        segment& front = m_segments.front();
+        if (front.fd != -1)
+        {
+            size_t len = front.len;
+            if (front.map)                              // 只发送已经确认在页缓存中的部分
+            {
+                if (front.offset >= front.hot)
+                    return FLUSH_PREFETCH;
+                len = front.hot - front.offset;
+            }
+            off_t offset = front.offset;
+            ssize_t n = sock->send_file(front.fd, &offset, len);
+            if (n < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? FLUSH_AGAIN : FLUSH_ERROR;
+            if (n == 0)                                 // 文件被截断了
+                return FLUSH_ERROR;
+            advance(n);
+            continue;
+        }
+
+        /** 把开头连续的内存分段收集起来一次写出 **/
+        struct iovec iv[IOV_MAX];
+        int count = 0;
+        for (size_t i = 0; i < m_segments.size() && count < IOV_MAX && m_segments[i].fd == -1; i++)
+        {
+            segment& seg = m_segments[i];
+            const char* base = seg.data ? seg.data : seg.buf.data();
+            iv[count].iov_base = (void*)(base + seg.offset);
+            iv[count].iov_len = seg.len;
+            count++;
+        }
+        bool more = (size_t)count < m_segments.size();  // 后面还有数据（通常是文件内容），让内核合并成完整的报文段
+        ssize_t n = sock->send_some(iv, count, more);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? FLUSH_AGAIN : FLUSH_ERROR;
+        advance(n);
+    }
+    return FLUSH_DONE;
+}
+
+my_task<bool> my_outqueue::prefetch(my_socket* sock)
+{
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        segment& seg = m_segments[i];
+        if (seg.fd == -1 || !seg.map || seg.offset < seg.hot)
+            continue;
+        size_t window = seg.len < my_aio::WINDOW ? seg.len : my_aio::WINDOW;
+        if (!co_await my_aio::prefetch(sock, seg.fd, seg.offset, seg.map + seg.offset, window))
+            co_return false;
+        seg.hot = seg.offset + window;
+    }
+    co_return true;
+}
+
+my_task<bool> my_outqueue::drain(my_socket* sock)
+{
+    while (1)
+    {
+        if (!co_await prefetch(sock))
+            co_return false;
+        int ret = flush(sock);
+        if (ret == FLUSH_DONE)
+            co_return true;
+        if (ret == FLUSH_ERROR)
+            co_return false;
+        if (ret == FLUSH_AGAIN && !co_await sock->wait(EPOLLOUT))
+            co_return false;
+    }
+}
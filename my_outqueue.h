@@ -0,0 +1,81 @@
+#ifndef _MY_OUTQUEUE_H_
+#define _MY_OUTQUEUE_H_
+
+#include <sys/types.h>
+#include <string>
+#include <deque>
+#include "my_coroutine.h"
+#include "my_socket.h"
+
+/*
+*   连接的发送队列：按顺序排列的内存分段与文件分段
+*   连续的内存分段合并成一次sendmsg（最多IOV_MAX个），文件分段用sendfile零拷贝发送，
+*   部分写出时精确地推进到写出的位置，下次从那里继续。
+*   队列里后面还有数据时带MSG_MORE发送，相当于在应答头与应答体之间cork，最后一段不带，相当于uncork。
+*   文件分段给出了映射时，每个窗口先由my_aio确认在页缓存中再发送。
+*   TLS连接上由my_socket决定是直接交给内核（明文或内核TLS）还是先在用户态加密
+*/
+
+class my_outqueue
+{
+public:
+    /** flush的返回值 **/
+    enum FLUSH_RESULT { FLUSH_ERROR = -1, FLUSH_AGAIN = 0, FLUSH_DONE = 1, FLUSH_PREFETCH = 2 };
+    /** 分段发完时的回调，owner为加入分段时给出的值 **/
+    typedef void (*done_fn)(void* arg, void* owner);
+
+    my_outqueue() : m_pending(0), m_done(NULL), m_done_arg(NULL) { }
+    ~my_outqueue() { clear(); }
+
+    void set_done(done_fn fn, void* arg) { m_done = fn; m_done_arg = arg; }
+
+    /** 引用外部内存，不拷贝，调用者保证它在发完之前有效；给出owner时发完（或丢弃）后回调 **/
+    void append(const void* data, size_t len, void* owner = NULL);
+    /** 拷贝数据到队列自己的缓冲区，与前面同样是拷贝的分段合并 **/
+    void append_copy(const void* data, size_t len);
+    /** 文件fd的[offset, offset+len)，map为文件的映射（可以为NULL），用于检查数据是否在页缓存中 **/
+    void append_file(int fd, off_t offset, size_t len, const char* map, void* owner = NULL);
+
+    bool empty() const { return m_segments.empty(); }
+    /** 已经排队但还没有交给内核的字节数，用于背压 **/
+    size_t pending() const { return m_pending; }
+    /** 丢弃所有分段，分段的owner同样会收到回调 **/
+    void clear();
+
+    /** 非阻塞地发送，返回FLUSH_RESULT；FLUSH_PREFETCH表示下一段文件数据需要先prefetch **/
+    int flush(my_socket* sock);
+    /** 确认队列中文件分段的数据在页缓存中，不在时挂起直到I/O线程读入 **/
+    my_task<bool> prefetch(my_socket* sock);
+    /** 发完队列中的全部数据，出错或对端关闭时返回false **/
+    my_task<bool> drain(my_socket* sock);
+
+private:
+    struct segment
+    {
+        /** 内存分段：data为NULL时数据在buf中 **/
+        const char*     data;
+        std::string     buf;
+        /** 文件分段的fd，内存分段为-1 **/
+        int             fd;
+        /** 内存分段已经发出的字节数，或者文件分段下一次发送的偏移 **/
+        off_t           offset;
+        /** 剩余的字节数 **/
+        size_t          len;
+        const char*     map;
+        /** 文件分段[offset, hot)已经确认在页缓存中 **/
+        off_t           hot;
+        void*           owner;
+    };
+
+    /** 推进n个已经写出的字节，发完的分段出队 **/
+    void advance(size_t n);
+    void pop();
+
+private:
+    std::deque<segment>     m_segments;
+    size_t                  m_pending;
+    done_fn                 m_done;
+    void*                   m_done_arg;
+};
+
+#endif
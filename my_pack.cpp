@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "my_pack.h"
+
+std::atomic<my_pack*> my_pack::m_current(NULL);
+mutex_locker my_pack::m_locker;
+char my_pack::m_path[256];
+
+my_pack::~my_pack()
+{
+    if (m_base)
+        munmap(m_base, m_size);
+}
+
+bool my_pack::map(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(pack_header))
+    {
+        close(fd);
+        return false;
+    }
+    m_size = st.st_size;
+    void* base = mmap(NULL, m_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);   // 预先读入所有页，之后应答不会缺页
+    close(fd);                          // 映射建立之后不再需要fd
+    if (base == MAP_FAILED)
+        return false;
+    m_base = (char*)base;
+
+    m_header = (const pack_header*)m_base;
+    if (memcmp(m_header->magic, MAGIC, sizeof(MAGIC)) != 0 || m_header->version != VERSION ||
+        m_header->file_size != m_size || m_header->buckets == 0)
+        return false;
+    if (!check_range(m_header->seeds_offset, (uint64_t)m_header->buckets * sizeof(uint32_t)) ||
+        !check_range(m_header->entries_offset, (uint64_t)m_header->count * sizeof(pack_entry)) ||
+        m_header->seeds_offset % sizeof(uint32_t) != 0 || m_header->entries_offset % sizeof(uint64_t) != 0)
+        return false;
+    m_seeds = (const uint32_t*)(m_base + m_header->seeds_offset);
+    m_entries = (const pack_entry*)(m_base + m_header->entries_offset);
+
+    /** 加载时检查一遍所有表项，查找时就不必再检查越界 **/
+    for (uint32_t i = 0; i < m_header->count; i++)
+    {
+        const pack_entry& e = m_entries[i];
+        if (!check_range(e.url_offset, e.url_len + 1) || !check_range(e.type_offset, e.type_len + 1))
+            return false;
+        for (int v = 0; v < VARIANT_COUNT; v++)
+        {
+            if (v != VARIANT_IDENTITY && !(e.flags & FLAG_GZIP))
+                continue;
+            const pack_variant& var = e.variants[v];
+            if (!check_range(var.header_offset, var.header_len) || !check_range(var.etag_offset, var.etag_len + 1) ||
+                !check_range(var.body_offset, var.body_len))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool my_pack::load(const char* path)
+{
+    snprintf(m_path, sizeof(m_path), "%s", path);
+    return reload();
+}
+
+bool my_pack::reload()
+{
+    if (m_path[0] == '\0')              // 没有配置资源包
+        return false;
+    my_pack* pack = new my_pack();
+    if (!pack->map(m_path))
+    {
+        printf("cannot load asset pack %s\n", m_path);
+        delete pack;
+        return false;
+    }
+
+    m_locker.lock();
+    my_pack* old = m_current.load();
+    m_current.store(pack);
+    m_locker.unlock();
+    if (old)
+        old->release();                 // 还在发送旧内容的请求持有引用，最后一个释放时才解除映射
+    printf("asset pack %s loaded, %u entries\n", m_path, pack->m_header->count);
+    return true;
+}
+
+my_pack* my_pack::acquire()
+{
+    if (!m_current.load(std::memory_order_relaxed))     // 没有配置资源包时不加锁
+        return NULL;
+    m_locker.lock();
+    my_pack* pack = m_current.load();
+    if (pack)
+        pack->m_refs++;
+    m_locker.unlock();
+    return pack;
+}
+
+void my_pack::release()
+{
+    m_locker.lock();
+    int refs = --m_refs;
+    m_locker.unlock();
+    if (refs == 0)
+        delete this;
+}
+
+bool my_pack::find(const char* url, bool gzip_ok, asset& out) const
+{
+    uint32_t count = m_header->count;
+    if (count == 0)
+        return false;
+    size_t len = strcspn(url, "?");     // 查询串不参与匹配
+
+    /** 一级哈希选桶，再用桶的seed算出唯一的槽位，最后比较URL排除不在包里的请求 **/
+    uint32_t bucket = hash(url, len, 0) % m_header->buckets;
+    const pack_entry& e = m_entries[hash(url, len, m_seeds[bucket]) % count];
+    if (e.url_len != len || memcmp(m_base + e.url_offset, url, len) != 0)
+        return false;
+
+    out.gzip = gzip_ok && (e.flags & FLAG_GZIP);
+    out.vary = (e.flags & FLAG_GZIP) != 0;
+    const pack_variant& v = e.variants[out.gzip ? VARIANT_GZIP : VARIANT_IDENTITY];
+    out.header = m_base + v.header_offset;
+    out.header_len = v.header_len;
+    out.body = m_base + v.body_offset;
+    out.body_len = v.body_len;
+    out.etag = m_base + v.etag_offset;
+    out.type = m_base + e.type_offset;
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef _MY_PACK_H_
+#define _MY_PACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "my_locker.h"
+
+/*
+*   静态资源包：由 tools/my_packer 在构建时把doc_root打包成一个文件，服务器启动时mmap一次，
+*   命中的请求直接从映射的内存中应答，不再有stat/open等文件系统调用。
+*   包内有完美哈希(hash and displace)的URL索引、按页对齐的文件内容、预先生成的应答头与ETag，
+*   以及可选的gzip预压缩版本(打包时取同名的.gz文件)。
+*   收到SIGHUP时重新映射同一路径的包，用rename替换包文件即可原子地切换内容，
+*   正在发送旧内容的请求持有旧映射的引用，发完后才解除映射
+*/
+
+/** 包文件的格式，打包工具与服务器共用，所有整数为本机字节序 **/
+struct pack_header
+{
+    char        magic[8];
+    uint32_t    version;
+    /** 索引的表项数，也是完美哈希的槽位数 **/
+    uint32_t    count;
+    /** 一级哈希的桶数，每个桶一个seed **/
+    uint32_t    buckets;
+    uint32_t    reserved;
+    /** uint32_t seeds[buckets] 与 pack_entry entries[count] 在文件中的位置 **/
+    uint64_t    seeds_offset;
+    uint64_t    entries_offset;
+    uint64_t    file_size;
+};
+
+/** 一个编码版本：预先生成的应答头(不含Connection与结尾的空行)、ETag与按页对齐的内容 **/
+struct pack_variant
+{
+    uint64_t    header_offset;
+    uint32_t    header_len;
+    uint32_t    etag_len;
+    uint64_t    etag_offset;
+    uint64_t    body_offset;
+    uint64_t    body_len;
+};
+
+/** 字符串都以\0结尾，长度不含\0 **/
+struct pack_entry
+{
+    uint64_t        url_offset;
+    uint32_t        url_len;
+    uint32_t        flags;
+    uint64_t        type_offset;
+    uint32_t        type_len;
+    uint32_t        reserved;
+    pack_variant    variants[2];
+};
+
+class my_pack
+{
+public:
+    static constexpr char MAGIC[8] = { 'M', 'Y', 'P', 'A', 'C', 'K', '\0', '\0' };
+    static const uint32_t VERSION = 1;
+    static const uint32_t PAGE_SIZE = 4096;
+
+    /** 内容编码的版本 **/
+    enum VARIANT { VARIANT_IDENTITY = 0, VARIANT_GZIP, VARIANT_COUNT };
+    /** pack_entry::flags **/
+    enum ENTRY_FLAG { FLAG_GZIP = 0x1 };
+
+    /** 命中的资源，指针指向映射的内存，在release之前有效 **/
+    struct asset
+    {
+        const char* header;
+        uint32_t    header_len;
+        const char* body;
+        uint64_t    body_len;
+        const char* etag;
+        const char* type;
+        bool        gzip;
+        /** 是否存在其他编码的版本，需要Vary: Accept-Encoding **/
+        bool        vary;
+    };
+
+    /** URL的哈希，seed为0时得到一级哈希的桶，打包工具与服务器必须一致 **/
+    static uint64_t hash(const char* s, size_t len, uint32_t seed)
+    {
+        uint64_t h = 14695981039346656037ULL ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ULL);   // FNV-1a
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= (unsigned char)s[i];
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;                   // 让低位也受到所有字节的影响
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+    /** 启动时映射资源包，失败返回false **/
+    static bool load(const char* path);
+    /** 重新映射同一路径的资源包并切换过去，失败时继续使用旧的 **/
+    static bool reload();
+    /** 取得当前资源包的引用，没有加载资源包时返回NULL **/
+    static my_pack* acquire();
+    void release();
+
+    /** 按URL(不含查询串)查找，gzip_ok表示客户端接受gzip编码 **/
+    bool find(const char* url, bool gzip_ok, asset& out) const;
+
+private:
+    my_pack() : m_base(NULL), m_size(0), m_header(NULL), m_seeds(NULL), m_entries(NULL), m_refs(1) { }
+    ~my_pack();
+    /** 映射并校验包文件中所有的偏移都没有越界 **/
+    bool map(const char* path);
+    bool check_range(uint64_t offset, uint64_t len) const { return offset <= m_size && len <= m_size - offset; }
+
+private:
+    char*                   m_base;
+    size_t                  m_size;
+    const pack_header*      m_header;
+    const uint32_t*         m_seeds;
+    const pack_entry*       m_entries;
+    /** 引用计数，由m_locker保护 **/
+    int                     m_refs;
+
+    /** 当前的资源包，切换时在m_locker保护下替换 **/
+    static std::atomic<my_pack*> m_current;
+    static mutex_locker     m_locker;
+    static char             m_path[256];
+};
+
+#endif
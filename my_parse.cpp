@@ -1,35 +1,136 @@
 
 #include "my_parse.h"
+#include "my_config.h"
+#include "my_proxy.h"
+#include "my_stats.h"
+#include "my_ratelimit.h"
+#include "my_websocket.h"
+#include "my_trace.h"
 
 
 const char* ok_200_title    =      "OK";
+const char* ok_201_title    =      "Created";
+const char* switching_101_title = "Switching Protocols";
+const char* ok_201_form     =      "The file was uploaded successfully.\n";
 const char* error_400_title =      "Bad Request";
 const char* error_400_form  =      "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title =      "Forbidden";
 const char* error_403_form  =      "You do not have permission to get the file from this server.\n";
 const char* error_404_title =      "Not found";
 const char* error_404_form  =      "The requested file was not found on this server.\n";
+const char* error_405_title =      "Method Not Allowed";
+const char* error_405_form  =      "The request method is not allowed for the requested URL.\n";
+const char* error_413_title =      "Payload Too Large";
+const char* error_413_form  =      "The request body is larger than the server is willing to accept.\n";
+const char* error_429_title =      "Too Many Requests";
+const char* error_429_form  =      "You are sending requests too fast, please retry later.\n";
 const char* error_500_title =      "Internal Error";
 const char* error_500_form  =      "There was an unusual problem serving the requested file.\n";
+const char* error_502_title =      "Bad Gateway";
+const char* error_502_form  =      "The upstream server is unavailable or sent an invalid response.\n";
+const char* not_modified_304_title = "Not Modified";
 
 const char* doc_root = "/var/www/html";
 
+/** 请求方法名，顺序与METHOD一致 **/
+static constexpr const char* method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "PATCH" };
+static constexpr my_phash<sizeof(method_names) / sizeof(method_names[0]), 16> method_hash(method_names);
+static_assert(method_hash.valid(), "no perfect hash for the methods");
+
+/** 请求头名，顺序与HEADER、m_header_fns一致 **/
+static constexpr const char* header_names[] =
+{
+    "Host",
+    "Connection",
+    "Upgrade",
+    "Sec-WebSocket-Key",
+    "Sec-WebSocket-Version",
+    "Content-Length",
+    "Transfer-Encoding",
+    "Expect",
+    "Accept-Encoding",
+    "If-None-Match",
+};
+static constexpr my_phash<sizeof(header_names) / sizeof(header_names[0]), 64> header_hash(header_names);
+static_assert(header_hash.valid(), "no perfect hash for the headers");
+
+const my_parse::header_fn my_parse::m_header_fns[my_parse::HEADER_NUM] =
+{
+    &my_parse::on_host,
+    &my_parse::on_connection,
+    &my_parse::on_upgrade,
+    &my_parse::on_ws_key,
+    &my_parse::on_ws_version,
+    &my_parse::on_content_length,
+    &my_parse::on_transfer_encoding,
+    &my_parse::on_expect,
+    &my_parse::on_accept_encoding,
+    &my_parse::on_if_none_match,
+};
+
 void my_parse::init()
 {
     m_check_state = CHECK_STATE_REQUESELINE;
     m_linger = false;
     m_method = GET;
+    m_method_name = 0;
+    m_method_name = 0;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_content = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_accept_gzip = false;
+    m_if_none_match = 0;
+    m_upgrade_websocket = false;
+    m_connection_upgrade = false;
+    m_ws_key = 0;
+    m_ws_version_ok = false;
     m_host = 0;
     m_start_line = 0;
+    m_header_idx = 0;
     m_check_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    m_file_fd = -1;
+    m_cache_entry = NULL;
+    m_pack = NULL;
+    m_vhost = my_vhost::default_host();
+    m_peer = NULL;
+    m_iv_count = 0;
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
+void my_parse::next_request()
+{
+    int remain = m_read_idx - m_check_idx;
+    memmove(m_read_buf, m_read_buf + m_check_idx, remain);    // 把流水线请求的剩余数据移到缓冲区开头
+    m_check_state = CHECK_STATE_REQUESELINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    m_content = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_accept_gzip = false;
+    m_if_none_match = 0;
+    m_upgrade_websocket = false;
+    m_connection_upgrade = false;
+    m_ws_key = 0;
+    m_ws_version_ok = false;
+    m_host = 0;
+    m_start_line = 0;
+    m_header_idx = 0;
+    m_vhost = my_vhost::default_host();
+    m_check_idx = 0;
+    m_read_idx = remain;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    memset(m_read_buf + remain, '\0', READ_BUFFER_SIZE - remain);
 }
 
 my_parse::LINE_STATUS my_parse::parse_line()
@@ -68,18 +169,27 @@ my_parse::LINE_STATUS my_parse::parse_line()
 
 my_parse::HTTP_CODE my_parse::parse_request_line(char* text)
 {
-    m_url = strpbrk(text, " \t");       // strpbrk函数为在text中找“\t”字符，找到任意一个就返回，没有找到就返回空指针
-    if (!m_url)   
+    /** 找方法名之后的空白，同时累积方法名的哈希，找到后直接定位到方法 **/
+    uint32_t h = method_hash.begin();
+    char* p = text;
+    for (; *p && *p != ' ' && *p != '\t'; p++)
+        h = method_hash.step(h, *p);
+    if (!*p || p == text)
         return BAD_REQUEST;
-    *m_url++ = '\0';
-
-    char* method = text;
-    if (strcasecmp(method, "GET") == 0)  // strcasecmp函数忽略大小写，比较method的前几个字节与“GET”字符串
+    int method = method_hash.find(h, text, p - text);
+    if (method < 0)                     // 不认识的方法只要是合法的token就接受，是否支持由路径决定
     {
-        m_method = GET;
+        for (char* c = text; c < p; c++)
+        {
+            if (!isalnum((unsigned char)*c) && !strchr("!#$%&'*+-.^_`|~", *c))
+                return BAD_REQUEST;
+        }
+        method = OTHER;
     }
-    else 
-        return BAD_REQUEST;
+    *p = '\0';
+    m_url = p + 1;
+    m_method = (METHOD)method;
+    m_method_name = text;
     
     m_url += strspn(m_url, " \t");    // strspn 函数返回m_url中起始处为\t的字节数，即跳过"\t"
 
@@ -87,7 +197,7 @@ my_parse::HTTP_CODE my_parse::parse_request_line(char* text)
     if (!m_version)
         return BAD_REQUEST;
     *m_version++ = '\0';
-    *m_version += strspn(m_url, " \t");
+    m_version += strspn(m_version, " \t");
     if (strcasecmp(m_version, "HTTP/1.1") != 0)
         return BAD_REQUEST;
     
@@ -100,6 +210,7 @@ my_parse::HTTP_CODE my_parse::parse_request_line(char* text)
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
 
+    m_header_idx = m_start_line;        // process_read已经把m_start_line移到了下一行
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
@@ -108,6 +219,38 @@ my_parse::HTTP_CODE my_parse::parse_headers(char* text)
 {
     if (text[0] == '\0')
     {
+        m_vhost = my_vhost::find(m_host);               // 每个请求只查一次虚拟主机表
+        if (my_ratelimit::enabled() && m_peer && !my_ratelimit::allow(m_peer, m_url))
+            return TOO_MANY_REQUESTS;                   // 在任何文件操作、转发与上传之前拒绝
+        if (my_proxy::match(m_url))                     // 反向代理的请求原样转发给上游，包括请求体，方法不限
+            return PROXY_REQUEST;
+        if (m_method != GET && m_method != PUT && m_method != POST)     // 静态文件与上传只支持这几个方法
+            return METHOD_NOT_ALLOWED;
+        if (my_config::m_websocket_url && match_path(m_url, my_config::m_websocket_url))
+        {
+            if (m_method != GET || !m_upgrade_websocket || !m_connection_upgrade || !m_ws_key || !m_ws_version_ok)
+                return BAD_REQUEST;
+            return WEBSOCKET_REQUEST;
+        }
+        if (my_config::m_sse_url && match_path(m_url, my_config::m_sse_url))
+        {
+            if (m_method == GET)
+                return SSE_SUBSCRIBE;
+            if (m_method != POST || m_chunked)
+                return BAD_REQUEST;
+            if (m_check_idx + m_content_length >= READ_BUFFER_SIZE)     // 事件的数据要整个放进读缓冲区
+                return TOO_LARGE_REQUEST;
+            m_check_state = CHECK_STATE_CONTENT;
+            return NO_REQUEST;
+        }
+        if (m_method == PUT || m_method == POST)        // 上传的请求体可能很大，不经过读缓冲区，交给连接协程流式接收
+        {
+            if (!upload_allowed(m_url))                 // 上传要明确打开，否则任何人都能覆盖站点内容
+                return METHOD_NOT_ALLOWED;
+            if (m_content_length > my_config::m_max_upload)
+                return TOO_LARGE_REQUEST;
+            return UPLOAD_REQUEST;
+        }
         if (m_content_length != 0)
         {
             m_check_state = CHECK_STATE_CONTENT;
@@ -115,29 +258,86 @@ my_parse::HTTP_CODE my_parse::parse_headers(char* text)
         }
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
-    {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
-            m_linger = true;
-    }
-    else if (strncasecmp(text, "Content-Length:", 15) == 0)
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }
-    else if (strncasecmp(text, "Host:", 5) == 0)
-    {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
-    else 
-    {
-        printf("Unkonw header: %s", text);
-    }
+
+    /** 扫描头部名直到冒号，同时累积哈希，扫描完一次查表就得到处理函数，与支持多少个请求头无关 **/
+    uint32_t h = header_hash.begin();
+    char* p = text;
+    for (; *p && *p != ':'; p++)
+        h = header_hash.step(h, *p);
+    int header = (*p == ':') ? header_hash.find(h, text, p - text) : -1;
+    if (header < 0)                     // 不认识的请求头（User-Agent、Accept等）直接忽略
+        return NO_REQUEST;
+    char* value = p + 1;
+    value += strspn(value, " \t");
+    return (this->*m_header_fns[header])(value);
+}
+
+my_parse::HTTP_CODE my_parse::on_host(char* value)
+{
+    m_host = value;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_connection(char* value)
+{
+    if (strcasecmp(value, "keep-alive") == 0)
+        m_linger = true;
+    else if (strcasestr(value, "upgrade"))            // 浏览器可能发 "keep-alive, Upgrade"
+        m_connection_upgrade = true;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_upgrade(char* value)
+{
+    if (strcasecmp(value, "websocket") == 0)
+        m_upgrade_websocket = true;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_ws_key(char* value)
+{
+    m_ws_key = value;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_ws_version(char* value)
+{
+    m_ws_version_ok = (strcmp(value, "13") == 0);
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_content_length(char* value)
+{
+    m_content_length = atoll(value);
+    if (m_content_length < 0)
+        return BAD_REQUEST;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_transfer_encoding(char* value)
+{
+    if (strcasecmp(value, "chunked") != 0)
+        return BAD_REQUEST;                             // 不支持其他的传输编码
+    m_chunked = true;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_expect(char* value)
+{
+    if (strcasecmp(value, "100-continue") == 0)
+        m_expect_continue = true;
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_accept_encoding(char* value)
+{
+    m_accept_gzip = (strcasestr(value, "gzip") != NULL);
+    return NO_REQUEST;
+}
+
+my_parse::HTTP_CODE my_parse::on_if_none_match(char* value)
+{
+    m_if_none_match = value;
     return NO_REQUEST;
 }
 
@@ -145,7 +345,11 @@ my_parse::HTTP_CODE my_parse::parse_content(char* text)
 {
     if (m_read_idx >= (m_content_length + m_check_idx))
     {
-        text[m_content_length] = '\0';
+        /** 请求体按m_content_length使用，不在末尾写\0，后面可能紧跟着流水线的下一个请求；
+            越过请求体，next_request从下一个请求开始保留数据 **/
+        m_content = text;
+        m_check_idx += m_content_length;
+        m_start_line = m_check_idx;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -153,12 +357,10 @@ my_parse::HTTP_CODE my_parse::parse_content(char* text)
 
 char* my_parse::get_line()
 {
-    std::string ret;
-    getline(std::cin, ret);
-    return const_cast<char*>(ret.c_str());
+    return m_read_buf + m_start_line;    // parse_line 已经把行尾的\r\n替换成了\0
 }
 
-my_parse::HTTP_CODE my_parse::process_read()
+my_parse::HTTP_CODE my_parse::process_read(bool nonblocking)
 {
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
@@ -169,7 +371,6 @@ my_parse::HTTP_CODE my_parse::process_read()
     {
         text = get_line();
         m_start_line = m_check_idx;
-        printf("got 1 http line: %s\n", text);
 
         switch (m_check_state)
         {
@@ -186,14 +387,16 @@ my_parse::HTTP_CODE my_parse::process_read()
                 if (ret == BAD_REQUEST)
                     return BAD_REQUEST;
                 else if (ret == GET_REQUEST)
-                    return do_request();
+                    return do_request(nonblocking);
+                else if (ret != NO_REQUEST)     // 上传请求，或者请求体过大
+                    return ret;
                 break;
             }
             case CHECK_STATE_CONTENT:
             {
                 ret = parse_content(text);
                 if (ret == GET_REQUEST)
-                    return do_request();
+                    return do_request(nonblocking);
                 line_status = LINE_OPEN;
                 break;
             }
@@ -206,30 +409,111 @@ my_parse::HTTP_CODE my_parse::process_read()
     return NO_REQUEST;
 }
 
-my_parse::HTTP_CODE my_parse::do_request()
+bool my_parse::upload_allowed(const char* url)
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN-len-1);
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_REQUEST;
-    if (!(m_file_stat.st_mode & S_IROTH))
+    for (int i = 0; i < my_config::m_upload_path_count; i++)
+    {
+        if (strncmp(url, my_config::m_upload_paths[i], strlen(my_config::m_upload_paths[i])) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool my_parse::match_path(const char* url, const char* path)
+{
+    size_t len = strlen(path);
+    return strncmp(url, path, len) == 0 && (url[len] == '\0' || url[len] == '?');
+}
+
+my_parse::HTTP_CODE my_parse::do_request(bool nonblocking)
+{
+    if (m_content && my_config::m_sse_url && match_path(m_url, my_config::m_sse_url))
+        return SSE_PUBLISH;
+    if (my_config::m_stats_url && strcmp(m_url, my_config::m_stats_url) == 0)
+        return STATS_REQUEST;
+    if (my_config::m_trace_url && strcmp(m_url, my_config::m_trace_url) == 0)
+        return TRACE_REQUEST;
+
+    /** 先查资源包，命中时不再访问文件系统；资源包只属于默认站点 **/
+    m_pack = (m_vhost == my_vhost::default_host()) ? my_pack::acquire() : NULL;
+    if (m_pack)
+    {
+        if (m_pack->find(m_url, m_accept_gzip, m_asset))
+        {
+            if (m_if_none_match && (strstr(m_if_none_match, m_asset.etag) || strcmp(m_if_none_match, "*") == 0))
+                return NOT_MODIFIED;
+            return PACK_REQUEST;
+        }
+        m_pack->release();
+        m_pack = NULL;
+    }
+
+    HTTP_CODE ret = open_file(m_vhost, m_url, &m_cache_entry, nonblocking);
+    if (ret == GET_REQUEST)
+    {
+        m_file_fd = m_cache_entry->fd;
+        m_file_stat = m_cache_entry->st;
+    }
+    return ret;
+}
+
+my_parse::HTTP_CODE my_parse::open_file(my_vhost* vhost, const char* url, my_cache::entry** out, bool nonblocking)
+{
+    std::string_view path(url, strcspn(url, "?"));     // 查询串不是文件名的一部分
+    if (path.find("/../") != std::string_view::npos || path.ends_with("/.."))
+        return FORBIDDEN_REQUEST;                       // 不允许访问根目录之外，也不能借此访问别的站点
+
+    my_cache& cache = vhost->cache();
+    *out = cache.lookup(path, nonblocking);
+    if (*out)
+    {
+        my_stats::add(my_stats::CACHE_HIT);
+        return GET_REQUEST;
+    }
+    if (nonblocking)                                    // stat/open可能等待磁盘，不能在事件循环线程上做
+        return OFFLOAD_REQUEST;
+    my_stats::add(my_stats::CACHE_MISS);
+
+    char real_file[FILENAME_LEN];
+    snprintf(real_file, FILENAME_LEN, "%s%.*s", vhost->root(), (int)path.size(), path.data());
+    struct stat st;
+    if (stat(real_file, &st) < 0)
+        return NO_RESOURCE;
+    if (!(st.st_mode & S_IROTH))
         return FORBIDDEN_REQUEST;
-    if (S_ISDIR(m_file_stat.st_mode))
+    if (S_ISDIR(st.st_mode))
         return BAD_REQUEST;
     
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    int fd = open(real_file, O_RDONLY | O_CLOEXEC);     // 不再mmap，文件内容由连接协程通过sendfile直接发送
+    if (fd < 0)
+        return INTERNAL_ERROR;
+    *out = cache.insert(path, real_file, fd, st);       // 只缓存可以应答的文件
     return GET_REQUEST;
 }
 
-void my_parse::unmap()
+bool my_parse::bulk_request() const
+{
+    for (int i = 0; i < my_config::m_bulk_path_count; i++)
+    {
+        if (strncmp(m_url, my_config::m_bulk_paths[i], strlen(my_config::m_bulk_paths[i])) == 0)
+            return true;
+    }
+    std::string_view path(m_url, strcspn(m_url, "?"));
+    return m_vhost->cache().size_hint(path) >= my_config::m_bulk_size;
+}
+
+void my_parse::close_file()
 {
-    if (m_file_address)
+    if (m_cache_entry)                  // fd由缓存管理，只释放引用
+    {
+        m_vhost->cache().release(m_cache_entry);
+        m_cache_entry = NULL;
+    }
+    m_file_fd = -1;
+    if (m_pack)                         // 应答的内容来自资源包的映射，发完之后才能放开它
     {
-        munmap(m_file_address, m_file_stat.st_size);   // 解除 m_file_address 映射
-        m_file_address = 0;
+        m_pack->release();
+        m_pack = NULL;
     }
 }
 
@@ -255,9 +539,7 @@ bool my_parse::add_status_line(int status, const char* title)
 
 bool my_parse::add_headers(int content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
 }
 
 bool my_parse::add_content_length(int content_len)
@@ -308,7 +590,139 @@ bool my_parse::process_write(HTTP_CODE ret)
         {
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
-            if (!add_content(error_404_form));
+            if (!add_content(error_404_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case TOO_LARGE_REQUEST: 
+        {
+            m_linger = false;                 // 请求体没有被读取，连接上剩下的数据已经无法解析
+            add_status_line(413, error_413_title);
+            add_headers(strlen(error_413_form));
+            if (!add_content(error_413_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case METHOD_NOT_ALLOWED:
+        {
+            if (m_content_length != 0 || m_chunked)
+                m_linger = false;             // 请求体没有被读取
+            add_status_line(405, error_405_title);
+            add_response("Allow: %s\r\n", upload_allowed(m_url) ? "GET, PUT, POST" : "GET");
+            add_headers(strlen(error_405_form));
+            if (!add_content(error_405_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case TOO_MANY_REQUESTS:
+        {
+            my_stats::add(my_stats::RATE_LIMITED);
+            if (m_content_length != 0 || m_chunked)
+                m_linger = false;             // 请求体没有被读取
+            add_status_line(429, error_429_title);
+            add_response("Retry-After: 1\r\n");
+            add_headers(strlen(error_429_form));
+            if (!add_content(error_429_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case BAD_GATEWAY: 
+        {
+            add_status_line(502, error_502_title);
+            add_headers(strlen(error_502_form));
+            if (!add_content(error_502_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case PACK_REQUEST:
+        {
+            add_linger();
+            add_blank_line();
+            m_iv[0].iov_base = (void*)m_asset.header;
+            m_iv[0].iov_len = m_asset.header_len;
+            m_iv[1].iov_base = m_write_buf;
+            m_iv[1].iov_len = m_write_idx;
+            m_iv[2].iov_base = (void*)m_asset.body;
+            m_iv[2].iov_len = m_asset.body_len;
+            m_iv_count = 3;
+            return true;
+        }
+        case NOT_MODIFIED:
+        {
+            add_status_line(304, not_modified_304_title);
+            add_response("ETag: %s\r\n", m_asset.etag);
+            add_linger();
+            add_blank_line();
+            break;
+        }
+        case STATS_REQUEST:
+        case TRACE_REQUEST:
+        {
+            m_body.clear();
+            if (ret == STATS_REQUEST)
+                my_stats::format(m_body);
+            else
+                my_trace::format(m_body);
+            add_status_line(200, ok_200_title);
+            add_response("Content-Type: %s\r\n", ret == STATS_REQUEST ? "text/plain" : "application/json");
+            add_headers(m_body.size());
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = (void*)m_body.data();
+            m_iv[1].iov_len = m_body.size();
+            m_iv_count = 2;
+            return true;
+        }
+        case WEBSOCKET_REQUEST:
+        {
+            char accept[32];
+            my_websocket::accept_key(m_ws_key, accept);
+            add_status_line(101, switching_101_title);
+            add_response("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n", accept);
+            add_blank_line();
+            break;
+        }
+        case SSE_SUBSCRIBE:
+        {
+            m_linger = false;                 // 事件流没有长度，直到连接关闭才结束
+            add_status_line(200, ok_200_title);
+            add_response("Content-Type: text/event-stream\r\nCache-Control: no-cache\r\nX-Accel-Buffering: no\r\n");
+            add_linger();
+            add_blank_line();
+            break;
+        }
+        case SSE_PUBLISH:
+        {
+            add_status_line(200, ok_200_title);
+            add_response("Content-Type: text/plain\r\n");
+            add_headers(m_body.size());
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = (void*)m_body.data();
+            m_iv[1].iov_len = m_body.size();
+            m_iv_count = 2;
+            return true;
+        }
+        case PROXIED_REQUEST:
+        {
+            m_iv_count = 0;                   // 应答已经由连接协程从上游转发给客户
+            return true;
+        }
+        case CREATED_REQUEST: 
+        {
+            add_status_line(201, ok_201_title);
+            add_headers(strlen(ok_201_form));
+            if (!add_content(ok_201_form))
             {
                 return false;
             }
@@ -332,20 +746,20 @@ bool my_parse::process_write(HTTP_CODE ret)
                 add_headers(m_file_stat.st_size);
                 m_iv[0].iov_base = m_write_buf;
                 m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
+                m_iv_count = 1;
                 return true;
             }
             else 
             {
+                close_file();
                 const char* ok_string = "<html><body></body></html>";
                 add_headers(strlen(ok_string));
-                if (!add_content(ok_string));
+                if (!add_content(ok_string))
                 {
                     return false;
                 }
             }
+            break;
         }
         default: 
         {
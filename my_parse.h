@@ -17,8 +17,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <string>
+#include "my_pack.h"
+#include "my_vhost.h"
+#include "my_phash.h"
 
 /*
 *   使用有限状态机思想，解析HTTP头部信息
@@ -28,6 +33,9 @@
 class my_parse
 {
     friend class my_httpconn;
+    friend class my_upload;
+    friend class my_proxy;
+    friend class my_websocket;
 public: 
     /** 文件名的最大长度 **/
     static const int FILENAME_LEN = 200;
@@ -36,7 +44,7 @@ public:
     /** 写缓冲区的大小 **/
     static const int WRITE_BUFFER_SIZE = 1024;
 
-    /** HTTP请求方法，目前仅支持GET，POST，TRACE **/
+    /** HTTP请求方法：静态文件支持GET，上传支持PUT，POST，转发给上游的请求可以是任何方法 **/
     enum METHOD  {  GET = 0,    // 客户请求服务器上的某些资源
                     POST,       // 客户往服务器上提交一些数据
                     HEAD,       // 与GET很像，但是服务器对此请求，只响应头部，而不响应具体资源
@@ -44,6 +52,8 @@ public:
                     DELETE,     // 客户向服务器请求删除某些资源，但是服务器不一定真的会删除
                     TRACE,      // 服务器把收到的请求信息的副本，精确的装在主体，返回给客户
                     OPTIONS,    // 客户向服务器请求告知其所支持的各种功能
+                    PATCH,      // 客户对资源做部分修改
+                    OTHER       // 其他合法的方法名，只能转发给上游，原样使用m_method_name
                  };
 
     /** 解析用户请求时，主状态机所处的状态 **/
@@ -59,7 +69,23 @@ public:
                         NO_RESOURCE,        // 表示服务器没有客户所请求的资源
                         FORBIDDEN_REQUEST,  // 表示客户请求的资源，被禁止访问
                         INTERNAL_ERROR,     // 表示服务器内部错误
-                        CLOSED_CONNECTION   // 表示客户端已关闭连接
+                        CLOSED_CONNECTION,  // 表示客户端已关闭连接
+                        UPLOAD_REQUEST,     // 表示获得了上传请求的头部，请求体由连接协程流式写入文件
+                        CREATED_REQUEST,    // 表示上传的文件已经写入
+                        TOO_LARGE_REQUEST,  // 表示请求体超过了上传大小的上限
+                        PROXY_REQUEST,      // 表示请求落在反向代理的路径前缀下，交给连接协程转发
+                        PROXIED_REQUEST,    // 表示上游的应答已经转发给客户
+                        BAD_GATEWAY,        // 表示上游不可用或者应答出错
+                        PACK_REQUEST,       // 表示请求命中了资源包，直接从映射的内存中应答
+                        NOT_MODIFIED,       // 表示客户端缓存的版本与资源包中的ETag一致
+                        OFFLOAD_REQUEST,    // 表示请求需要访问文件系统，要交给线程池再调用do_request
+                        STATS_REQUEST,      // 表示请求的是运行计数器
+                        TOO_MANY_REQUESTS,  // 表示客户端超过了限速
+                        METHOD_NOT_ALLOWED, // 表示请求方法不能用于这个路径，比如 --upload-path 之外的PUT/POST，静态文件上的DELETE
+                        WEBSOCKET_REQUEST,  // 表示WebSocket的Upgrade握手，应答101之后连接转入帧模式
+                        SSE_SUBSCRIBE,      // 表示订阅Server-Sent Events，应答头之后连接转入事件流
+                        SSE_PUBLISH,        // 表示发布一个事件，请求体已经读进读缓冲区
+                        TRACE_REQUEST       // 表示请求的是采样的请求区间（Chrome trace JSON）
                      };
 
     /** 行读取状态 **/
@@ -73,26 +99,69 @@ public:
     ~my_parse() { }
 
 
-    /** 解析HTTP请求，返回解析处理结果 **/
-    HTTP_CODE process_read();
+    /** 解析HTTP请求，返回解析处理结果；nonblocking为true时不做任何可能阻塞的文件操作，
+        需要时返回OFFLOAD_REQUEST，请求已经完整解析，到线程池里调用do_request(false)继续 **/
+    HTTP_CODE process_read(bool nonblocking = false);
     /** 填充HTTP应答 **/
     bool process_write(HTTP_CODE ret);
 
+    /** 把url映射为虚拟主机根目录下的文件，经由该主机的文件缓存打开，HTTP/1.1与HTTP/2共用；
+        成功返回GET_REQUEST，out持有缓存表项的一个引用；nonblocking为true时只查缓存，
+        需要stat/open时返回OFFLOAD_REQUEST **/
+    static HTTP_CODE open_file(my_vhost* vhost, const char* url, my_cache::entry** out, bool nonblocking = false);
+    /** 返回OFFLOAD_REQUEST的请求是否进入线程池的BULK通道：url在 --bulk-path 之下，
+        或者文件缓存记得这个文件不小于 --bulk-size **/
+    bool bulk_request() const;
+
 
 
 private:
     void init();
+    /** 保留缓冲区中流水线请求的剩余数据，重置状态机以解析下一个请求 **/
+    void next_request();
 
     /** 用以分析HTTP请求的函数，被 process_read 调用 **/
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
-    HTTP_CODE do_request();
+
+    /** 支持的请求头，也是处理函数表m_header_fns与名字表的下标；请求头名经过完美哈希直接定位到处理函数 **/
+    enum HEADER {   HOST = 0,
+                    CONNECTION,
+                    UPGRADE,
+                    SEC_WEBSOCKET_KEY,
+                    SEC_WEBSOCKET_VERSION,
+                    CONTENT_LENGTH,
+                    TRANSFER_ENCODING,
+                    EXPECT,
+                    ACCEPT_ENCODING,
+                    IF_NONE_MATCH,
+                    HEADER_NUM
+                };
+    /** 请求头的处理函数，value已经跳过了冒号之后的空白 **/
+    typedef HTTP_CODE (my_parse::*header_fn)(char* value);
+    HTTP_CODE on_host(char* value);
+    HTTP_CODE on_connection(char* value);
+    HTTP_CODE on_upgrade(char* value);
+    HTTP_CODE on_ws_key(char* value);
+    HTTP_CODE on_ws_version(char* value);
+    HTTP_CODE on_content_length(char* value);
+    HTTP_CODE on_transfer_encoding(char* value);
+    HTTP_CODE on_expect(char* value);
+    HTTP_CODE on_accept_encoding(char* value);
+    HTTP_CODE on_if_none_match(char* value);
+    static const header_fn m_header_fns[HEADER_NUM];
+
+    /** url是否在某个 --upload-path 之下 **/
+    static bool upload_allowed(const char* url);
+    /** url是否就是path，或者path之后紧跟查询串 **/
+    static bool match_path(const char* url, const char* path);
+    HTTP_CODE do_request(bool nonblocking);
     char* get_line();
     LINE_STATUS parse_line();
 
     /** 用以填充HTTP应答的内部调用函数，被 process_write 调用 **/
-    void unmap();
+    void close_file();
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
     bool add_status_line(int status, const char* title);
@@ -110,6 +179,8 @@ private:
     int             m_check_idx;
     /** 当前正在解析的行的起始位置 **/
     int             m_start_line;
+    /** 请求头部第一行在缓冲区中的位置，转发请求时用来取回原始的头部 **/
+    int             m_header_idx;
 
     /** 写缓冲区 **/
     char            m_write_buf[WRITE_BUFFER_SIZE];
@@ -120,10 +191,13 @@ private:
     CHECK_STATE     m_check_state;
     /** 请求方法 **/
     METHOD          m_method;
+    /** 请求行中的方法名，指向读缓冲区，转发时原样发给上游 **/
+    const char*     m_method_name;
 
-    /** 客户群请求的目标文件的完整路径，其内容为doc_root + m_url
-        doc_root为网站根目录 **/
-    char            m_real_file[FILENAME_LEN];
+    /** 客户端的地址，用于限速 **/
+    const struct sockaddr* m_peer;
+    /** 请求头解析完时按Host确定的虚拟主机，目标文件为它的根目录 + m_url **/
+    my_vhost*       m_vhost;
     /** 客户请求的目标文件文件名 **/
     char*           m_url;
     /** HTTP版本号，仅支持HTTP/1.1 **/
@@ -131,16 +205,38 @@ private:
     /** 主机名 **/
     char*           m_host;
     /** HTTP请求消息体的长度 **/
-    int             m_content_length;
+    long long       m_content_length;
+    /** 读进读缓冲区的请求体，以\0结尾 **/
+    char*           m_content;
+    /** 请求体是否使用chunked编码 **/
+    bool            m_chunked;
+    /** 客户端是否在等待 100 Continue 之后才发送请求体 **/
+    bool            m_expect_continue;
+    /** 客户端是否接受gzip编码，以及它缓存的ETag **/
+    bool            m_accept_gzip;
+    char*           m_if_none_match;
+    /** WebSocket握手：Upgrade: websocket，Connection中含有Upgrade，Sec-WebSocket-Key与版本13 **/
+    bool            m_upgrade_websocket;
+    bool            m_connection_upgrade;
+    char*           m_ws_key;
+    bool            m_ws_version_ok;
     /** HTTP请求是否要求保持连接 **/
     bool            m_linger;
-    /** 客户请求的目标文件被mmap到内存中的起始位置 **/
-    char*           m_file_address;
+    /** 客户请求的目标文件的描述符，应答头发送后通过sendfile发送文件内容；
+        fd属于虚拟主机的文件缓存表项，发完后在close_file中释放表项而不是关闭fd **/
+    int             m_file_fd;
+    my_cache::entry* m_cache_entry;
     /** 目标文件的状态，判断文件是否存在，是否为目录，是否可读，并获取文件大小等信息 **/
     struct stat     m_file_stat;
-
-    /** 将使用writev来执行写操作，所以定义下面两个文件，其中m_iv_count表示被写内存块的数量 **/
-    struct iovec    m_iv[2];
+    /** 命中资源包时持有它的引用，应答发完后在close_file中释放 **/
+    my_pack*        m_pack;
+    my_pack::asset  m_asset;
+    /** 在内存中生成的应答体（运行计数器、请求区间、发布事件的结果） **/
+    std::string     m_body;
+
+    /** 将使用writev来发送应答，其中m_iv_count表示被写内存块的数量；
+        资源包的应答是 预先生成的头部 + Connection与空行 + 映射中的内容 三块 **/
+    struct iovec    m_iv[3];
     int             m_iv_count;
 };
 
@@ -0,0 +1,90 @@
+#ifndef _MY_PHASH_H_
+#define _MY_PHASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <strings.h>
+
+/*
+*   编译期生成的完美哈希：固定的一组名字（请求头名、请求方法）在编译时找一个种子，使它们落在互不相同的槽里。
+*   调用者扫描名字时逐个字符调用step累积哈希值（大小写折叠在这里做），扫描完用find一次定位到下标，
+*   再比较一次名字排除不在表里的名字；查找的代价与表里有多少个名字无关。
+*   对字母 c | 0x20 就是小写，名字里的'-'与数字本来就带着这一位，不受影响；其他字符可能折叠到一起，由最后的比较排除
+*/
+
+template <size_t N, size_t SIZE>
+class my_phash
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+    static_assert(N < SIZE && N < 255, "too many keys");
+
+public:
+    /** 种子搜索的上限，名字个数不超过槽数的四分之一时通常几十次就能找到 **/
+    static const uint32_t MAX_SEED = 100000;
+
+    constexpr my_phash(const char* const (&keys)[N]) : m_seed(0), m_keys(), m_lens(), m_slots()
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            m_keys[i] = keys[i];
+            size_t len = 0;
+            while (keys[i][len])
+                len++;
+            m_lens[i] = len;
+        }
+        for (uint32_t seed = 1; seed < MAX_SEED; seed++)
+        {
+            bool used[SIZE] = {};
+            bool ok = true;
+            for (size_t i = 0; i < N && ok; i++)
+            {
+                size_t s = slot(hash(seed, keys[i]));
+                ok = !used[s];
+                used[s] = true;
+            }
+            if (ok)
+            {
+                m_seed = seed;
+                break;
+            }
+        }
+        for (size_t i = 0; i < N; i++)
+            m_slots[slot(hash(m_seed, keys[i]))] = i + 1;
+    }
+
+    /** 扫描开始时的哈希值 **/
+    constexpr uint32_t begin() const { return m_seed; }
+    /** 累积一个字符（FNV-1a），大小写不敏感 **/
+    static constexpr uint32_t step(uint32_t h, char c) { return (h ^ (uint8_t)(c | 0x20)) * 16777619u; }
+    /** 种子是否找到了，用于static_assert **/
+    constexpr bool valid() const { return m_seed != 0; }
+
+    /** h为对name的每个字符step之后的结果，返回名字在keys中的下标，不在表里返回-1 **/
+    int find(uint32_t h, const char* name, size_t len) const
+    {
+        int i = (int)m_slots[slot(h)] - 1;
+        if (i < 0 || m_lens[i] != len || strncasecmp(name, m_keys[i], len) != 0)
+            return -1;
+        return i;
+    }
+
+private:
+    static constexpr uint32_t hash(uint32_t seed, const char* key)
+    {
+        uint32_t h = seed;
+        for (; *key; key++)
+            h = step(h, *key);
+        return h;
+    }
+    /** 低位先混入高位，FNV的低位不够散 **/
+    static constexpr size_t slot(uint32_t h) { return (h ^ (h >> 16)) & (SIZE - 1); }
+
+private:
+    uint32_t        m_seed;
+    const char*     m_keys[N];
+    size_t          m_lens[N];
+    /** 槽中是下标加1，0表示空槽 **/
+    uint8_t         m_slots[SIZE];
+};
+
+#endif
@@ -0,0 +1,660 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "my_proxy.h"
+#include "my_httpconn.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+extern void removefd(int epollfd, int fd);
+
+std::vector<my_proxy::route*> my_proxy::m_routes;
+
+bool my_proxy::parse_address(const char* text, backend* b)
+{
+    snprintf(b->name, sizeof(b->name), "%s", text);
+    memset(&b->addr, 0, sizeof(b->addr));
+
+    if (strncmp(text, "unix:", 5) == 0)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)&b->addr;
+        const char* path = text + 5;
+        if (*path == '\0' || strlen(path) >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        b->addr_len = sizeof(struct sockaddr_un);
+        return true;
+    }
+
+    const char* colon = strrchr(text, ':');
+    if (!colon || colon == text)
+        return false;
+    std::string host(text, colon - text);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')    // [::1]:8000
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0)
+        return false;
+    memcpy(&b->addr, res->ai_addr, res->ai_addrlen);
+    b->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+bool my_proxy::add_route(const char* spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (spec[0] != '/' || !eq || eq[1] == '\0')
+        return false;
+
+    route* r = new route;
+    r->prefix.assign(spec, eq - spec);
+    r->next.store(0);
+
+    const char* item = eq + 1;
+    while (1)
+    {
+        const char* comma = strchr(item, ',');
+        std::string text = comma ? std::string(item, comma - item) : std::string(item);
+        backend* b = new backend;
+        b->healthy.store(true);
+        if (!parse_address(text.c_str(), b))
+        {
+            delete b;
+            for (size_t i = 0; i < r->backends.size(); i++)
+                delete r->backends[i];
+            delete r;
+            return false;
+        }
+        r->backends.push_back(b);
+        if (!comma)
+            break;
+        item = comma + 1;
+    }
+    m_routes.push_back(r);
+    return true;
+}
+
+my_proxy::route* my_proxy::find(const char* url)
+{
+    route* best = NULL;
+    for (size_t i = 0; i < m_routes.size(); i++)        // 最长前缀匹配
+    {
+        route* r = m_routes[i];
+        if (strncmp(url, r->prefix.c_str(), r->prefix.size()) == 0 &&
+            (!best || r->prefix.size() > best->prefix.size()))
+            best = r;
+    }
+    return best;
+}
+
+bool my_proxy::match(const char* url)
+{
+    return !m_routes.empty() && find(url) != NULL;
+}
+
+bool my_proxy::probe(backend* b)
+{
+    int fd = socket(b->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int ret = ::connect(fd, (struct sockaddr*)&b->addr, b->addr_len);
+    if (ret < 0 && errno == EINPROGRESS)
+    {
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLOUT;
+        p.revents = 0;
+        if (poll(&p, 1, HEALTH_TIMEOUT) == 1)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            ret = (err == 0) ? 0 : -1;
+        }
+    }
+    close(fd);
+    return ret == 0;
+}
+
+void* my_proxy::health_check(void* arg)
+{
+    while (1)
+    {
+        sleep(HEALTH_INTERVAL);
+        for (size_t i = 0; i < m_routes.size(); i++)
+        {
+            for (size_t j = 0; j < m_routes[i]->backends.size(); j++)
+            {
+                backend* b = m_routes[i]->backends[j];
+                bool ok = probe(b);
+                if (ok != b->healthy.load())
+                    printf("upstream %s is %s\n", b->name, ok ? "up" : "down");
+                b->healthy.store(ok);
+            }
+        }
+    }
+    return NULL;
+}
+
+void my_proxy::start()
+{
+    if (m_routes.empty())
+        return;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, health_check, NULL) != 0)      // 探测用阻塞的connect+poll，放在单独的线程里，不占用事件循环
+    {
+        printf("pthread create error");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+my_proxy::my_proxy(my_httpconn* conn, my_socket* sock, my_parse* parse, const char* client_ip) :
+                   m_conn(conn),
+                   m_sock(sock),
+                   m_parse(parse),
+                   m_client_ip(client_ip),
+                   m_up(NULL)
+{
+    m_client.sock = sock;
+    m_client.buf = parse->m_read_buf;
+    m_client.start = &parse->m_check_idx;
+    m_client.end = &parse->m_read_idx;
+    m_client.size = my_parse::READ_BUFFER_SIZE;
+}
+
+my_proxy::~my_proxy()
+{
+    if (m_up)
+        close_upstream(m_up);
+}
+
+my_task<my_proxy::upstream*> my_proxy::connect(backend* b)
+{
+    int fd = socket(b->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        co_return NULL;
+    if (fd >= my_socket::MAX_SOCKET)
+    {
+        close(fd);
+        co_return NULL;
+    }
+    if (b->addr.ss_family != AF_UNIX)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    upstream* u = new upstream;
+    u->owner = b;
+    u->start = u->end = 0;
+    if (pipe2(u->pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        close(fd);
+        delete u;
+        co_return NULL;
+    }
+    addfd(my_socket::m_epollfd, fd, true);      // 和客户连接注册在同一个epoll上
+    u->sock.attach(fd);
+
+    int ret = ::connect(fd, (struct sockaddr*)&b->addr, b->addr_len);
+    if (ret < 0 && errno == EINPROGRESS)
+    {
+        bool ok = co_await u->sock.wait(EPOLLOUT);
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        ret = (ok && err == 0) ? 0 : -1;
+    }
+    if (ret < 0)
+    {
+        close_upstream(u);
+        co_return NULL;
+    }
+    co_return u;
+}
+
+my_task<my_proxy::upstream*> my_proxy::acquire(route* r, bool& reused)
+{
+    size_t count = r->backends.size();
+    unsigned first = r->next.fetch_add(1);
+    for (size_t i = 0; i < count; i++)
+    {
+        backend* b = r->backends[(first + i) % count];
+        if (!b->healthy.load())
+            continue;
+
+        /** 先取空闲连接，确认对端没有在空闲期间关闭它 **/
+        while (1)
+        {
+            upstream* u = NULL;
+            b->idle_locker.lock();
+            if (!b->idle.empty())
+            {
+                u = b->idle.back();
+                b->idle.pop_back();
+            }
+            b->idle_locker.unlock();
+            if (!u)
+                break;
+
+            char c;
+            ssize_t n = recv(u->sock.fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                reused = true;
+                co_return u;
+            }
+            close_upstream(u);                  // 已关闭，或者收到了不属于任何请求的数据
+        }
+
+        upstream* u = co_await connect(b);
+        if (u)
+        {
+            reused = false;
+            co_return u;
+        }
+        if (b->healthy.exchange(false))         // 连不上的后端由健康检查线程探测恢复
+            printf("upstream %s is down\n", b->name);
+    }
+    co_return NULL;
+}
+
+void my_proxy::release(upstream* u, bool reuse)
+{
+    if (reuse && u->start == u->end)
+    {
+        u->start = u->end = 0;
+        backend* b = u->owner;
+        b->idle_locker.lock();
+        if (b->idle.size() < MAX_IDLE)
+        {
+            b->idle.push_back(u);
+            u = NULL;
+        }
+        b->idle_locker.unlock();
+    }
+    if (u)
+        close_upstream(u);
+}
+
+void my_proxy::close_upstream(upstream* u)
+{
+    int fd = u->sock.fd();
+    u->sock.detach();
+    removefd(my_socket::m_epollfd, fd);
+    close(u->pipe[0]);
+    close(u->pipe[1]);
+    delete u;
+}
+
+void my_proxy::build_request()
+{
+    m_request.clear();
+    m_request.append(m_parse->m_method_name).append(" ").append(m_parse->m_url).append(" HTTP/1.1\r\n");
+
+    /** 请求头已经被解析器按行切分，每行以两个\0结尾 **/
+    std::string forwarded;              // 客户端自己带的X-Forwarded-For，与对端地址合并成一个头，上游只看到一个
+    char* p = m_parse->m_read_buf + m_parse->m_header_idx;
+    char* end = m_parse->m_read_buf + m_parse->m_check_idx;
+    while (p < end && *p != '\0')
+    {
+        size_t len = strlen(p);
+        if (strncasecmp(p, "X-Forwarded-For:", 16) == 0)
+        {
+            const char* value = p + 16 + strspn(p + 16, " \t");
+            if (*value)
+                forwarded.append(value).append(", ");
+        }
+        else if (strncasecmp(p, "Connection:", 11) != 0 && strncasecmp(p, "Keep-Alive:", 11) != 0 &&
+                 strncasecmp(p, "Proxy-Connection:", 17) != 0 && strncasecmp(p, "Expect:", 7) != 0 &&
+                 strncasecmp(p, "X-Forwarded-Proto:", 18) != 0)    // 协议由这里根据连接决定
+            m_request.append(p, len).append("\r\n");
+        p += len + 2;
+    }
+    /** 最后一项是这里看到的对端地址，上游应当只信任它，前面的是客户端声称的，可以伪造 **/
+    m_request.append("X-Forwarded-For: ").append(forwarded).append(m_client_ip).append("\r\n");
+    m_request.append("X-Forwarded-Proto: ").append(m_sock->tls() ? "https" : "http").append("\r\n");
+    m_request.append("Connection: keep-alive\r\n\r\n");     // 与上游之间总是保持连接，由连接池复用
+}
+
+my_task<int> my_proxy::read_head()
+{
+    upstream* u = m_up;
+    int avail = u->end - u->start;
+    memmove(u->buf, u->buf + u->start, avail);
+    u->start = 0;
+    u->end = avail;
+
+    int scanned = 0;
+    while (1)
+    {
+        int from = scanned > 3 ? scanned - 3 : 0;
+        char* p = (char*)memmem(u->buf + from, u->end - from, "\r\n\r\n", 4);
+        if (p)
+            co_return p + 4 - u->buf;
+        scanned = u->end;
+        if (u->end >= BUFFER_SIZE)
+            co_return -1;                       // 应答头超过了缓冲区
+        ssize_t n = co_await u->sock.read(u->buf + u->end, BUFFER_SIZE - u->end);
+        if (n <= 0)
+            co_return -1;
+        u->end += n;
+    }
+}
+
+long long my_proxy::parse_head(int head_len, int& status, bool& reuse)
+{
+    char* buf = m_up->buf;
+    if (head_len < 14 || strncmp(buf, "HTTP/1.", 7) != 0 || buf[8] != ' ')
+        return -3;
+    status = atoi(buf + 9);
+    if (status < 100 || status > 999)
+        return -3;
+    bool http10 = (buf[7] == '0');
+    bool keep_alive = false;
+    bool close_conn = false;
+    bool chunked = false;
+    long long content_length = -1;
+
+    char* line_end = (char*)memmem(buf, head_len, "\r\n", 2);
+    m_response.assign("HTTP/1.1");              // 对客户总是以HTTP/1.1应答
+    m_response.append(buf + 8, line_end - buf - 8).append("\r\n");
+
+    char* p = line_end + 2;
+    char* end = buf + head_len - 2;             // 最后一个空行
+    while (p < end)
+    {
+        line_end = (char*)memmem(p, end - p, "\r\n", 2);
+        int len = line_end - p;
+        if (strncasecmp(p, "Connection:", 11) == 0)
+        {
+            std::string value(p + 11, len - 11);
+            if (strcasestr(value.c_str(), "close"))
+                close_conn = true;
+            else if (strcasestr(value.c_str(), "keep-alive"))
+                keep_alive = true;
+        }
+        else if (strncasecmp(p, "Keep-Alive:", 11) == 0)
+        {
+        }
+        else
+        {
+            if (strncasecmp(p, "Content-Length:", 15) == 0)
+                content_length = atoll(p + 15);
+            else if (strncasecmp(p, "Transfer-Encoding:", 18) == 0)
+                chunked = strcasestr(std::string(p + 18, len - 18).c_str(), "chunked") != NULL;
+            m_response.append(p, len).append("\r\n");
+        }
+        p = line_end + 2;
+    }
+
+    reuse = !close_conn && (!http10 || keep_alive);
+    long long body = content_length;
+    if (m_parse->m_method == my_parse::HEAD || status / 100 == 1 || status == 204 || status == 304)
+        body = 0;                               // HEAD的应答带着Content-Length但没有应答体
+    else if (chunked)
+        body = -1;
+    else if (content_length < 0)                // 没有长度的应答体以连接关闭结束，两边的连接都不能复用
+    {
+        body = -2;
+        reuse = false;
+        m_parse->m_linger = false;
+    }
+
+    m_response.append("Connection: ").append(m_parse->m_linger ? "keep-alive" : "close").append("\r\n\r\n");
+    return body;
+}
+
+my_task<bool> my_proxy::relay(channel& from, my_socket* to, long long len)
+{
+    /** 先写出缓冲区中已经读到的部分 **/
+    int avail = *from.end - *from.start;
+    if (avail > 0 && len != 0)
+    {
+        int n = (len < 0 || avail < len) ? avail : (int)len;
+        struct iovec iv;
+        iv.iov_base = from.buf + *from.start;
+        iv.iov_len = n;
+        *from.start += n;
+        if (len > 0)
+            len -= n;
+        if (!co_await to->writev(&iv, 1, len != 0))
+            co_return false;
+    }
+
+    /** TLS连接上读到的是密文，用户态加密时也不能直接写fd，经过缓冲区转发 **/
+    if (!from.sock->splice_in() || !to->splice_out())
+    {
+        while (len != 0)
+        {
+            int want = (len < 0 || len > from.size) ? from.size : (int)len;
+            *from.start = *from.end = 0;        // 缓冲区已经取空，整个拿来中转
+            ssize_t n = co_await from.sock->read(from.buf, want);
+            if (n == 0)
+                co_return len < 0;
+            if (n < 0)
+                co_return false;
+            if (len > 0)
+                len -= n;
+            struct iovec iv;
+            iv.iov_base = from.buf;
+            iv.iov_len = n;
+            if (!co_await to->writev(&iv, 1, len != 0))
+                co_return false;
+        }
+        co_return true;
+    }
+
+    int* pipefd = m_up->pipe;
+    while (len != 0)
+    {
+        size_t want = (len < 0 || len > SPLICE_CHUNK) ? SPLICE_CHUNK : len;
+        ssize_t n = splice(from.sock->fd(), NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            co_return len < 0;                  // 对端关闭：转发到连接关闭时就是正常结束
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                co_return false;
+            if (!co_await from.sock->wait(EPOLLIN))
+                co_return false;
+            continue;
+        }
+        if (len > 0)
+            len -= n;
+
+        while (n > 0)                           // 管道里的数据全部写给对方之后，才从源端读下一段
+        {
+            ssize_t m = splice(pipefd[0], NULL, to->fd(), NULL, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (m < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    co_return false;
+                if (!co_await to->wait(EPOLLOUT))
+                    co_return false;
+                continue;
+            }
+            n -= m;
+        }
+    }
+    co_return true;
+}
+
+my_task<char*> my_proxy::read_line(channel& from)
+{
+    while (1)
+    {
+        char* start = from.buf + *from.start;
+        int avail = *from.end - *from.start;
+        char* crlf = (char*)memmem(start, avail, "\r\n", 2);
+        if (crlf)
+        {
+            *crlf = '\0';
+            *from.start = crlf + 2 - from.buf;
+            co_return start;
+        }
+
+        memmove(from.buf, start, avail);
+        *from.start = 0;
+        *from.end = avail;
+        if (avail >= from.size)
+            co_return NULL;
+        ssize_t n = co_await from.sock->read(from.buf + avail, from.size - avail);
+        if (n <= 0)
+            co_return NULL;
+        *from.end += n;
+    }
+}
+
+my_task<bool> my_proxy::relay_chunked(channel& from, my_socket* to)
+{
+    bool trailer = false;
+    while (1)
+    {
+        char* line = co_await read_line(from);
+        if (!line)
+            co_return false;
+        size_t len = strlen(line);
+
+        long long size = 0;
+        if (!trailer)
+        {
+            char* end = NULL;
+            size = strtoll(line, &end, 16);
+            if (end == line || size < 0 || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+                co_return false;
+            trailer = (size == 0);
+        }
+        bool last = trailer && len == 0;        // 最后一个chunk之后的trailer以空行结束
+
+        line[len] = '\r';                       // read_line把\r换成了\0，还原后原样转发
+        struct iovec iv;
+        iv.iov_base = line;
+        iv.iov_len = len + 2;
+        if (!co_await to->writev(&iv, 1, !last))
+            co_return false;
+        if (last)
+            break;
+        if (size > 0 && !co_await relay(from, to, size + 2))     // chunk数据及其后的\r\n
+            co_return false;
+    }
+    co_return true;
+}
+
+my_task<my_parse::HTTP_CODE> my_proxy::run()
+{
+    route* r = find(m_parse->m_url);
+    if (!r)
+        co_return my_parse::NO_RESOURCE;
+    build_request();
+
+    bool has_body = m_parse->m_chunked || m_parse->m_content_length > 0;
+    if (has_body && m_parse->m_expect_continue)
+    {
+        static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        struct iovec iv;
+        iv.iov_base = (void*)continue_line;
+        iv.iov_len = sizeof(continue_line) - 1;
+        if (!co_await m_sock->writev(&iv, 1))
+            co_return my_parse::CLOSED_CONNECTION;
+    }
+
+    int status = 0;
+    long long body = 0;
+    bool reuse = false;
+    size_t tries = r->backends.size() + 1;      // 每个后端一次，外加一次复用的连接恰好被上游关闭的重试
+    while (1)
+    {
+        bool reused = false;
+        m_up = co_await acquire(r, reused);
+        if (!m_up)
+        {
+            if (has_body)
+                m_parse->m_linger = false;      // 请求体还留在连接上
+            co_return my_parse::BAD_GATEWAY;
+        }
+        m_upstream.sock = &m_up->sock;
+        m_upstream.buf = m_up->buf;
+        m_upstream.start = &m_up->start;
+        m_upstream.end = &m_up->end;
+        m_upstream.size = BUFFER_SIZE;
+
+        struct iovec iv;
+        iv.iov_base = (void*)m_request.data();
+        iv.iov_len = m_request.size();
+        bool sent = false;                      // 请求体已经开始从客户连接上读走，不能再重试
+        bool ok = co_await m_up->sock.writev(&iv, 1, has_body);
+        if (ok && has_body)
+        {
+            sent = true;
+            if (m_parse->m_chunked)
+                ok = co_await relay_chunked(m_client, &m_up->sock);
+            else
+                ok = co_await relay(m_client, &m_up->sock, m_parse->m_content_length);
+        }
+
+        int head_len = -1;
+        while (ok)
+        {
+            head_len = co_await read_head();
+            if (head_len < 0)
+                break;
+            body = parse_head(head_len, status, reuse);
+            m_up->start = head_len;
+            if (body == -3 || status == 101)    // 不支持协议升级
+            {
+                head_len = -1;
+                break;
+            }
+            if (status >= 200)                  // 跳过 100 Continue 之类的临时应答
+                break;
+        }
+        if (head_len >= 0)
+            break;
+
+        bool answered = (m_up->end > 0);
+        close_upstream(m_up);
+        m_up = NULL;
+        if (sent || answered || --tries == 0)
+        {
+            if (sent)
+                m_parse->m_linger = false;
+            co_return my_parse::BAD_GATEWAY;
+        }
+    }
+
+    struct iovec iv;
+    iv.iov_base = (void*)m_response.data();
+    iv.iov_len = m_response.size();
+    bool ok = co_await m_sock->writev(&iv, 1, body != 0);
+    if (ok && body == -1)
+        ok = co_await relay_chunked(m_upstream, m_sock);
+    else if (ok && body == -2)
+        ok = co_await relay(m_upstream, m_sock, -1);
+    else if (ok && body > 0)
+        ok = co_await relay(m_upstream, m_sock, body);
+    if (!ok)
+    {
+        m_parse->m_linger = false;              // 应答已经发出一部分，只能关闭客户连接
+        co_return my_parse::CLOSED_CONNECTION;
+    }
+
+    release(m_up, reuse);
+    m_up = NULL;
+    co_return my_parse::PROXIED_REQUEST;
+}
@@ -0,0 +1,136 @@
+#ifndef _MY_PROXY_H_
+#define _MY_PROXY_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "my_locker.h"
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_parse.h"
+
+/*
+*   反向代理：按路径前缀把请求转发给上游的TCP或Unix socket后端
+*   上游连接与客户连接注册在同一个epoll上，由同一个连接协程非阻塞地驱动；
+*   请求体与应答体通过 socket -> pipe -> socket 的splice转发，不经过用户态缓冲区（TLS客户连接上经过缓冲区）。
+*   每个后端维护一个keep-alive空闲连接池，连接失败的后端被标记为不可用，
+*   由健康检查线程定期探测恢复，请求会转给同一前缀下的其他后端
+*/
+
+class my_httpconn;
+
+class my_proxy
+{
+public:
+    /** 解析 PREFIX=ADDR[,ADDR...]，ADDR为 host:port 或 unix:/path，出错返回false **/
+    static bool add_route(const char* spec);
+    /** url是否落在某个代理前缀之下 **/
+    static bool match(const char* url);
+    /** 配置了代理时启动健康检查线程 **/
+    static void start();
+
+public:
+    my_proxy(my_httpconn* conn, my_socket* sock, my_parse* parse, const char* client_ip);
+    ~my_proxy();
+
+    /** 转发请求并把应答转发给客户，应答已经发出时返回PROXIED_REQUEST **/
+    my_task<my_parse::HTTP_CODE> run();
+
+private:
+    /** 每次splice最多搬运的字节数，即管道的容量 **/
+    static const int SPLICE_CHUNK = 65536;
+    /** 上游应答头的缓冲区大小 **/
+    static const int BUFFER_SIZE = 4096;
+    /** 每个后端保留的空闲连接数上限 **/
+    static const size_t MAX_IDLE = 32;
+    /** 健康检查的间隔(秒)与连接超时(毫秒) **/
+    static const int HEALTH_INTERVAL = 2;
+    static const int HEALTH_TIMEOUT = 1000;
+
+    struct upstream;
+
+    struct backend
+    {
+        char                    name[128];
+        struct sockaddr_storage addr;
+        socklen_t               addr_len;
+        std::atomic<bool>       healthy;
+        /** 空闲的keep-alive连接，连接协程可能在任意线程上归还连接，所以要加锁 **/
+        mutex_locker            idle_locker;
+        std::vector<upstream*>  idle;
+    };
+
+    struct route
+    {
+        std::string             prefix;
+        std::vector<backend*>   backends;
+        /** 轮转选择后端的起点 **/
+        std::atomic<unsigned>   next;
+    };
+
+    /** 到上游的一条连接，连同它专用的管道与应答头缓冲区一起复用 **/
+    struct upstream
+    {
+        my_socket               sock;
+        backend*                owner;
+        int                     pipe[2];
+        char                    buf[BUFFER_SIZE];
+        int                     start;
+        int                     end;
+    };
+
+    /** 带读缓冲区的一端：客户端一侧使用my_parse的读缓冲区，上游一侧使用upstream的缓冲区 **/
+    struct channel
+    {
+        my_socket*              sock;
+        char*                   buf;
+        int*                    start;
+        int*                    end;
+        int                     size;
+    };
+
+private:
+    static route* find(const char* url);
+    static bool parse_address(const char* text, backend* b);
+    static bool probe(backend* b);
+    static void* health_check(void* arg);
+
+    /** 取一条到后端的连接：优先复用空闲连接，否则轮转地连接健康的后端 **/
+    my_task<upstream*> acquire(route* r, bool& reused);
+    my_task<upstream*> connect(backend* b);
+    /** 归还连接，不能复用或者池已满时关闭 **/
+    void release(upstream* u, bool reuse);
+    static void close_upstream(upstream* u);
+
+    /** 把请求行与头部重新组装成发给上游的请求头 **/
+    void build_request();
+    /** 读取上游的应答头，返回头部长度，出错返回-1 **/
+    my_task<int> read_head();
+    /** 解析应答头并生成发给客户的应答头，返回应答体长度，-1表示chunked，-2表示读到连接关闭，-3表示出错 **/
+    long long parse_head(int head_len, int& status, bool& reuse);
+
+    /** 从from转发len字节到to，先写出缓冲区里已有的数据；len为-1时转发到连接关闭 **/
+    my_task<bool> relay(channel& from, my_socket* to, long long len);
+    /** 转发chunked编码的消息体，chunk头原样转发 **/
+    my_task<bool> relay_chunked(channel& from, my_socket* to);
+    my_task<char*> read_line(channel& from);
+
+private:
+    my_httpconn*    m_conn;
+    my_socket*      m_sock;
+    my_parse*       m_parse;
+    const char*     m_client_ip;
+
+    upstream*       m_up;
+    channel         m_client;
+    channel         m_upstream;
+    /** 发给上游的请求头与发给客户的应答头 **/
+    std::string     m_request;
+    std::string     m_response;
+
+    static std::vector<route*>  m_routes;
+};
+
+#endif
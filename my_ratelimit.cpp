@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "my_ratelimit.h"
+
+my_ratelimit::rule my_ratelimit::m_client;
+bool my_ratelimit::m_client_enabled = false;
+my_ratelimit::rule my_ratelimit::m_paths[my_ratelimit::MAX_RULES];
+int my_ratelimit::m_path_count = 0;
+int my_ratelimit::m_v6_prefix = 64;
+my_ratelimit::shard* my_ratelimit::m_shards = NULL;
+
+/** 把客户端地址与规则编号混合成桶的键，规则-1表示按IP的总限制 **/
+static uint64_t bucket_key(const unsigned char* addr, size_t len, int rule)
+{
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)(rule + 1);     // FNV-1a
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= addr[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h | 1;                       // 0留给空桶
+}
+
+bool my_ratelimit::parse_rule(const char* spec, rule& r)
+{
+    char* end = NULL;
+    double rate = strtod(spec, &end);
+    if (end == spec || rate <= 0)
+        return false;
+    double burst = rate;                // 默认最多积攒一秒的令牌
+    if (*end == ',')
+    {
+        const char* p = end + 1;
+        burst = strtod(p, &end);
+        if (end == p || burst < 1)
+            return false;
+    }
+    if (*end != '\0')
+        return false;
+    r.rate = rate / 1e9;
+    r.burst = burst < 1 ? 1 : burst;
+    return true;
+}
+
+void my_ratelimit::init_table()
+{
+    if (!m_shards)                      // 桶初始全为0，即空桶
+        m_shards = new shard[SHARDS]();
+}
+
+bool my_ratelimit::set_client_limit(const char* spec)
+{
+    if (!parse_rule(spec, m_client))
+        return false;
+    m_client.prefix[0] = '\0';
+    m_client.len = 0;
+    m_client_enabled = true;
+    init_table();
+    return true;
+}
+
+bool my_ratelimit::add_path_limit(const char* spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (!eq || spec[0] != '/' || eq - spec >= PREFIX_LEN || m_path_count >= MAX_RULES)
+        return false;
+    rule& r = m_paths[m_path_count];
+    if (!parse_rule(eq + 1, r))
+        return false;
+    memcpy(r.prefix, spec, eq - spec);
+    r.prefix[eq - spec] = '\0';
+    r.len = eq - spec;
+    m_path_count++;
+    init_table();
+    return true;
+}
+
+bool my_ratelimit::set_v6_prefix(const char* text)
+{
+    char* end = NULL;
+    long bits = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || bits < 1 || bits > 128)
+        return false;
+    m_v6_prefix = (int)bits;
+    return true;
+}
+
+bool my_ratelimit::take(uint64_t key, const rule& r, int64_t now)
+{
+    shard& s = m_shards[key % SHARDS];
+    bucket* set = s.sets[(key / SHARDS) % SETS];
+
+    s.locker.lock();
+    bucket* b = NULL;
+    bucket* victim = &set[0];
+    for (int i = 0; i < WAYS; i++)
+    {
+        if (set[i].key == key)
+        {
+            b = &set[i];
+            break;
+        }
+        if (set[i].last < victim->last)
+            victim = &set[i];
+    }
+    if (!b)                             // 新的客户端从满桶开始
+    {
+        b = victim;
+        b->key = key;
+        b->tokens = r.burst;
+    }
+    else
+    {
+        b->tokens += (now - b->last) * r.rate;
+        if (b->tokens > r.burst)
+            b->tokens = r.burst;
+    }
+    b->last = now;
+    bool ok = b->tokens >= 1;
+    if (ok)
+        b->tokens -= 1;
+    s.locker.unlock();
+    return ok;
+}
+
+bool my_ratelimit::allow(const struct sockaddr* peer, const char* url)
+{
+    const unsigned char* addr = NULL;
+    size_t len = 0;
+    unsigned char prefix[16];
+    if (peer->sa_family == AF_INET)
+    {
+        addr = (const unsigned char*)&((const struct sockaddr_in*)peer)->sin_addr;
+        len = 4;
+    }
+    else if (peer->sa_family == AF_INET6)
+    {
+        /** 只取前缀，同一个/64（默认）里轮换源地址的客户端共用一个桶 **/
+        memcpy(prefix, &((const struct sockaddr_in6*)peer)->sin6_addr, 16);
+        len = (m_v6_prefix + 7) / 8;
+        if (m_v6_prefix % 8)
+            prefix[len - 1] &= (unsigned char)(0xff << (8 - m_v6_prefix % 8));
+        addr = prefix;
+    }
+    else                                // 本地socket上的客户端不限速
+    {
+        return true;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    if (m_client_enabled && !take(bucket_key(addr, len, -1), m_client, now))
+        return false;
+    for (int i = 0; i < m_path_count; i++)
+    {
+        if (strncmp(url, m_paths[i].prefix, m_paths[i].len) == 0)
+            return take(bucket_key(addr, len, i), m_paths[i], now);
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef _MY_RATELIMIT_H_
+#define _MY_RATELIMIT_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "my_locker.h"
+
+/*
+*   按客户端IP与路径前缀限速的令牌桶
+*   桶放在固定大小、分片加锁的哈希表里（每片一把锁，组相联，每组WAYS个桶），
+*   令牌在每次检查时按距离上次检查的时间补充，不需要后台线程清理；
+*   一组满了就替换最久没有请求的桶，那样的桶早已补满，替换掉等于让它重新从满桶开始。
+*   检查在请求头解析完、任何文件操作之前进行，超过限制的请求直接应答429。
+*   IPv4客户端按完整地址计；IPv6客户端按地址前缀计（默认/64），一个站点通常分到整个/64，
+*   按完整地址计时换个源地址就能绕过限制
+*/
+
+class my_ratelimit
+{
+public:
+    /** 表的大小：SHARDS * SETS * WAYS 个桶，启用限速时一次分配 **/
+    static const int SHARDS = 64;
+    static const int SETS = 256;
+    static const int WAYS = 4;
+    /** 路径规则的最大数量与前缀长度 **/
+    static const int MAX_RULES = 16;
+    static const int PREFIX_LEN = 128;
+
+    /** 解析 RATE[,BURST]：每个客户端IP每秒RATE个请求，最多积攒BURST个，出错返回false **/
+    static bool set_client_limit(const char* spec);
+    /** 解析 PREFIX=RATE[,BURST]：每个客户端IP对PREFIX下的路径的限制，先配置的规则优先 **/
+    static bool add_path_limit(const char* spec);
+    /** 解析IPv6客户端按多长的前缀合并计数（1~128位），出错返回false **/
+    static bool set_v6_prefix(const char* text);
+    static bool enabled() { return m_shards != NULL; }
+
+    /** 记一次来自peer、请求url的请求，超过任何一个适用的限制时返回false **/
+    static bool allow(const struct sockaddr* peer, const char* url);
+
+private:
+    struct rule
+    {
+        char        prefix[PREFIX_LEN];
+        size_t      len;
+        /** 每纳秒补充的令牌数与桶的容量 **/
+        double      rate;
+        double      burst;
+    };
+
+    struct bucket
+    {
+        /** 客户端地址与规则的哈希，0表示空桶 **/
+        uint64_t    key;
+        int64_t     last;
+        double      tokens;
+    };
+
+    struct alignas(64) shard
+    {
+        mutex_locker    locker;
+        bucket          sets[SETS][WAYS];
+    };
+
+    static bool parse_rule(const char* spec, rule& r);
+    /** 从key对应的桶里取一个令牌 **/
+    static bool take(uint64_t key, const rule& r, int64_t now);
+    static void init_table();
+
+private:
+    static rule     m_client;
+    static bool     m_client_enabled;
+    static rule     m_paths[MAX_RULES];
+    static int      m_path_count;
+    /** IPv6地址参与计数的前缀位数 **/
+    static int      m_v6_prefix;
+    static shard*   m_shards;
+};
+
+#endif
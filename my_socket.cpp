@@ -0,0 +1,250 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include "my_socket.h"
+#include "my_stats.h"
+
+#ifdef MY_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+extern void modfd(int epollfd, int fd, int ev);
+
+int my_socket::m_epollfd = -1;
+my_socket* my_socket::m_sockets[my_socket::MAX_SOCKET];
+
+void my_socket::attach(int fd)
+{
+    m_fd = fd;
+    m_revents = 0;
+    m_waiter.store(NULL);
+    m_sockets[fd] = this;
+}
+
+void my_socket::detach()
+{
+#ifdef MY_TLS
+    if (m_ssl)
+    {
+        if (!m_tls_failed && SSL_is_init_finished(m_ssl))
+        {
+            ERR_clear_error();
+            SSL_shutdown(m_ssl);        // 只发出close_notify，不等对端的回应
+        }
+        SSL_free(m_ssl);
+        ERR_clear_error();
+    }
+#endif
+    m_ssl = NULL;
+    m_ktls_send = false;
+    m_tls_failed = false;
+    if (m_fd != -1)
+    {
+        m_sockets[m_fd] = NULL;
+        m_fd = -1;
+    }
+}
+
+void my_socket::wait_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    m_sock->rearm(h, m_events);
+}
+
+void my_socket::rearm(std::coroutine_handle<> h, uint32_t events)
+{
+    int fd = m_fd;
+    m_waiter.store(h.address());
+    modfd(m_epollfd, fd, events);       // 重新注册之后协程可能马上在事件循环线程被恢复，之后不能再访问协程帧
+}
+
+void my_socket::dispatch(int fd, uint32_t events)
+{
+    my_socket* sock = m_sockets[fd];
+    if (!sock)
+        return;
+    void* waiter = sock->m_waiter.exchange(NULL);
+    if (!waiter)                       // 协程没有挂起在这个fd上（正在别的线程运行），忽略这次事件
+        return;                        // 它下次I/O返回EAGAIN时会重新注册，EPOLL_CTL_MOD会重新检查就绪状态
+    sock->m_revents = events;
+    std::coroutine_handle<>::from_address(waiter).resume();
+}
+
+bool my_socket::tls_pending() const
+{
+#ifdef MY_TLS
+    return m_ssl && SSL_pending(m_ssl) > 0;
+#else
+    return false;
+#endif
+}
+
+ssize_t my_socket::tls_error(int ret)
+{
+#ifdef MY_TLS
+    switch (SSL_get_error(m_ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:     // 对端发了close_notify
+            return 0;
+        default:
+            break;
+    }
+    m_tls_failed = true;
+    ERR_clear_error();
+    errno = ECONNRESET;
+#endif
+    return -1;
+}
+
+int my_socket::accept_tls()
+{
+#ifdef MY_TLS
+    ERR_clear_error();
+    int ret = SSL_accept(m_ssl);
+    if (ret == 1)
+    {
+        my_stats::add(my_stats::TLS_HANDSHAKES);
+        if (SSL_session_reused(m_ssl))
+            my_stats::add(my_stats::TLS_RESUMED);
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        if (m_ktls_send)
+            my_stats::add(my_stats::KTLS_SEND);
+        return 0;
+    }
+    switch (SSL_get_error(m_ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ: return EPOLLIN;
+        case SSL_ERROR_WANT_WRITE: return EPOLLOUT;
+        default: break;
+    }
+    m_tls_failed = true;
+    ERR_clear_error();
+#endif
+    return -1;
+}
+
+ssize_t my_socket::tls_write(const char* data, size_t len)
+{
+#ifdef MY_TLS
+    ERR_clear_error();
+    size_t n = 0;
+    int ret = SSL_write_ex(m_ssl, data, len, &n);
+    if (ret == 1)
+        return n;
+    return tls_error(ret);
+#else
+    return -1;
+#endif
+}
+
+ssize_t my_socket::recv_some(char* buf, size_t len)
+{
+#ifdef MY_TLS
+    if (m_ssl)                          // 接收方向即使进入了内核TLS，也要由OpenSSL处理记录类型不是应用数据的消息
+    {
+        ERR_clear_error();
+        size_t n = 0;
+        int ret = SSL_read_ex(m_ssl, buf, len, &n);
+        if (ret == 1)
+            return n;
+        return tls_error(ret);
+    }
+#endif
+    return recv(m_fd, buf, len, 0);
+}
+
+ssize_t my_socket::send_some(const struct iovec* iv, int count, bool more)
+{
+#ifdef MY_TLS
+    if (m_ssl && !m_ktls_send)
+    {
+        /** 用户态加密没有writev，连续的小块先拼成一个记录再加密，不让每个iovec单独成为一个记录。
+            部分写入之后重试时拼出的内容以上次的数据开头、长度不会更短，满足SSL_write重试的要求 **/
+        static thread_local char record[TLS_RECORD];
+        const char* data = (const char*)iv[0].iov_base;
+        size_t len = iv[0].iov_len;
+        if (count > 1 && len < TLS_RECORD)
+        {
+            len = 0;
+            for (int i = 0; i < count && len < TLS_RECORD; i++)
+            {
+                size_t step = iv[i].iov_len < TLS_RECORD - len ? iv[i].iov_len : TLS_RECORD - len;
+                memcpy(record + len, iv[i].iov_base, step);
+                len += step;
+            }
+            data = record;
+        }
+        return tls_write(data, len);
+    }
+#endif
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iv;
+    msg.msg_iovlen = count;
+    return sendmsg(m_fd, &msg, more ? MSG_MORE : 0);
+}
+
+ssize_t my_socket::send_file(int fd, off_t* offset, size_t len)
+{
+#ifdef MY_TLS
+    if (m_ssl && !m_ktls_send)          // 没有内核TLS时只能读到用户态加密，每次一个记录
+    {
+        static thread_local char record[TLS_RECORD];
+        ssize_t n = pread(fd, record, len < TLS_RECORD ? len : TLS_RECORD, *offset);
+        if (n <= 0)
+            return n;
+        n = tls_write(record, n);
+        if (n > 0)
+            *offset += n;
+        return n;
+    }
+#endif
+    return ::sendfile(m_fd, fd, offset, len);
+}
+
+my_task<ssize_t> my_socket::read(char* buf, size_t len)
+{
+    while (1)
+    {
+        ssize_t n = recv_some(buf, len);
+        if (n >= 0)
+            co_return n;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -1;
+        if (!co_await wait(EPOLLIN))
+            co_return -1;
+    }
+}
+
+my_task<bool> my_socket::writev(struct iovec* iv, int count, bool more)
+{
+    while (count > 0)
+    {
+        ssize_t n = send_some(iv, count, more);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                co_return false;
+            if (!co_await wait(EPOLLOUT))
+                co_return false;
+            continue;
+        }
+        while (count > 0 && (size_t)n >= iv->iov_len)    // 跳过已经完整写出的块
+        {
+            n -= iv->iov_len;
+            iv++;
+            count--;
+        }
+        if (count > 0)                                   // 部分写出的块，推进起始位置
+        {
+            iv->iov_base = (char*)iv->iov_base + n;
+            iv->iov_len -= n;
+        }
+    }
+    co_return true;
+}
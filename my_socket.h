@@ -0,0 +1,111 @@
+#ifndef _MY_SOCKET_H_
+#define _MY_SOCKET_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <atomic>
+#include "my_coroutine.h"
+
+/*
+*   可等待的非阻塞socket
+*   I/O返回EAGAIN时协程挂起，并以EPOLLONESHOT重新注册事件；事件循环调用dispatch直接恢复协程。
+*   TLS连接（my_tls.h）的收发经过SSL会话，recv_some/send_some/send_file保持与recv/sendmsg/sendfile相同的返回值约定，
+*   发送方向进入内核TLS之后直接对fd发送明文
+*/
+
+struct ssl_st;
+
+class my_socket
+{
+public:
+    /** 事件分发表的大小，与服务器允许的最大fd一致 **/
+    static const int MAX_SOCKET = 65536;
+
+    /** 用户态加密时每次最多交给SSL_write的字节数，即一个TLS记录 **/
+    static const size_t TLS_RECORD = 16384;
+
+    my_socket() : m_fd(-1), m_revents(0), m_waiter(NULL), m_ssl(NULL), m_ktls_send(false), m_tls_failed(false) { }
+
+    /** 绑定fd并登记到事件分发表，fd需已通过addfd加入epoll **/
+    void attach(int fd);
+    /** 从事件分发表中注销，TLS连接先发出close_notify并释放会话 **/
+    void detach();
+    int fd() const { return m_fd; }
+
+    /** 连接上的收发改为经过ssl，detach时释放 **/
+    void set_tls(struct ssl_st* ssl) { m_ssl = ssl; }
+    bool tls() const { return m_ssl != NULL; }
+    /** 推进一步TLS握手：完成返回0，需要等待时返回要等的事件，失败返回-1 **/
+    int accept_tls();
+    /** 能否直接对fd做splice：读方向只有明文连接可以，写方向在明文连接或者内核TLS发送时可以 **/
+    bool splice_in() const { return m_ssl == NULL; }
+    bool splice_out() const { return m_ssl == NULL || m_ktls_send; }
+
+    /** 非阻塞的收发，返回值与errno的约定与recv/sendmsg/sendfile相同 **/
+    ssize_t recv_some(char* buf, size_t len);
+    ssize_t send_some(const struct iovec* iv, int count, bool more);
+    ssize_t send_file(int fd, off_t* offset, size_t len);
+
+    /** 读取数据，返回读到的字节数，0表示对端关闭，-1表示出错 **/
+    my_task<ssize_t> read(char* buf, size_t len);
+    /** 写出全部iovec，部分写入时推进iovec继续写；more为true表示后面还有数据(MSG_MORE) **/
+    my_task<bool> writev(struct iovec* iv, int count, bool more = false);
+
+    /** 挂起当前协程直到fd上出现events事件，出错或挂断时返回false **/
+    struct wait_awaiter
+    {
+        my_socket*  m_sock;
+        uint32_t    m_events;
+
+        /** SSL会话里还有已经解密、没有读走的数据时，fd不会再有可读事件，不能挂起 **/
+        bool await_ready() { return (m_events & EPOLLIN) && m_sock->tls_pending(); }
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume() { return m_sock->ok(); }
+    };
+    wait_awaiter wait(uint32_t events) { return wait_awaiter{this, events}; }
+
+    /** 为已经挂起的协程h注册events事件，由事件循环恢复它，可以在其他线程上调用 **/
+    void rearm(std::coroutine_handle<> h, uint32_t events);
+    /** 最近一次恢复时没有出错或挂断 **/
+    bool ok() const { return !(m_revents & (EPOLLERR | EPOLLHUP)); }
+
+    /** 由事件循环调用：恢复阻塞在fd上的协程 **/
+    static void dispatch(int fd, uint32_t events);
+    /** 处理一批事件时预取下一个fd对应的对象，dispatch时不用等内存 **/
+    static void prefetch(int fd)
+    {
+        my_socket* sock = m_sockets[fd];
+        if (sock)
+            __builtin_prefetch(sock);
+    }
+
+public:
+    /** 所有socket注册在同一个epoll内核事件表 **/
+    static int m_epollfd;
+
+private:
+    int                 m_fd;
+    /** 最近一次恢复时epoll返回的事件 **/
+    uint32_t            m_revents;
+    /** 挂起在该fd上的协程，事件循环与工作线程都会访问，所以是原子的 **/
+    std::atomic<void*>  m_waiter;
+
+    struct ssl_st*      m_ssl;
+    /** 握手完成后发送方向是否进入了内核TLS **/
+    bool                m_ktls_send;
+    /** SSL会话出现了致命错误，不能再发close_notify **/
+    bool                m_tls_failed;
+
+    static my_socket*   m_sockets[MAX_SOCKET];
+
+private:
+    bool tls_pending() const;
+    /** 把SSL调用失败转换成recv/send的约定：需要等待时errno为EAGAIN，对端正常关闭返回0 **/
+    ssize_t tls_error(int ret);
+    ssize_t tls_write(const char* data, size_t len);
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include "my_sse.h"
+#include "my_config.h"
+#include "my_stats.h"
+
+my_sse* my_sse::m_head = NULL;
+int my_sse::m_count = 0;
+uint64_t my_sse::m_last_id = 0;
+uint64_t my_sse::m_last_publish = 0;
+my_timer::entry my_sse::m_heartbeat;
+
+my_sse::my_sse(my_socket* sock, my_outqueue* out)
+    : m_sock(sock), m_out(out), m_prev(NULL), m_next(NULL), m_dropped(false), m_notified(false)
+{
+    m_out->set_done(on_sent, NULL);
+}
+
+my_sse::~my_sse()
+{
+    unlink();
+    m_out->clear();                 // 没发完的事件在这里释放引用
+    m_out->set_done(NULL, NULL);    // 发送队列属于连接，之后还会被普通的HTTP应答使用
+}
+
+my_sse::message* my_sse::create(size_t len)
+{
+    message* msg = (message*)malloc(sizeof(message) + len);
+    if (!msg)
+        return NULL;
+    msg->refs.store(1, std::memory_order_relaxed);
+    msg->len = len;
+    return msg;
+}
+
+void my_sse::release(message* msg)
+{
+    if (msg->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        free(msg);
+}
+
+void my_sse::on_sent(void* arg, void* owner)
+{
+    release((message*)owner);
+}
+
+void my_sse::link()
+{
+    m_prev = NULL;
+    m_next = m_head;
+    if (m_head)
+        m_head->m_prev = this;
+    m_head = this;
+    m_count++;
+    if (!m_heartbeat.pending())
+    {
+        m_heartbeat.fn = on_heartbeat;
+        my_timer::add(&m_heartbeat, HEARTBEAT);
+    }
+}
+
+void my_sse::unlink()
+{
+    if (!m_prev && m_head != this)
+        return;
+    if (m_prev)
+        m_prev->m_next = m_next;
+    else
+        m_head = m_next;
+    if (m_next)
+        m_next->m_prev = m_prev;
+    m_prev = m_next = NULL;
+    m_count--;
+}
+
+int my_sse::broadcast(message* msg)
+{
+    m_last_publish = my_timer::now();
+    int delivered = 0;
+    for (my_sse* sub = m_head; sub; )
+    {
+        my_sse* next = sub->m_next;         // 唤醒的订阅者可能马上结束并把自己从链表中摘掉
+        if (sub->m_dropped)
+        {
+            sub = next;
+            continue;
+        }
+        bool idle = sub->m_out->empty();    // 队列不空时协程正在等可写，发完前面的数据会接着发这一条
+        if (sub->m_out->pending() + msg->len > (size_t)my_config::m_sse_max_queue)
+        {
+            sub->m_dropped = true;
+            my_stats::add(my_stats::SSE_DROPPED);
+            idle = true;
+        }
+        else
+        {
+            msg->refs.fetch_add(1, std::memory_order_relaxed);
+            sub->m_out->append(msg->data(), msg->len, msg);
+            delivered++;
+        }
+        if (idle)
+        {
+            sub->m_notified = true;
+            my_socket::dispatch(sub->m_sock->fd(), 0);
+        }
+        sub = next;
+    }
+    return delivered;
+}
+
+int my_sse::publish(const char* event, const char* data, size_t len)
+{
+    if (len > 0 && data[len - 1] == '\n')       // 请求体末尾的换行不算一个空行
+        len--;
+
+    /** 先算出编码后的长度，一次分配：id行、event行、每行数据一个data:，最后一个空行 **/
+    char head[128];
+    int head_len = snprintf(head, sizeof(head), "id: %llu\n", (unsigned long long)(m_last_id + 1));
+    if (event && event[0])
+        head_len += snprintf(head + head_len, sizeof(head) - head_len, "event: %.64s\n", event);
+    size_t size = head_len + 1;
+    for (size_t pos = 0; ; )
+    {
+        const char* eol = (const char*)memchr(data + pos, '\n', len - pos);
+        size_t end = eol ? eol - data : len;
+        size_t line = end - pos;
+        if (line > 0 && data[end - 1] == '\r')
+            line--;
+        size += 6 + line + 1;                   // "data: " + 行 + "\n"
+        if (!eol)
+            break;
+        pos = end + 1;
+    }
+
+    message* msg = create(size);
+    if (!msg)
+        return -1;
+    char* p = msg->data();
+    memcpy(p, head, head_len);
+    p += head_len;
+    for (size_t pos = 0; ; )
+    {
+        const char* eol = (const char*)memchr(data + pos, '\n', len - pos);
+        size_t end = eol ? eol - data : len;
+        size_t line = end - pos;
+        if (line > 0 && data[end - 1] == '\r')
+            line--;
+        memcpy(p, "data: ", 6);
+        memcpy(p + 6, data + pos, line);
+        p += 6 + line;
+        *p++ = '\n';
+        if (!eol)
+            break;
+        pos = end + 1;
+    }
+    *p++ = '\n';
+
+    m_last_id++;
+    my_stats::add(my_stats::SSE_EVENTS);
+    int delivered = broadcast(msg);
+    release(msg);                               // 没有订阅者时在这里释放
+    return delivered;
+}
+
+void my_sse::on_heartbeat(void* arg)
+{
+    if (m_count == 0)                           // 没有订阅者时停止，下一个订阅者到来时重新开始
+        return;
+    uint64_t idle = my_timer::now() - m_last_publish;
+    if (idle < (uint64_t)HEARTBEAT)
+    {
+        my_timer::add(&m_heartbeat, HEARTBEAT - idle);
+        return;
+    }
+    /** 注释行，客户端忽略它，只用来让中间的代理不断开空闲连接，以及发现已经消失的对端 **/
+    message* msg = create(2);
+    if (msg)
+    {
+        memcpy(msg->data(), ":\n", 2);
+        broadcast(msg);
+        release(msg);
+    }
+    my_timer::add(&m_heartbeat, HEARTBEAT);
+}
+
+my_task<> my_sse::run()
+{
+    link();
+    my_stats::add(my_stats::SSE_SUBSCRIBERS);
+    bool closed = false;
+    while (!m_dropped && !closed)
+    {
+        int ret = m_out->flush(m_sock);
+        if (ret == my_outqueue::FLUSH_ERROR)
+            break;
+        /** 发完时只等对端关闭（或者被广播唤醒），发不完时同时等可写 **/
+        uint32_t events = (ret == my_outqueue::FLUSH_DONE) ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+        if (!co_await m_sock->wait(events))
+            break;
+        if (m_notified)
+        {
+            m_notified = false;
+            continue;
+        }
+        /** 订阅者不应该发来数据，读到的直接丢弃，读到0表示对端关闭 **/
+        char buf[256];
+        ssize_t n;
+        while ((n = m_sock->recv_some(buf, sizeof(buf))) > 0)
+            ;
+        if (n == 0 || errno != EAGAIN)
+            closed = true;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef _MY_SSE_H_
+#define _MY_SSE_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_outqueue.h"
+#include "my_timer.h"
+
+/*
+*   Server-Sent Events的广播：GET --sse 指定的URL订阅，POST同一个URL发布（请求体是事件的数据，?event=NAME给出事件名）
+*   发布时事件只编码一次，放进一块带引用计数的只读内存，每个订阅者的发送队列只引用这块内存（my_outqueue的外部内存分段），
+*   一次广播的数据占用与订阅者数量无关，最后一个订阅者发完时释放。
+*   订阅者的队列里积压超过 --sse-max-queue 字节时认为它跟不上，直接断开，不让它拖住内存。
+*   订阅者与发布都只在事件循环线程上运行，订阅者链表不加锁；没有事件时每隔HEARTBEAT秒广播一行注释保持连接
+*/
+
+class my_sse
+{
+public:
+    /** 没有事件时发送心跳注释的间隔（tick） **/
+    static const int HEARTBEAT = 15;
+
+    /** 广播一个事件，event可以为NULL；data中的每一行编码为一行data:。返回收到事件的订阅者数 **/
+    static int publish(const char* event, const char* data, size_t len);
+    /** 当前的订阅者数 **/
+    static int subscribers() { return m_count; }
+
+public:
+    my_sse(my_socket* sock, my_outqueue* out);
+    ~my_sse();
+
+    /** 应答头已经发出，把广播的事件发给订阅者，直到连接关闭或者因为积压被断开 **/
+    my_task<> run();
+
+private:
+    /** 编码好的事件，数据紧跟在结构之后 **/
+    struct message
+    {
+        std::atomic<int>    refs;
+        size_t              len;
+
+        char* data() { return (char*)(this + 1); }
+    };
+
+    static message* create(size_t len);
+    static void release(message* msg);
+    /** 把一条编码好的事件放进所有订阅者的队列 **/
+    static int broadcast(message* msg);
+    /** 发送队列发完一个分段，owner为它引用的事件 **/
+    static void on_sent(void* arg, void* owner);
+    static void on_heartbeat(void* arg);
+
+    void link();
+    void unlink();
+
+private:
+    my_socket*          m_sock;
+    my_outqueue*        m_out;
+    /** 订阅者链表 **/
+    my_sse*             m_prev;
+    my_sse*             m_next;
+    /** 积压超过上限，等协程醒来后断开 **/
+    bool                m_dropped;
+    /** 被广播直接唤醒（而不是socket上有事件），醒来后不用读socket **/
+    bool                m_notified;
+
+    static my_sse*          m_head;
+    static int              m_count;
+    /** 事件的id，从1开始递增 **/
+    static uint64_t         m_last_id;
+    /** 最近一次广播时的tick，心跳只在空闲时发送 **/
+    static uint64_t         m_last_publish;
+    static my_timer::entry  m_heartbeat;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include "my_stats.h"
+
+my_stats::counter my_stats::m_counters[my_stats::COUNTER_NUM];
+
+const char* const my_stats::m_names[my_stats::COUNTER_NUM] =
+{
+    "requests_inline",
+    "requests_offloaded",
+    "pool_full",
+    "pool_fast_jobs",
+    "pool_fast_wait_us",
+    "pool_fast_wait_1ms",
+    "pool_bulk_jobs",
+    "pool_bulk_wait_us",
+    "pool_bulk_wait_1ms",
+    "cache_hit",
+    "cache_miss",
+    "aio_prefetch",
+    "rate_limited",
+    "tls_handshakes",
+    "tls_resumed",
+    "ktls_send",
+    "websocket_sessions",
+    "websocket_messages",
+    "sse_subscribers",
+    "sse_events",
+    "sse_dropped",
+};
+
+void my_stats::format(std::string& out)
+{
+    char line[96];
+    for (int i = 0; i < COUNTER_NUM; i++)
+    {
+        int n = snprintf(line, sizeof(line), "%s %llu\n", m_names[i], (unsigned long long)get((COUNTER)i));
+        out.append(line, n);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _MY_STATS_H_
+#define _MY_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+/*
+*   服务器的运行计数器，各线程直接原子地累加，通过 --stats-url 指定的URL以 "名字 数值" 的文本格式读取。
+*   每个计数器独占一个缓存行，不同线程累加不同的计数器时不会互相争用
+*/
+
+class my_stats
+{
+public:
+    enum COUNTER {  REQUESTS_INLINE = 0,    // 在事件循环线程上直接完成的请求
+                    REQUESTS_OFFLOADED,     // 交给线程池处理的请求
+                    POOL_FULL,              // 线程池队列已满，只能留在当前线程执行的次数
+                    POOL_FAST_JOBS,         // 从线程池FAST通道取出的任务
+                    POOL_FAST_WAIT_US,      // 这些任务在队列中等待的总时间(微秒)
+                    POOL_FAST_WAIT_1MS,     // 其中等待超过1毫秒的任务
+                    POOL_BULK_JOBS,         // BULK通道，同上
+                    POOL_BULK_WAIT_US,
+                    POOL_BULK_WAIT_1MS,
+                    CACHE_HIT,              // 文件缓存命中
+                    CACHE_MISS,             // 文件缓存没有命中，需要stat/open
+                    AIO_PREFETCH,           // 数据不在页缓存中，交给I/O线程预读的次数
+                    RATE_LIMITED,           // 超过限速被拒绝的请求
+                    TLS_HANDSHAKES,         // 完成的TLS握手
+                    TLS_RESUMED,            // 其中恢复了会话的握手
+                    KTLS_SEND,              // 其中发送方向进入了内核TLS的连接
+                    WS_SESSIONS,            // 建立的WebSocket会话
+                    WS_MESSAGES,            // 收到的完整WebSocket消息
+                    SSE_SUBSCRIBERS,        // 建立的SSE订阅
+                    SSE_EVENTS,             // 广播的SSE事件
+                    SSE_DROPPED,            // 因为积压过多被断开的SSE订阅者
+                    COUNTER_NUM
+                 };
+
+    static void add(COUNTER c, uint64_t n = 1) { m_counters[c].value.fetch_add(n, std::memory_order_relaxed); }
+    static uint64_t get(COUNTER c) { return m_counters[c].value.load(std::memory_order_relaxed); }
+    /** 把所有计数器格式化为文本，每行一个 **/
+    static void format(std::string& out);
+
+private:
+    struct alignas(64) counter
+    {
+        std::atomic<uint64_t>   value;
+    };
+
+    static counter              m_counters[COUNTER_NUM];
+    static const char* const    m_names[COUNTER_NUM];
+};
+
+#endif
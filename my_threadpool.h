@@ -7,15 +7,23 @@
 #include <pthread.h>
 #include "my_locker.h"
 
+/*
+*   请求队列分为两条通道：延迟敏感的小请求走FAST，大文件、上传这类一次占用工作线程较久的请求走BULK。
+*   前reserved个工作线程只处理FAST通道，大请求再多也不会占满所有线程；
+*   其余线程两条通道都有任务时，每取weight个FAST任务取一个BULK任务，BULK通道不会被饿死
+*/
+enum pool_lane { LANE_FAST = 0, LANE_BULK, LANE_NUM };
+
 template <typename T>               // 参数T为任务类
 class threadpool
 {
 public:
-    threadpool(int thread_num = 8, int max_requests = 10000);  // 默认线程数为8，最大连接请求为10000
+    threadpool(int thread_num = 8, int max_requests = 10000,    // 默认线程数为8，最大连接请求为10000
+               int reserved = 0, int weight = 4);               // 默认不保留线程，两条通道都有任务时按4:1取
     ~threadpool();
 
-    bool append(T* request);                    // 往请求队列添加任务请求的函数，仅有的除构造析构函数之外的 公开接口 ，
-                                                // 只需要把任务加进来就行了
+    bool append(T* request, int lane = LANE_FAST);  // 往请求队列添加任务请求的函数，仅有的除构造析构函数之外的 公开接口 ，
+                                                    // 只需要把任务加进来就行了，lane为任务所在的通道
 private:
     static void* worker(void* arg);             // 静态成员函数。工作线程运行的函数，不断的从请求队列中取出线程并运行
                                                 // 注意worker函数一般来说，必须为静态成员函数
@@ -27,26 +35,38 @@ private:
                                                 // 然后通过传入this指针，再调用下面的run函数，实际执行真正属于每个对象的操作
                                                 
     void run();                                 // 实际运行的函数
+    T* take(bool reserved);                     // 按通道的优先级取出一个任务，队列为空时返回NULL，需要持有m_queuelocker
 
 private:
     int             m_thread_number;            // 线程池的线程数
     int             m_max_requests;             // 请求队列中允许的最大请求数
     pthread_t*      m_threads;                  // 线程池数组，大小为线程数
-    std::list<T*>   m_workqueue;                // 任务请求队列
+    int             m_reserved;                 // 只处理FAST通道的线程数
+    int             m_weight;                   // 两条通道都有任务时，每取一个BULK任务之前最多连续取的FAST任务数
+    int             m_fast_run;                 // 已经连续取了多少个FAST任务
+    int             m_started;                  // 已经启动的线程数，先启动的m_reserved个线程为保留线程
+    std::list<T*>   m_workqueue[LANE_NUM];      // 每条通道一个任务请求队列
     mutex_locker    m_queuelocker;              // 保护任务请求队列的互斥锁
-    sem             m_queuestat;                // 是否有任务需要处理
+    sem             m_queuestat;                // 是否有任务需要处理，每个任务post一次
+    sem             m_reservedstat;             // 是否有FAST任务需要保留线程处理，每个FAST任务post一次
     bool            m_stop;                     // 是否结束线程
 };
 
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) :    // 构造函数
+threadpool<T>::threadpool(int thread_number, int max_requests, int reserved, int weight) :    // 构造函数
                           m_thread_number(thread_number), 
                           m_max_requests(max_requests),
                           m_threads(NULL), 
+                          m_reserved(reserved),
+                          m_weight(weight),
+                          m_fast_run(0),
+                          m_started(0),
                           m_stop(false) 
 {
     if (thread_number <= 0 || max_requests <= 0)            // 如果线程数与最大任务请求数不符合要求，则抛出异常
         throw std::exception();
+    if (reserved < 0 || reserved >= thread_number || weight <= 0)   // 至少留一个线程处理BULK通道
+        throw std::exception();
 
     m_threads = new pthread_t[thread_number];               // 线程数组，后面的线程tid号都是存放在这个数组中
     if (!m_threads)                                         // 创建失败，抛出异常
@@ -56,7 +76,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests) :    // 构造函
     {
         printf("create the %dth thread\n", i);
 
-        if (pthread_create(m_threads+i, NULL, worker, this) != 0)      // 创建线程，线程id存放于线程数组
+        if (pthread_create(m_threads+i-1, NULL, worker, this) != 0)      // 创建线程，线程id存放于线程数组
                                                                        // 注意，给worker传递的参数是 this，即指针对象本身的指针
                                                                        // 因为worker是必须设置为静态成员函数，否则不能通过
         {                                                              // 因为非静态函数会自动加一个this指针，导致编译无法通过
@@ -81,17 +101,19 @@ threadpool<T>::~threadpool()
 }
 
 template<typename T>
-bool threadpool<T>::append(T* request)     // 往任务请求队列中添加请求
+bool threadpool<T>::append(T* request, int lane)     // 往任务请求队列中添加请求
 {       
     m_queuelocker.lock();                   // 操作之前需要对队列上锁
-    if (m_workqueue.size() >= m_max_requests)   //如果已经达到最大的任务请求数了，则忽略请求，返回false
-    {
+    if (m_workqueue[LANE_FAST].size() + m_workqueue[LANE_BULK].size() >= (size_t)m_max_requests)
+    {                                       // 如果已经达到最大的任务请求数了，则忽略请求，返回false
         m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(request);     // 添加任务请求
+    m_workqueue[lane].push_back(request);   // 添加任务请求
     m_queuelocker.unlock();             // 解锁
     m_queuestat.post();                 // 通知线程池，有任务请求到了，快来处理
+    if (lane == LANE_FAST && m_reserved > 0)
+        m_reservedstat.post();          // FAST任务同时通知保留线程，谁先抢到谁处理，另一个醒来发现队列为空就继续等
     return true;
 }
 
@@ -103,27 +125,43 @@ void* threadpool<T>::worker(void* arg)    // 线程池工作函数，内部调
     return pool;
 }
 
+template<typename T>
+T* threadpool<T>::take(bool reserved)
+{
+    bool fast = !m_workqueue[LANE_FAST].empty();
+    bool bulk = !reserved && !m_workqueue[LANE_BULK].empty();
+    if (!fast && !bulk)
+        return NULL;
+    int lane = LANE_FAST;
+    if (bulk && (!fast || m_fast_run >= m_weight))  // BULK通道已经让了weight次，或者FAST通道没有任务
+        lane = LANE_BULK;
+    if (!reserved)
+        m_fast_run = (lane == LANE_FAST) ? m_fast_run + 1 : 0;
+    T* request = m_workqueue[lane].front();
+    m_workqueue[lane].pop_front();
+    return request;
+}
+
 template<typename T>
 void threadpool<T>::run()                 // 线程池的实际工作函数
 {
+    m_queuelocker.lock();
+    bool reserved = m_started++ < m_reserved;   // 先启动的线程作为保留线程，只处理FAST通道
+    m_queuelocker.unlock();
+    sem& stat = reserved ? m_reservedstat : m_queuestat;
+
     while (!m_stop)                       // 只要m_stop没有设为停止，则不断循环
     {
-        m_queuestat.wait();               // 阻塞于任务请求队列，若有任务了，将会被唤醒
+        stat.wait();                      // 阻塞于任务请求队列，若有任务了，将会被唤醒
                                           // 线程池启动之后，在没有任务来之前，全部线程阻塞于此
                                           // 当有任务来了之后，服务器主线程调用append添加任务
                                           // 然后append函数会发信号通知正在wait的线程
                                           // 然后正在wait的函数通过竞争上岗，谁抢到谁上
                                           
         m_queuelocker.lock();             // 唤醒后，先上锁
-        if (m_workqueue.empty())          // 如果发现队列是空的，那就跳出本次循环，继续等待请求队列
-        {
-            m_queuelocker.unlock();
-            continue;
-        }
-        T* request = m_workqueue.front();  // 如果有任务请求，则取出
-        m_workqueue.pop_front();
+        T* request = take(reserved);      // 如果有任务请求，则按通道的优先级取出
         m_queuelocker.unlock();
-        if (!request)                      // 如果取出后发现是空的。。。就继续等待。。。
+        if (!request)                      // 队列是空的（任务被另一种线程抢走了），或者取出后发现是空的。。。就继续等待。。。
             continue;   
         request->process();                // 如果是正常的任务请求，则处理，这是任务类提供的处理接口
     }
@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/timerfd.h>
+#include "my_timer.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+
+int my_timer::m_fd = -1;
+uint64_t my_timer::m_now = 0;
+my_timer::entry my_timer::m_wheel[my_timer::WHEEL_SIZE];
+
+bool my_timer::start(int epollfd)
+{
+    for (int i = 0; i < WHEEL_SIZE; i++)
+        m_wheel[i].prev = m_wheel[i].next = &m_wheel[i];
+
+    m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_fd < 0)
+    {
+        printf("timerfd_create error\n");
+        return false;
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec = TICK_MS / 1000;
+    its.it_interval.tv_nsec = (TICK_MS % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    timerfd_settime(m_fd, 0, &its, NULL);
+    addfd(epollfd, m_fd, false);
+    return true;
+}
+
+void my_timer::link(entry* head, entry* e)
+{
+    e->prev = head->prev;
+    e->next = head;
+    head->prev->next = e;
+    head->prev = e;
+}
+
+void my_timer::add(entry* e, uint64_t ticks)
+{
+    if (e->pending())
+        remove(e);
+    e->expire = m_now + (ticks > 0 ? ticks : 1);
+    link(&m_wheel[e->expire % WHEEL_SIZE], e);
+}
+
+void my_timer::remove(entry* e)
+{
+    if (!e->pending())
+        return;
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+    e->prev = e->next = NULL;
+}
+
+void my_timer::tick()
+{
+    uint64_t expirations = 0;
+    if (read(m_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    while (expirations-- > 0)
+    {
+        m_now++;
+        /** 先把到期的表项摘到临时链表里再逐个回调，回调中可以重新加入自己，或者移除别的表项 **/
+        entry expired;
+        expired.prev = expired.next = &expired;
+        entry* head = &m_wheel[m_now % WHEEL_SIZE];
+        for (entry* e = head->next; e != head; )
+        {
+            entry* next = e->next;
+            if (e->expire <= m_now)
+            {
+                remove(e);
+                link(&expired, e);
+            }
+            e = next;
+        }
+        while (expired.next != &expired)
+        {
+            entry* e = expired.next;
+            remove(e);
+            e->fn(e->arg);
+        }
+    }
+}
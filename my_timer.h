@@ -0,0 +1,59 @@
+#ifndef _MY_TIMER_H_
+#define _MY_TIMER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+*   定时器：单层哈希时间轮，由事件循环线程驱动
+*   timerfd每TICK_MS毫秒触发一次，事件循环读到它时调用tick，推进时间轮并执行到期的回调。
+*   表项嵌在使用者的对象里（双向链表节点），加入与删除都是O(1)，不分配内存，
+*   几万个空闲连接各挂一个表项也只是几万个节点；到期时间超过一圈的表项留在槽里，转到时再比较。
+*   所有操作都只能在事件循环线程上进行，不加锁
+*/
+
+class my_timer
+{
+public:
+    /** 时间轮一格的长度（毫秒）与格数 **/
+    static const int TICK_MS = 1000;
+    static const int WHEEL_SIZE = 256;
+
+    typedef void (*callback)(void* arg);
+
+    struct entry
+    {
+        entry*      prev;
+        entry*      next;
+        /** 到期时的tick **/
+        uint64_t    expire;
+        callback    fn;
+        void*       arg;
+
+        entry() : prev(NULL), next(NULL), expire(0), fn(NULL), arg(NULL) { }
+        bool pending() const { return prev != NULL; }
+    };
+
+    /** 创建timerfd并加入事件循环的epoll，失败返回false **/
+    static bool start(int epollfd);
+    static int fd() { return m_fd; }
+    /** 从启动开始经过的tick数 **/
+    static uint64_t now() { return m_now; }
+
+    /** ticks个tick之后调用e->fn(e->arg)，已经在时间轮中时先移除 **/
+    static void add(entry* e, uint64_t ticks);
+    static void remove(entry* e);
+    /** timerfd可读时由事件循环调用 **/
+    static void tick();
+
+private:
+    static void link(entry* head, entry* e);
+
+private:
+    static int          m_fd;
+    static uint64_t     m_now;
+    /** 每个槽是一个以哨兵为头的循环双向链表 **/
+    static entry        m_wheel[WHEEL_SIZE];
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include "my_tls.h"
+
+#ifdef MY_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+void* my_tls::m_ctx = NULL;
+
+#ifdef MY_TLS
+/** ALPN：客户端支持h2时选h2，否则http/1.1，都不支持时不协商 **/
+static int select_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                       const unsigned char* in, unsigned int inlen, void* arg)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char* selected = NULL;
+    if (SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
+bool my_tls::init(const char* cert, const char* key)
+{
+#ifdef MY_TLS
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    /** 对端不发close_notify就断开按正常关闭处理，而不是报错 **/
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION);
+    /** 发送队列按TLS记录为单位推进，重试时缓冲区的地址可能变了（分段被合并、协程换了线程） **/
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    /** 会话恢复：TLS1.3用握手后下发的票据，TLS1.2用票据或服务端会话缓存，票据密钥由OpenSSL在进程内随机生成 **/
+    static const unsigned char sid_ctx[] = "my_httpserver";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, 20480);
+    SSL_CTX_set_num_tickets(ctx, 2);
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        printf("cannot load certificate %s / key %s\n", cert, key);
+        ERR_print_errors_fp(stdout);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    m_ctx = ctx;
+    return true;
+#else
+    printf("built without TLS support, rebuild with -DMY_TLS -lssl -lcrypto\n");
+    return false;
+#endif
+}
+
+struct ssl_st* my_tls::create(int fd)
+{
+#ifdef MY_TLS
+    SSL* ssl = SSL_new((SSL_CTX*)m_ctx);
+    if (!ssl)
+        return NULL;
+    if (SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+#else
+    return NULL;
+#endif
+}
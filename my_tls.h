@@ -0,0 +1,29 @@
+#ifndef _MY_TLS_H_
+#define _MY_TLS_H_
+
+/*
+*   TLS终结，编译时定义MY_TLS并链接 -lssl -lcrypto 才会启用
+*   所有TLS连接共用一个SSL_CTX：开启服务端会话缓存与会话票据，客户端带着票据重连时恢复会话，
+*   不用再做证书签名；ALPN优先选h2，HTTP/2仍然由连接前言识别。
+*   开启SSL_OP_ENABLE_KTLS：握手完成后OpenSSL把会话密钥交给内核，发送方向进入内核TLS之后，
+*   连接上的sendmsg/sendfile/splice直接写明文，由内核加密，文件照样零拷贝发送；
+*   内核没有tls模块或者套件不支持时退回用户态的SSL_write（my_socket.h）
+*/
+
+struct ssl_st;
+
+class my_tls
+{
+public:
+    /** 加载证书链与私钥并创建SSL_CTX，出错时打印原因并返回false **/
+    static bool init(const char* cert, const char* key);
+    static bool enabled() { return m_ctx != NULL; }
+    /** 为已经accept的fd创建服务端SSL会话，失败返回NULL **/
+    static struct ssl_st* create(int fd);
+
+private:
+    /** 类型为SSL_CTX*，头文件里不引入openssl **/
+    static void*    m_ctx;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "my_trace.h"
+
+int my_trace::m_sample = 0;
+std::atomic<uint32_t> my_trace::m_requests(0);
+std::atomic<my_trace::buffer*> my_trace::m_buffers(NULL);
+
+const char* const my_trace::m_names[my_trace::STAGE_NUM] =
+{
+    "connect",
+    "queue",
+    "parse",
+    "do_request",
+    "upload",
+    "proxy",
+    "write",
+    "request",
+};
+
+my_trace::buffer* my_trace::local_buffer()
+{
+    static thread_local buffer* t_buffer = NULL;
+    if (!t_buffer)
+    {
+        /** 第一次记录时分配，之后一直属于这个线程；线程都活到进程结束，缓冲区不用释放 **/
+        buffer* b = new buffer;
+        b->tid = (int)syscall(SYS_gettid);
+        b->next.store(0, std::memory_order_relaxed);
+        b->link = m_buffers.load(std::memory_order_relaxed);
+        while (!m_buffers.compare_exchange_weak(b->link, b, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        t_buffer = b;
+    }
+    return t_buffer;
+}
+
+void my_trace::record(STAGE stage, uint32_t req, uint64_t start, uint64_t end)
+{
+    buffer* b = local_buffer();
+    uint64_t slot = b->next.load(std::memory_order_relaxed);
+    event& e = b->events[slot % BUFFER_EVENTS];
+    e.start = start;
+    e.dur = end > start ? end - start : 0;
+    e.req = req;
+    e.stage = stage;
+    b->next.store(slot + 1, std::memory_order_release);
+}
+
+void my_trace::format(std::string& out)
+{
+    /** 导出时写入者可能正在覆盖最旧的几条，跳过它们 **/
+    static const uint64_t SLACK = 64;
+    char line[256];
+    int pid = getpid();
+    out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (buffer* b = m_buffers.load(std::memory_order_acquire); b; b = b->link)
+    {
+        int n = snprintf(line, sizeof(line),
+                         "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                         first ? "" : ",\n", pid, b->tid, b->tid == pid ? "event loop" : "worker", b->tid);
+        out.append(line, n);
+        first = false;
+
+        uint64_t end = b->next.load(std::memory_order_acquire);
+        uint64_t begin = end > BUFFER_EVENTS - SLACK ? end - (BUFFER_EVENTS - SLACK) : 0;
+        for (uint64_t i = begin; i < end; i++)
+        {
+            const event& e = b->events[i % BUFFER_EVENTS];
+            if (e.stage >= STAGE_NUM)
+                continue;
+            /** Chrome trace的时间单位是微秒，保留到纳秒 **/
+            n = snprintf(line, sizeof(line),
+                         ",\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                         "\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%u}}",
+                         m_names[e.stage],
+                         (unsigned long long)(e.start / 1000), (unsigned)(e.start % 1000),
+                         (unsigned long long)(e.dur / 1000), (unsigned)(e.dur % 1000),
+                         pid, b->tid, e.req);
+            out.append(line, n);
+        }
+    }
+    out.append("\n]}\n");
+}
+
+bool my_trace::dump(const char* path)
+{
+    std::string out;
+    format(out);
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        return false;
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return fclose(fp) == 0 && ok;
+}
@@ -0,0 +1,100 @@
+#ifndef _MY_TRACE_H_
+#define _MY_TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+/*
+*   按采样记录请求各阶段的耗时，导出为Chrome trace-event JSON，可以直接在Perfetto/chrome://tracing中打开
+*   --trace N 时每N个请求采样一个，被采样的请求在每个阶段结束时记一条 [开始, 结束) 的区间：
+*   建立连接到第一个请求、线程池队列中的等待、解析、文件系统操作、上传、转发、发送，以及整个请求。
+*   区间写进每个线程自己的环形缓冲区，不加锁，写满后覆盖最旧的；导出时逐个复制，正在被覆盖的最旧几条直接跳过。
+*   时间戳用CLOCK_MONOTONIC（vDSO，不进内核），各线程之间可以直接比较。
+*   另外在同样的阶段边界上放了USDT探针（provider为my_httpserver），不论是否采样都在，
+*   没有附加perf/bpftrace时只是一条nop；编译环境没有<sys/sdt.h>时探针为空
+*/
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MY_PROBE(name, fd, req)     DTRACE_PROBE2(my_httpserver, name, fd, req)
+#endif
+#endif
+#ifndef MY_PROBE
+#define MY_PROBE(name, fd, req)     do { } while (0)
+#endif
+
+class my_trace
+{
+public:
+    /** 请求的阶段，也是导出的区间名 **/
+    enum STAGE {    CONNECT = 0,        // accept到连接上第一个请求的第一批数据（包括TLS握手）
+                    QUEUE,              // 在线程池队列中等待工作线程
+                    PARSE,              // 一次process_read
+                    DO_REQUEST,         // 在工作线程上的do_request，stat/open等文件系统操作
+                    UPLOAD,             // 接收上传的请求体
+                    PROXY,              // 转发给上游并取回应答
+                    WRITE,              // 发送应答
+                    REQUEST,            // 整个请求：开始解析到应答发完
+                    STAGE_NUM
+                };
+
+    /** 每个线程的环形缓冲区能放的区间数 **/
+    static const int BUFFER_EVENTS = 16384;
+
+    /** 每n个请求采样一个，0表示关闭 **/
+    static void set_sample(int n) { m_sample = n; }
+    static bool enabled() { return m_sample > 0; }
+    /** 决定是否采样下一个请求，采样时返回请求的编号（不为0），否则返回0 **/
+    static uint32_t sample()
+    {
+        if (m_sample <= 0)
+            return 0;
+        uint32_t n = m_requests.fetch_add(1, std::memory_order_relaxed) + 1;
+        return (n % m_sample == 0) ? n : 0;
+    }
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    /** 记一个区间到当前线程的缓冲区 **/
+    static void record(STAGE stage, uint32_t req, uint64_t start, uint64_t end);
+
+    /** 把所有线程缓冲区中的区间格式化为Chrome trace-event JSON **/
+    static void format(std::string& out);
+    /** 写到文件，成功返回true **/
+    static bool dump(const char* path);
+
+private:
+    struct event
+    {
+        uint64_t    start;
+        uint64_t    dur;
+        uint32_t    req;
+        uint32_t    stage;
+    };
+
+    struct buffer
+    {
+        int                     tid;
+        std::atomic<uint64_t>   next;       // 下一个要写的位置，只增不减
+        buffer*                 link;
+        event                   events[BUFFER_EVENTS];
+    };
+
+    static buffer* local_buffer();
+
+private:
+    static int                      m_sample;
+    static std::atomic<uint32_t>    m_requests;
+    /** 所有线程的缓冲区，新的插在表头，不会删除 **/
+    static std::atomic<buffer*>     m_buffers;
+    static const char* const        m_names[STAGE_NUM];
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "my_upgrade.h"
+#include "my_listener.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+extern void removefd(int epollfd, int fd);
+
+int my_upgrade::m_listen_fd = -1;
+int my_upgrade::m_conn_fd = -1;
+int my_upgrade::m_parent_fd = -1;
+int my_upgrade::m_fds[my_upgrade::MAX_FDS];
+char my_upgrade::m_names[my_upgrade::MAX_FDS][128];
+int my_upgrade::m_count = 0;
+
+/** 交接消息：每个监听地址一行，最后一个空行；SCM_RIGHTS中的fd与行一一对应 **/
+static const char upgrade_ack[] = "ok";
+
+static bool make_address(const char* path, struct sockaddr_un* un)
+{
+    memset(un, 0, sizeof(*un));
+    if (strlen(path) >= sizeof(un->sun_path))
+        return false;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, path);
+    return true;
+}
+
+bool my_upgrade::take_over(const char* path)
+{
+    struct sockaddr_un un;
+    if (!make_address(path, &un))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    if (connect(fd, (struct sockaddr*)&un, sizeof(un)) < 0)
+    {
+        close(fd);
+        return errno == ENOENT || errno == ECONNREFUSED;    // 没有旧进程，正常启动
+    }
+
+    char buf[MAX_FDS * 130];
+    size_t len = 0;
+    int fds[MAX_FDS];
+    int nfds = 0;
+    while (len < 2 || buf[len - 1] != '\n' || buf[len - 2] != '\n')
+    {
+        union
+        {
+            struct cmsghdr  align;
+            char            data[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        } control;
+        struct iovec iv = { buf + len, sizeof(buf) - len };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iv;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0 || len + n >= sizeof(buf))
+        {
+            printf("upgrade: %s closed during handoff\n", path);
+            close(fd);
+            return false;
+        }
+        len += n;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+                continue;
+            int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count && nfds < MAX_FDS; i++)
+                memcpy(&fds[nfds++], CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+        }
+    }
+
+    /** 逐行对应fd **/
+    buf[len] = '\0';
+    char* line = buf;
+    for (int i = 0; i < nfds; i++)
+    {
+        char* eol = strchr(line, '\n');
+        if (!eol || eol == line)
+            break;
+        *eol = '\0';
+        snprintf(m_names[m_count], sizeof(m_names[m_count]), "%.127s", line);
+        m_fds[m_count++] = fds[i];
+        line = eol + 1;
+    }
+    for (int i = m_count; i < nfds; i++)
+        close(fds[i]);
+    m_parent_fd = fd;
+    printf("upgrade: took over %d listening sockets from %s\n", m_count, path);
+    return true;
+}
+
+int my_upgrade::inherited(const char* name)
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        if (m_fds[i] != -1 && strcmp(m_names[i], name) == 0)
+        {
+            int fd = m_fds[i];
+            m_fds[i] = -1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+bool my_upgrade::listen(const char* path, int epollfd)
+{
+    if (m_parent_fd != -1)
+    {
+        /** 旧进程收到确认后才停止accept；新的配置里已经没有的地址，旧进程关闭之后就不再监听 **/
+        send(m_parent_fd, upgrade_ack, sizeof(upgrade_ack) - 1, MSG_NOSIGNAL);
+        close(m_parent_fd);
+        m_parent_fd = -1;
+    }
+    for (int i = 0; i < m_count; i++)
+    {
+        if (m_fds[i] != -1)
+        {
+            close(m_fds[i]);
+            m_fds[i] = -1;
+        }
+    }
+
+    struct sockaddr_un un;
+    if (!make_address(path, &un))
+    {
+        printf("upgrade: socket path too long: %s\n", path);
+        return false;
+    }
+    /** 旧进程的升级socket可能还在监听这个路径，它收到确认后只关闭fd，不删除路径，路径由这里接手 **/
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0 || bind(m_listen_fd, (struct sockaddr*)&un, sizeof(un)) < 0 || ::listen(m_listen_fd, 1) < 0)
+    {
+        printf("upgrade: listen %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    chmod(path, 0600);                  // 只有同一个用户能接手监听socket
+    addfd(epollfd, m_listen_fd, false);
+    return true;
+}
+
+void my_upgrade::close_conn(int epollfd)
+{
+    if (m_conn_fd != -1)
+    {
+        removefd(epollfd, m_conn_fd);
+        m_conn_fd = -1;
+    }
+}
+
+bool my_upgrade::on_event(int fd, int epollfd)
+{
+    if (fd == m_listen_fd)
+    {
+        while (1)
+        {
+            int conn = accept4(m_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (conn < 0)
+                return false;
+            if (m_conn_fd != -1)        // 同时只进行一次交接
+            {
+                close(conn);
+                continue;
+            }
+
+            /** 所有监听socket的地址，每行一个，以空行结束，fd放在同一条消息的SCM_RIGHTS里 **/
+            char buf[MAX_FDS * 130];
+            size_t len = 0;
+            int fds[MAX_FDS];
+            int nfds = 0;
+            for (int i = 0; i < my_listener::count() && nfds < MAX_FDS; i++)
+            {
+                my_listener* l = my_listener::at(i);
+                if (l->m_fd == -1)
+                    continue;
+                len += snprintf(buf + len, sizeof(buf) - len, "%s\n", l->m_name);
+                fds[nfds++] = l->m_fd;
+            }
+            buf[len++] = '\n';
+
+            union
+            {
+                struct cmsghdr  align;
+                char            data[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+            } control;
+            memset(&control, 0, sizeof(control));
+            struct iovec iv = { buf, len };
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iv;
+            msg.msg_iovlen = 1;
+            if (nfds > 0)
+            {
+                msg.msg_control = control.data;
+                msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+                struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+                c->cmsg_level = SOL_SOCKET;
+                c->cmsg_type = SCM_RIGHTS;
+                c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+                memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+            }
+            if (sendmsg(conn, &msg, MSG_NOSIGNAL) != (ssize_t)len)
+            {
+                printf("upgrade: handoff failed: %s\n", strerror(errno));
+                close(conn);
+                continue;
+            }
+            printf("upgrade: handed %d listening sockets to a new process\n", nfds);
+            m_conn_fd = conn;
+            addfd(epollfd, m_conn_fd, false);
+        }
+    }
+
+    /** 等新进程的确认，没有确认就断开说明新进程启动失败，继续服务 **/
+    char buf[16];
+    ssize_t n;
+    while ((n = recv(m_conn_fd, buf, sizeof(buf), 0)) > 0)
+    {
+        if ((size_t)n >= sizeof(upgrade_ack) - 1 && memcmp(buf, upgrade_ack, sizeof(upgrade_ack) - 1) == 0)
+        {
+            close_conn(epollfd);
+            removefd(epollfd, m_listen_fd);     // 路径已经属于新进程，只关闭fd
+            m_listen_fd = -1;
+            return true;
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        printf("upgrade: new process went away before taking over, keep serving\n");
+        close_conn(epollfd);
+    }
+    return false;
+}
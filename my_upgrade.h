@@ -0,0 +1,47 @@
+#ifndef _MY_UPGRADE_H_
+#define _MY_UPGRADE_H_
+
+/*
+*   不停机升级：新进程从旧进程手里接过监听socket，旧进程停止accept，处理完已有的连接后退出
+*   --upgrade-socket PATH 时，进程启动时先连接PATH：有旧进程在监听时，旧进程通过SCM_RIGHTS把所有监听socket
+*   连同它们的地址（配置原文）一起发过来，新进程按地址认领，不再socket/bind/listen，内核中的连接队列原样保留；
+*   新进程把它们加入自己的epoll之后回一个确认，旧进程收到确认才关闭自己的监听socket，
+*   这之前两个进程都在accept，之后只有新进程在accept，中间没有拒绝连接的窗口。
+*   新进程还没有确认就退出时，旧进程照常服务。然后新进程在PATH上监听，等待下一次升级。
+*   旧进程进入排空：空闲的keep-alive连接马上关闭，正在处理的请求应答完带Connection: close关闭，
+*   所有连接都关闭或者到了 --drain-timeout 秒时退出
+*/
+
+class my_upgrade
+{
+public:
+    /** 一次交接的监听socket数的上限，与my_listener::MAX_LISTENERS一致 **/
+    static const int MAX_FDS = 16;
+
+    /** 连接path上的旧进程并收下它的监听socket，没有旧进程时什么也不做；协议出错时返回false **/
+    static bool take_over(const char* path);
+    /** 认领地址为name的监听socket，没有时返回-1 **/
+    static int inherited(const char* name);
+    /** 自己的监听socket都已经加入epoll：确认交接完成，关闭没有认领的socket，然后在path上监听下一次升级 **/
+    static bool listen(const char* path, int epollfd);
+
+    /** fd是升级用的socket（监听或者与新进程的连接） **/
+    static bool owns(int fd) { return fd >= 0 && (fd == m_listen_fd || fd == m_conn_fd); }
+    /** 处理升级socket上的事件，新进程确认接手时返回true，调用者随后停止accept并开始排空 **/
+    static bool on_event(int fd, int epollfd);
+
+private:
+    static void close_conn(int epollfd);
+
+private:
+    static int      m_listen_fd;
+    static int      m_conn_fd;
+    /** 新进程：与旧进程的连接，确认之后关闭 **/
+    static int      m_parent_fd;
+    /** 新进程：收到的监听socket与它们的地址，认领后fd置为-1 **/
+    static int      m_fds[MAX_FDS];
+    static char     m_names[MAX_FDS][128];
+    static int      m_count;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "my_upload.h"
+#include "my_httpconn.h"
+#include "my_config.h"
+
+my_upload::my_upload(my_httpconn* conn, my_socket* sock, my_parse* parse) :
+                     m_conn(conn),
+                     m_sock(sock),
+                     m_parse(parse),
+                     m_file_fd(-1),
+                     m_use_splice(true),
+                     m_received(0),
+                     m_committed(false)
+{
+    m_url[0] = '\0';
+    m_target[0] = '\0';
+    m_temp[0] = '\0';
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+my_upload::~my_upload()
+{
+    if (m_file_fd != -1)
+        close(m_file_fd);
+    if (m_pipe[0] != -1)
+    {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+    if (!m_committed && m_temp[0] != '\0')      // 没有完成的上传，删除临时文件
+        unlink(m_temp);
+}
+
+my_parse::HTTP_CODE my_upload::prepare()
+{
+    /** 查询串不是文件名的一部分，目标文件、检查与缓存失效都用去掉查询串的路径；请求体会覆盖读缓冲区里的url **/
+    const char* url = m_parse->m_url;
+    int len = strcspn(url, "?");
+    if (len == 0 || len >= (int)sizeof(m_url))
+        return my_parse::BAD_REQUEST;
+    snprintf(m_url, sizeof(m_url), "%.*s", len, url);
+    if (strstr(m_url, "/../") || (len >= 3 && strcmp(m_url + len - 3, "/..") == 0))
+        return my_parse::FORBIDDEN_REQUEST;     // 不允许写到站点根目录之外
+    if (m_url[len - 1] == '/')
+        return my_parse::BAD_REQUEST;
+
+    const char* root = m_parse->m_vhost->root();
+    if (snprintf(m_target, sizeof(m_target), "%s%s", root, m_url) >= (int)sizeof(m_target))
+        return my_parse::BAD_REQUEST;
+    snprintf(m_temp, sizeof(m_temp), "%s/.upload.XXXXXX", root);
+    m_file_fd = mkstemp(m_temp);                // 临时文件与目标在同一文件系统内，rename才是原子的
+    if (m_file_fd < 0)
+    {
+        m_temp[0] = '\0';
+        return my_parse::INTERNAL_ERROR;
+    }
+    if (!m_sock->splice_in())                   // TLS连接上读到的是密文，只能经过SSL_read解密
+        m_use_splice = false;
+    else if (pipe2(m_pipe, O_CLOEXEC) < 0)
+    {
+        m_pipe[0] = m_pipe[1] = -1;
+        m_use_splice = false;
+    }
+    return my_parse::UPLOAD_REQUEST;
+}
+
+bool my_upload::write_all(const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_file_fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+my_task<bool> my_upload::receive(long long len)
+{
+    char* buf = m_parse->m_read_buf;
+
+    /** 先写出读缓冲区中已经读到的部分 **/
+    int avail = m_parse->m_read_idx - m_parse->m_check_idx;
+    if (avail > 0)
+    {
+        int n = avail < len ? avail : (int)len;
+        if (!write_all(buf + m_parse->m_check_idx, n))
+            co_return false;
+        m_parse->m_check_idx += n;
+        m_received += n;
+        len -= n;
+    }
+
+    while (len > 0)
+    {
+        size_t want = len < SPLICE_CHUNK ? len : SPLICE_CHUNK;
+        ssize_t n = 0;
+        if (m_use_splice)
+        {
+            n = splice(m_sock->fd(), NULL, m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        else
+        {
+            m_parse->m_check_idx = m_parse->m_read_idx = 0;     // 缓冲区已经取空，整个拿来中转
+            if (want > (size_t)my_parse::READ_BUFFER_SIZE)
+                want = my_parse::READ_BUFFER_SIZE;
+            n = m_sock->recv_some(buf, want);
+        }
+
+        if (n == 0)                             // 请求体还没收完对端就关闭了
+            co_return false;
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!co_await m_sock->wait(EPOLLIN))
+                    co_return false;
+                co_await m_conn->offload(true); // 写文件可能因为脏页回写而阻塞，放到工作线程的BULK通道中
+                continue;
+            }
+            if (m_use_splice && errno == EINVAL)
+            {
+                m_use_splice = false;
+                continue;
+            }
+            co_return false;
+        }
+
+        if (m_use_splice)
+        {
+            ssize_t left = n;
+            while (left > 0)
+            {
+                ssize_t m = splice(m_pipe[0], NULL, m_file_fd, NULL, left, SPLICE_F_MOVE);
+                if (m < 0 && errno == EINVAL)   // 目标文件系统不支持splice，把管道里的数据读出来写入
+                {
+                    m = ::read(m_pipe[0], buf, left < my_parse::READ_BUFFER_SIZE ? left : my_parse::READ_BUFFER_SIZE);
+                    if (m > 0 && !write_all(buf, m))
+                        co_return false;
+                    m_use_splice = false;
+                }
+                if (m <= 0)
+                    co_return false;
+                left -= m;
+            }
+        }
+        else if (!write_all(buf, n))
+        {
+            co_return false;
+        }
+        m_received += n;
+        len -= n;
+    }
+    co_return true;
+}
+
+my_task<char*> my_upload::read_line()
+{
+    char* buf = m_parse->m_read_buf;
+    while (1)
+    {
+        char* start = buf + m_parse->m_check_idx;
+        int avail = m_parse->m_read_idx - m_parse->m_check_idx;
+        char* crlf = (char*)memmem(start, avail, "\r\n", 2);
+        if (crlf)
+        {
+            *crlf = '\0';
+            m_parse->m_check_idx = crlf + 2 - buf;
+            co_return start;
+        }
+
+        memmove(buf, start, avail);             // 把不完整的行移到开头，再读
+        m_parse->m_check_idx = 0;
+        m_parse->m_read_idx = avail;
+        if (avail >= my_parse::READ_BUFFER_SIZE)
+            co_return NULL;                     // 一行超过了读缓冲区，不可能是合法的chunk头
+        ssize_t n = co_await m_sock->read(buf + avail, my_parse::READ_BUFFER_SIZE - avail);
+        if (n <= 0)
+            co_return NULL;
+        m_parse->m_read_idx += n;
+    }
+}
+
+my_task<my_parse::HTTP_CODE> my_upload::receive_chunked()
+{
+    while (1)
+    {
+        /** chunk头: 十六进制长度[;扩展]\r\n **/
+        char* line = co_await read_line();
+        if (!line)
+            co_return my_parse::BAD_REQUEST;
+        char* end = NULL;
+        long long size = strtoll(line, &end, 16);
+        if (end == line || size < 0 || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+            co_return my_parse::BAD_REQUEST;
+        if (size == 0)
+            break;
+        if (size > my_config::m_max_upload - m_received)
+            co_return my_parse::TOO_LARGE_REQUEST;
+
+        if (!co_await receive(size))
+            co_return my_parse::CLOSED_CONNECTION;
+        line = co_await read_line();            // chunk数据之后紧跟一个空行
+        if (!line || *line != '\0')
+            co_return my_parse::BAD_REQUEST;
+    }
+
+    /** 跳过trailer，直到空行 **/
+    while (1)
+    {
+        char* line = co_await read_line();
+        if (!line)
+            co_return my_parse::BAD_REQUEST;
+        if (*line == '\0')
+            break;
+    }
+    co_return my_parse::CREATED_REQUEST;
+}
+
+my_task<my_parse::HTTP_CODE> my_upload::run()
+{
+    my_parse::HTTP_CODE ret = prepare();
+    if (ret != my_parse::UPLOAD_REQUEST)
+        co_return ret;
+
+    /** 头部已经解析完，把缓冲区里跟在头部后面的请求体移到开头，腾出空间 **/
+    int avail = m_parse->m_read_idx - m_parse->m_check_idx;
+    memmove(m_parse->m_read_buf, m_parse->m_read_buf + m_parse->m_check_idx, avail);
+    m_parse->m_check_idx = 0;
+    m_parse->m_read_idx = avail;
+
+    if (m_parse->m_expect_continue)
+    {
+        static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        struct iovec iv;
+        iv.iov_base = (void*)continue_line;
+        iv.iov_len = sizeof(continue_line) - 1;
+        if (!co_await m_sock->writev(&iv, 1))
+            co_return my_parse::CLOSED_CONNECTION;
+    }
+
+    if (m_parse->m_chunked)
+        ret = co_await receive_chunked();
+    else
+        ret = (co_await receive(m_parse->m_content_length)) ? my_parse::CREATED_REQUEST : my_parse::CLOSED_CONNECTION;
+    if (ret != my_parse::CREATED_REQUEST)
+    {
+        m_parse->m_linger = false;              // 请求体没有读完，连接上剩下的数据已经无法解析
+        co_return ret;
+    }
+
+    /** 写完之后才让文件对其他读者可见，rename保证读者要么看到旧文件要么看到完整的新文件 **/
+    fchmod(m_file_fd, 0644);
+    if (rename(m_temp, m_target) < 0)
+        co_return (errno == ENOENT || errno == ENOTDIR) ? my_parse::NO_RESOURCE : my_parse::FORBIDDEN_REQUEST;
+    m_committed = true;
+    m_parse->m_vhost->cache().invalidate(m_url);    // 缓存里的fd还指向被替换掉的旧文件
+    co_return my_parse::CREATED_REQUEST;
+}
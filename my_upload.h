@@ -0,0 +1,59 @@
+#ifndef _MY_UPLOAD_H_
+#define _MY_UPLOAD_H_
+
+#include <sys/types.h>
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_parse.h"
+
+/*
+*   PUT/POST 上传：请求体(Content-Length或chunked)流式写入站点根目录下的临时文件，
+*   写完后原子地rename到目标路径。数据通过 socket -> pipe -> 文件 的splice搬运，
+*   不经过用户态缓冲区，每个上传占用的内存与请求体大小无关
+*/
+
+class my_httpconn;
+
+class my_upload
+{
+public:
+    my_upload(my_httpconn* conn, my_socket* sock, my_parse* parse);
+    ~my_upload();
+
+    /** 接收请求体并落盘，返回应答的处理结果：CREATED_REQUEST 或错误 **/
+    my_task<my_parse::HTTP_CODE> run();
+
+private:
+    /** 每次splice最多搬运的字节数，即管道的容量 **/
+    static const int SPLICE_CHUNK = 65536;
+
+    /** 从读缓冲区与socket中接收len字节写入临时文件 **/
+    my_task<bool> receive(long long len);
+    /** 从读缓冲区中取出一行(去掉\r\n)，缓冲区中不够一行时从socket读取，出错返回NULL **/
+    my_task<char*> read_line();
+    /** chunked编码的请求体 **/
+    my_task<my_parse::HTTP_CODE> receive_chunked();
+
+    bool write_all(const char* buf, size_t len);
+    /** 把url映射为站点根目录下的目标路径，并在同一目录树下创建临时文件 **/
+    my_parse::HTTP_CODE prepare();
+
+private:
+    my_httpconn*    m_conn;
+    my_socket*      m_sock;
+    my_parse*       m_parse;
+
+    /** 请求的url(不含查询串)、目标路径与临时文件路径 **/
+    char            m_url[my_parse::FILENAME_LEN];
+    char            m_target[my_parse::FILENAME_LEN];
+    char            m_temp[my_parse::FILENAME_LEN];
+    int             m_file_fd;
+    /** splice使用的管道，文件系统不支持splice或者是TLS连接时退化为recv+write **/
+    int             m_pipe[2];
+    bool            m_use_splice;
+    /** 已写入的请求体字节数 **/
+    long long       m_received;
+    bool            m_committed;
+};
+
+#endif
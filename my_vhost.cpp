@@ -0,0 +1,73 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "my_vhost.h"
+
+extern const char* doc_root;
+
+std::unordered_map<std::string_view, my_vhost*> my_vhost::m_hosts;
+my_vhost my_vhost::m_default("", "", my_vhost::DEFAULT_CACHE_ENTRIES);
+
+/** 主机名转成小写，去掉端口与末尾的点，IPv6字面量保留方括号 **/
+static size_t normalize(const char* host, char* out)
+{
+    size_t len = 0;
+    const char* end = (host[0] == '[') ? strchr(host, ']') : NULL;
+    end = end ? end + 1 : host + strcspn(host, ":");
+    for (const char* p = host; p < end && len < my_vhost::HOST_LEN - 1; p++)
+        out[len++] = tolower((unsigned char)*p);
+    while (len > 0 && out[len - 1] == '.')
+        len--;
+    out[len] = '\0';
+    return len;
+}
+
+bool my_vhost::add(const char* spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (!eq || eq == spec || eq[1] != '/')
+        return false;
+
+    std::string name(spec, eq - spec);
+    char host[HOST_LEN];
+    normalize(name.c_str(), host);
+
+    std::string root(eq + 1);
+    size_t entries = DEFAULT_CACHE_ENTRIES;
+    size_t comma = root.find(',');
+    if (comma != std::string::npos)
+    {
+        char* end = NULL;
+        long value = strtol(root.c_str() + comma + 1, &end, 10);
+        if (value < 0 || *end != '\0' || end == root.c_str() + comma + 1)
+            return false;
+        entries = value;
+        root.erase(comma);
+    }
+    while (root.size() > 1 && root[root.size() - 1] == '/')
+        root.erase(root.size() - 1);
+
+    struct stat st;
+    if (host[0] == '\0' || stat(root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) || m_hosts.count(host))
+        return false;
+
+    my_vhost* vhost = new my_vhost(host, root.c_str(), entries);
+    m_hosts[std::string_view(vhost->m_name)] = vhost;
+    return true;
+}
+
+my_vhost* my_vhost::find(const char* host)
+{
+    if (!host || m_hosts.empty())       // 没有配置虚拟主机时不需要查表
+        return &m_default;
+    char name[HOST_LEN];
+    size_t len = normalize(host, name);
+    std::unordered_map<std::string_view, my_vhost*>::iterator it = m_hosts.find(std::string_view(name, len));
+    return it == m_hosts.end() ? &m_default : it->second;
+}
+
+const char* my_vhost::root() const
+{
+    return m_root.empty() ? doc_root : m_root.c_str();
+}
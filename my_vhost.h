@@ -0,0 +1,47 @@
+#ifndef _MY_VHOST_H_
+#define _MY_VHOST_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "my_cache.h"
+
+/*
+*   基于Host的虚拟主机：主机名 -> 文档根目录的哈希表，每个请求在请求头解析完时查找一次。
+*   每个虚拟主机有自己的文件缓存与容量，一个站点的流量不会把另一个站点的热点文件挤出缓存。
+*   没有Host或者Host不在表中的请求使用默认站点，它的根目录是 --root 指定的 doc_root
+*/
+
+class my_vhost
+{
+public:
+    /** 每个站点默认缓存的文件数，每个表项占用一个fd **/
+    static const size_t DEFAULT_CACHE_ENTRIES = 256;
+    /** 主机名的最大长度 **/
+    static const int HOST_LEN = 256;
+
+    /** 解析 HOST=DIR[,ENTRIES]，出错返回false **/
+    static bool add(const char* spec);
+    /** 按Host头部查找虚拟主机，忽略大小写与端口，找不到时返回默认站点 **/
+    static my_vhost* find(const char* host);
+    static my_vhost* default_host() { return &m_default; }
+
+public:
+    const char* root() const;
+    my_cache& cache() { return m_cache; }
+
+private:
+    my_vhost(const char* name, const char* root, size_t entries) : m_name(name), m_root(root), m_cache(entries) { }
+
+private:
+    std::string     m_name;
+    /** 为空表示使用doc_root **/
+    std::string     m_root;
+    my_cache        m_cache;
+
+    /** 键指向虚拟主机自己的名字 **/
+    static std::unordered_map<std::string_view, my_vhost*>  m_hosts;
+    static my_vhost                                         m_default;
+};
+
+#endif
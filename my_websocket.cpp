@@ -0,0 +1,438 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "my_websocket.h"
+#include "my_parse.h"
+#include "my_config.h"
+#include "my_stats.h"
+
+char* my_websocket::m_free[my_websocket::BUFFER_CLASSES][my_websocket::MAX_FREE_BUFFERS];
+int my_websocket::m_free_count[my_websocket::BUFFER_CLASSES];
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+/** SHA-1，只用于计算握手应答中的Sec-WebSocket-Accept **/
+static void sha1(const unsigned char* data, size_t len, unsigned char out[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t padded = ((len + 8) / 64 + 1) * 64;      // 消息 + 0x80 + 填充 + 64位的比特长度
+    for (size_t off = 0; off < padded; off += 64)
+    {
+        unsigned char block[64];
+        for (int i = 0; i < 64; i++)
+        {
+            size_t p = off + i;
+            block[i] = p < len ? data[p] : (p == len ? 0x80 : 0);
+        }
+        if (off + 64 == padded)
+        {
+            for (int i = 0; i < 8; i++)
+                block[63 - i] = (unsigned char)(((uint64_t)len * 8) >> (8 * i));
+        }
+
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+        for (int i = 16; i < 80; i++)
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 20; i++)
+        out[i] = (unsigned char)(h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+void my_websocket::accept_key(const char* key, char* out)
+{
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    unsigned char text[128];
+    size_t key_len = strlen(key);
+    if (key_len > sizeof(text) - sizeof(guid))
+        key_len = sizeof(text) - sizeof(guid);
+    memcpy(text, key, key_len);
+    memcpy(text + key_len, guid, sizeof(guid) - 1);
+    unsigned char digest[21];
+    sha1(text, key_len + sizeof(guid) - 1, digest);
+    digest[20] = 0;
+
+    /** 20字节的摘要base64编码为28个字符，最后一组只有2个字节，补一个= **/
+    char* p = out;
+    for (int i = 0; i < 21; i += 3)
+    {
+        uint32_t v = (uint32_t)digest[i] << 16 | (uint32_t)digest[i + 1] << 8 | (i + 2 < 21 ? digest[i + 2] : 0);
+        *p++ = table[(v >> 18) & 63];
+        *p++ = table[(v >> 12) & 63];
+        *p++ = table[(v >> 6) & 63];
+        *p++ = i + 2 < 20 ? table[v & 63] : '=';
+    }
+    out[28] = '\0';
+}
+
+void my_websocket::unmask(char* data, size_t len, const unsigned char mask[4], size_t offset)
+{
+    /** 把掩码转到从data[0]开始的顺序，之后每4字节都是同一个32位的值 **/
+    unsigned char rotated[4];
+    for (int i = 0; i < 4; i++)
+        rotated[i] = mask[(offset + i) & 3];
+    uint32_t key;
+    memcpy(&key, rotated, 4);
+
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i key32 = _mm256_set1_epi32(key);
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(v, key32));
+    }
+#endif
+#ifdef __SSE2__
+    __m128i key16 = _mm_set1_epi32(key);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, key16));
+    }
+#endif
+    uint64_t key8 = (uint64_t)key << 32 | key;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key8;
+        memcpy(data + i, &v, 8);
+    }
+    for (; i < len; i++)
+        data[i] ^= rotated[i & 3];
+}
+
+char* my_websocket::alloc_buffer(size_t size, size_t& cap)
+{
+    int c = 0;
+    cap = MIN_BUFFER;
+    while (cap < size)
+    {
+        cap <<= 1;
+        c++;
+    }
+    if (c < BUFFER_CLASSES && m_free_count[c] > 0)
+        return m_free[c][--m_free_count[c]];
+    return (char*)malloc(cap);
+}
+
+void my_websocket::free_buffer(char* buf, size_t cap)
+{
+    int c = 0;
+    while ((MIN_BUFFER << c) < cap)
+        c++;
+    if (c < BUFFER_CLASSES && m_free_count[c] < MAX_FREE_BUFFERS)
+        m_free[c][m_free_count[c]++] = buf;
+    else
+        free(buf);
+}
+
+my_websocket::my_websocket(my_socket* sock, my_parse* parse) :
+                           m_sock(sock),
+                           m_parse(parse),
+                           m_frame_op(0),
+                           m_frame_fin(false),
+                           m_frame_left(0),
+                           m_mask_off(0),
+                           m_in_frame(false),
+                           m_msg_op(0),
+                           m_msg(NULL),
+                           m_msg_len(0),
+                           m_msg_cap(0),
+                           m_last_active(0),
+                           m_ping_sent(false),
+                           m_timer_fired(false)
+{
+    m_timer.fn = on_timer;
+    m_timer.arg = this;
+}
+
+my_websocket::~my_websocket()
+{
+    my_timer::remove(&m_timer);
+    release_message();
+}
+
+void my_websocket::on_timer(void* arg)
+{
+    my_websocket* ws = (my_websocket*)arg;
+    ws->m_timer_fired = true;
+    my_socket::dispatch(ws->m_sock->fd(), 0);      // 协程一定挂起在socket上（会话只在事件循环线程上运行），唤醒它
+}
+
+bool my_websocket::append(const char* data, size_t len)
+{
+    if (m_msg_len + len > MAX_MESSAGE)
+        return false;
+    if (m_msg_len + len > m_msg_cap)
+    {
+        size_t cap = 0;
+        char* buf = alloc_buffer(m_msg_len + len, cap);
+        if (!buf)
+            return false;
+        if (m_msg)
+        {
+            memcpy(buf, m_msg, m_msg_len);
+            free_buffer(m_msg, m_msg_cap);
+        }
+        m_msg = buf;
+        m_msg_cap = cap;
+    }
+    memcpy(m_msg + m_msg_len, data, len);
+    m_msg_len += len;
+    return true;
+}
+
+void my_websocket::release_message()
+{
+    if (m_msg)
+        free_buffer(m_msg, m_msg_cap);
+    m_msg = NULL;
+    m_msg_len = m_msg_cap = 0;
+    m_msg_op = 0;
+}
+
+my_task<bool> my_websocket::send_frame(int opcode, const char* data, size_t len)
+{
+    unsigned char header[10];
+    int header_len = 2;
+    header[0] = 0x80 | opcode;          // 服务器发出的帧不分片，也不加掩码
+    if (len < 126)
+    {
+        header[1] = len;
+    }
+    else if (len < 65536)
+    {
+        header[1] = 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        header_len = 4;
+    }
+    else
+    {
+        header[1] = 127;
+        for (int i = 0; i < 8; i++)
+            header[2 + i] = (unsigned char)((uint64_t)len >> (56 - 8 * i));
+        header_len = 10;
+    }
+    struct iovec iv[2];
+    iv[0].iov_base = header;
+    iv[0].iov_len = header_len;
+    iv[1].iov_base = (void*)data;
+    iv[1].iov_len = len;
+    co_return co_await m_sock->writev(iv, len > 0 ? 2 : 1);
+}
+
+my_task<bool> my_websocket::send_close(int code)
+{
+    char payload[2] = { (char)(code >> 8), (char)code };
+    co_return co_await send_frame(OP_CLOSE, payload, 2);
+}
+
+my_task<bool> my_websocket::on_message(int opcode, const char* data, size_t len)
+{
+    my_stats::add(my_stats::WS_MESSAGES);
+    co_return co_await send_frame(opcode, data, len);
+}
+
+my_task<> my_websocket::run()
+{
+    my_stats::add(my_stats::WS_SESSIONS);
+    char* buf = m_parse->m_read_buf;
+    const int size = my_parse::READ_BUFFER_SIZE;
+    int start = m_parse->m_check_idx;
+    int end = m_parse->m_read_idx;
+    int interval = my_config::m_ws_ping;
+    m_last_active = my_timer::now();
+    if (interval > 0)
+        my_timer::add(&m_timer, interval);
+
+    while (1)
+    {
+        int avail = end - start;
+        bool need_read = false;
+        if (!m_in_frame)
+        {
+            /** 帧头：2字节 + 0/2/8字节的扩展长度 + 4字节掩码 **/
+            unsigned char b0 = avail >= 1 ? buf[start] : 0;
+            unsigned char b1 = avail >= 2 ? buf[start + 1] : 0;
+            int len7 = b1 & 0x7f;
+            int header_len = 2 + (len7 == 126 ? 2 : (len7 == 127 ? 8 : 0)) + 4;
+            if (avail < 2 || avail < header_len)
+            {
+                need_read = true;
+            }
+            else
+            {
+                uint64_t len = len7;
+                if (len7 == 126)
+                    len = (unsigned char)buf[start + 2] << 8 | (unsigned char)buf[start + 3];
+                else if (len7 == 127)
+                {
+                    len = 0;
+                    for (int i = 0; i < 8; i++)
+                        len = len << 8 | (unsigned char)buf[start + 2 + i];
+                }
+                int opcode = b0 & 0x0f;
+                bool fin = b0 & 0x80;
+                bool control = opcode & 0x8;
+                bool valid = !(b0 & 0x70) && (b1 & 0x80);       // 没有协商扩展，RSV必须为0；客户端的帧必须加掩码
+                if (control)
+                    valid = valid && fin && len <= 125 && (opcode == OP_CLOSE || opcode == OP_PING || opcode == OP_PONG);
+                else if (opcode == OP_CONTINUATION)
+                    valid = valid && m_msg_op != 0;
+                else
+                    valid = valid && (opcode == OP_TEXT || opcode == OP_BINARY) && m_msg_op == 0;
+                if (!valid)
+                {
+                    co_await send_close(CLOSE_PROTOCOL_ERROR);
+                    break;
+                }
+
+                if (control && (uint64_t)avail < header_len + len)
+                {
+                    need_read = true;               // 控制帧不超过125字节，整个读进缓冲区再处理
+                }
+                else
+                {
+                    memcpy(m_mask, buf + start + header_len - 4, 4);
+                    start += header_len;
+                    if (control)
+                    {
+                        char* payload = buf + start;
+                        unmask(payload, len, m_mask, 0);
+                        start += len;
+                        if (opcode == OP_CLOSE)     // 回应同样的状态码，然后关闭
+                        {
+                            co_await send_frame(OP_CLOSE, payload, len >= 2 ? 2 : 0);
+                            break;
+                        }
+                        if (opcode == OP_PING && !co_await send_frame(OP_PONG, payload, len))
+                            break;
+                        continue;
+                    }
+
+                    /** 不分片、整个在缓冲区里的消息直接在读缓冲区里解码处理，不拷贝 **/
+                    if (fin && opcode != OP_CONTINUATION && len <= (uint64_t)(end - start))
+                    {
+                        unmask(buf + start, len, m_mask, 0);
+                        if (!co_await on_message(opcode, buf + start, len))
+                            break;
+                        start += len;
+                        continue;
+                    }
+                    if (m_msg_len + len > MAX_MESSAGE)
+                    {
+                        co_await send_close(CLOSE_TOO_BIG);
+                        break;
+                    }
+                    if (opcode != OP_CONTINUATION)
+                        m_msg_op = opcode;
+                    m_frame_op = opcode;
+                    m_frame_fin = fin;
+                    m_frame_left = len;
+                    m_mask_off = 0;
+                    m_in_frame = true;
+                    avail = end - start;
+                }
+            }
+        }
+
+        if (m_in_frame)
+        {
+            /** 帧的负载可能比读缓冲区大，读到多少就解码、拼接多少 **/
+            size_t take = (uint64_t)avail < m_frame_left ? avail : m_frame_left;
+            unmask(buf + start, take, m_mask, m_mask_off);
+            if (!append(buf + start, take))
+            {
+                co_await send_close(CLOSE_TOO_BIG);
+                break;
+            }
+            start += take;
+            m_mask_off += take;
+            m_frame_left -= take;
+            if (m_frame_left == 0)
+            {
+                m_in_frame = false;
+                if (m_frame_fin)
+                {
+                    bool ok = co_await on_message(m_msg_op, m_msg, m_msg_len);
+                    release_message();
+                    if (!ok)
+                        break;
+                }
+                continue;
+            }
+            need_read = true;
+        }
+        if (!need_read)
+            continue;
+
+        /** 缓冲区里只剩不完整的帧头，移到开头再读 **/
+        if (start > 0)
+        {
+            memmove(buf, buf + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        ssize_t n = m_sock->recv_some(buf + end, size - end);
+        if (n > 0)
+        {
+            end += n;
+            m_last_active = my_timer::now();
+            m_ping_sent = false;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            break;
+        if (!co_await m_sock->wait(EPOLLIN))
+            break;
+
+        if (m_timer_fired)
+        {
+            m_timer_fired = false;
+            if (m_ping_sent)                // 发出ping之后的一个周期内什么都没有收到
+                break;
+            uint64_t idle = my_timer::now() - m_last_active;
+            if (idle < (uint64_t)interval)  // 期间收到过数据，从最后一次收到数据时重新计时
+            {
+                my_timer::add(&m_timer, interval - idle);
+            }
+            else
+            {
+                if (!co_await send_frame(OP_PING, NULL, 0))
+                    break;
+                m_ping_sent = true;
+                my_timer::add(&m_timer, interval);
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef _MY_WEBSOCKET_H_
+#define _MY_WEBSOCKET_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "my_coroutine.h"
+#include "my_socket.h"
+#include "my_timer.h"
+
+class my_parse;
+
+/*
+*   WebSocket会话（RFC 6455），在 --websocket 指定的URL上完成Upgrade握手之后由连接协程运行
+*   帧直接在连接的读缓冲区里解析，客户端的掩码用SSE2/AVX2按16/32字节一组原地异或解码；
+*   分片的消息（以及放不进读缓冲区的大帧）在按2的幂分级复用的缓冲区里拼接，消息处理完就归还，
+*   空闲的连接除了协程帧之外不持有任何缓冲区。
+*   收到完整的消息后原样回显，应用在on_message里处理消息。
+*   会话只在事件循环线程上运行：空闲 --ws-ping 秒后由定时器（my_timer.h）唤醒协程发ping，
+*   再过同样的时间仍然没有收到任何数据就关闭连接
+*/
+
+class my_websocket
+{
+public:
+    /** 一条消息的最大长度，超过时以1009关闭 **/
+    static const size_t MAX_MESSAGE = 1 << 20;
+
+    /** 由请求的Sec-WebSocket-Key计算Sec-WebSocket-Accept，out至少29字节 **/
+    static void accept_key(const char* key, char* out);
+    /** 原地解码len字节，data[0]对应掩码的第offset个字节（按4取模） **/
+    static void unmask(char* data, size_t len, const unsigned char mask[4], size_t offset);
+
+public:
+    my_websocket(my_socket* sock, my_parse* parse);
+    ~my_websocket();
+
+    /** 处理帧直到连接关闭，读缓冲区中握手请求之后的数据是第一批帧 **/
+    my_task<> run();
+
+private:
+    enum OPCODE {   OP_CONTINUATION = 0x0,
+                    OP_TEXT = 0x1,
+                    OP_BINARY = 0x2,
+                    OP_CLOSE = 0x8,
+                    OP_PING = 0x9,
+                    OP_PONG = 0xA
+                };
+    /** 关闭状态码 **/
+    enum CLOSE_CODE {   CLOSE_NORMAL = 1000,
+                        CLOSE_PROTOCOL_ERROR = 1002,
+                        CLOSE_TOO_BIG = 1009
+                    };
+
+    my_task<bool> send_frame(int opcode, const char* data, size_t len);
+    my_task<bool> send_close(int code);
+    /** 一条完整的消息 **/
+    my_task<bool> on_message(int opcode, const char* data, size_t len);
+    /** 把分片的数据追加到消息缓冲区，超过MAX_MESSAGE时返回false **/
+    bool append(const char* data, size_t len);
+    void release_message();
+
+    static void on_timer(void* arg);
+
+    /** 消息缓冲区池，按2的幂分级，最小MIN_BUFFER字节 **/
+    static char* alloc_buffer(size_t size, size_t& cap);
+    static void free_buffer(char* buf, size_t cap);
+
+private:
+    static const size_t MIN_BUFFER = 4096;
+    static const int BUFFER_CLASSES = 9;          // 4K ... 1M
+    static const int MAX_FREE_BUFFERS = 64;
+
+    my_socket*          m_sock;
+    my_parse*           m_parse;
+
+    /** 正在接收的帧：操作码、是否为最后一片、剩余的负载字节数、掩码及已解码的字节数 **/
+    int                 m_frame_op;
+    bool                m_frame_fin;
+    uint64_t            m_frame_left;
+    unsigned char       m_mask[4];
+    size_t              m_mask_off;
+    bool                m_in_frame;
+
+    /** 正在拼接的消息：首片的操作码（0表示没有），缓冲区 **/
+    int                 m_msg_op;
+    char*               m_msg;
+    size_t              m_msg_len;
+    size_t              m_msg_cap;
+
+    /** 空闲检测：最近一次收到数据时的tick，已经发出ping还没有回应 **/
+    my_timer::entry     m_timer;
+    uint64_t            m_last_active;
+    bool                m_ping_sent;
+    bool                m_timer_fired;
+
+    static char*        m_free[BUFFER_CLASSES][MAX_FREE_BUFFERS];
+    static int          m_free_count[BUFFER_CLASSES];
+};
+
+#endif
@@ -0,0 +1,367 @@
+/*
+*   资源包打包工具：my_packer <目录> <输出文件>
+*   把目录下的所有文件打成服务器用 --pack 加载的资源包（格式见 my_pack.h）。
+*   foo.css.gz 作为 foo.css 的gzip预压缩版本，目录下的 index.html 同时可以用 /dir/ 访问。
+*   先写临时文件再rename，运行中的服务器收到SIGHUP后就会切换到新的包
+*
+*   g++ -std=c++20 -O2 tools/my_packer.cpp -o my_packer
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "../my_pack.h"
+
+/** 一个文件：URL、源文件路径与可选的gzip版本 **/
+struct pack_file
+{
+    std::string     url;
+    std::string     path;
+    std::string     gz_path;
+};
+
+/** 一个编码版本的内容摘要 **/
+struct pack_digest
+{
+    uint64_t        size;
+    uint64_t        hash;
+};
+
+static const char* content_type(const std::string& url)
+{
+    static const char* types[][2] =
+    {
+        { ".html", "text/html; charset=utf-8" },  { ".htm", "text/html; charset=utf-8" },
+        { ".css", "text/css; charset=utf-8" },    { ".js", "text/javascript; charset=utf-8" },
+        { ".json", "application/json" },          { ".txt", "text/plain; charset=utf-8" },
+        { ".xml", "application/xml" },            { ".svg", "image/svg+xml" },
+        { ".png", "image/png" },                  { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },                { ".gif", "image/gif" },
+        { ".webp", "image/webp" },                { ".ico", "image/x-icon" },
+        { ".wasm", "application/wasm" },          { ".woff2", "font/woff2" },
+        { ".woff", "font/woff" },                 { ".pdf", "application/pdf" },
+    };
+    size_t dot = url.rfind('.');
+    if (dot != std::string::npos && url.find('/', dot) == std::string::npos)
+    {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        {
+            if (strcasecmp(url.c_str() + dot, types[i][0]) == 0)
+                return types[i][1];
+        }
+    }
+    return "application/octet-stream";
+}
+
+/** 递归收集目录下的普通文件，跳过以.开头的文件 **/
+static bool walk(const std::string& dir, const std::string& url, std::map<std::string, std::string>& files)
+{
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+    {
+        printf("cannot open %s\n", dir.c_str());
+        return false;
+    }
+    struct dirent* ent = NULL;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+        std::string path = dir + "/" + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            if (!walk(path, url + ent->d_name + "/", files))
+            {
+                closedir(d);
+                return false;
+            }
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            files[url + ent->d_name] = path;
+        }
+    }
+    closedir(d);
+    return true;
+}
+
+/** 读一遍文件，得到长度与内容的哈希，用来生成ETag **/
+static bool digest(const std::string& path, pack_digest& out)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    char buf[65536];
+    uint64_t h = 14695981039346656037ULL;
+    out.size = 0;
+    ssize_t n = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            h ^= (unsigned char)buf[i];
+            h *= 1099511628211ULL;
+        }
+        out.size += n;
+    }
+    close(fd);
+    out.hash = h;
+    return n == 0;
+}
+
+static bool copy_body(const std::string& path, int out_fd, uint64_t offset)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    char buf[65536];
+    ssize_t n = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        if (pwrite(out_fd, buf, n, offset) != n)
+        {
+            close(fd);
+            return false;
+        }
+        offset += n;
+    }
+    close(fd);
+    return n == 0;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+/** hash and displace：按桶从大到小，为每个桶找一个seed，使桶内的URL落在互不相同的空槽位上 **/
+static bool build_index(const std::vector<std::string>& urls, uint32_t buckets,
+                        std::vector<uint32_t>& seeds, std::vector<uint32_t>& slots)
+{
+    uint32_t count = urls.size();
+    std::vector<std::vector<uint32_t> > members(buckets);
+    for (uint32_t i = 0; i < count; i++)
+        members[my_pack::hash(urls[i].data(), urls[i].size(), 0) % buckets].push_back(i);
+
+    std::vector<uint32_t> order(buckets);
+    for (uint32_t i = 0; i < buckets; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+    seeds.assign(buckets, 0);
+    slots.assign(count, 0);
+    std::vector<bool> used(count, false);
+    std::vector<uint32_t> trial;
+    for (uint32_t i = 0; i < buckets; i++)
+    {
+        const std::vector<uint32_t>& keys = members[order[i]];
+        if (keys.empty())
+            break;
+        uint32_t seed = 1;
+        for (; seed < 100000000; seed++)
+        {
+            trial.clear();
+            bool ok = true;
+            for (size_t k = 0; k < keys.size() && ok; k++)
+            {
+                uint32_t slot = my_pack::hash(urls[keys[k]].data(), urls[keys[k]].size(), seed) % count;
+                ok = !used[slot] && std::find(trial.begin(), trial.end(), slot) == trial.end();
+                trial.push_back(slot);
+            }
+            if (ok)
+                break;
+        }
+        if (seed == 100000000)
+            return false;
+        seeds[order[i]] = seed;
+        for (size_t k = 0; k < keys.size(); k++)
+        {
+            used[trial[k]] = true;
+            slots[keys[k]] = trial[k];
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf("usage: %s source_dir output_pack\n", basename(argv[0]));
+        return 1;
+    }
+    std::string root = argv[1];
+    while (root.size() > 1 && root[root.size() - 1] == '/')
+        root.erase(root.size() - 1);
+
+    std::map<std::string, std::string> found;
+    if (!walk(root, "/", found))
+        return 1;
+
+    /** foo.gz 有同名的 foo 时作为它的gzip版本，不单独索引 **/
+    std::vector<pack_file> files;
+    for (std::map<std::string, std::string>::iterator it = found.begin(); it != found.end(); ++it)
+    {
+        const std::string& url = it->first;
+        if (url.size() > 3 && url.compare(url.size() - 3, 3, ".gz") == 0 && found.count(url.substr(0, url.size() - 3)))
+            continue;
+        pack_file f;
+        f.url = url;
+        f.path = it->second;
+        std::map<std::string, std::string>::iterator gz = found.find(url + ".gz");
+        if (gz != found.end())
+            f.gz_path = gz->second;
+        files.push_back(f);
+    }
+
+    /** 索引的键：每个文件的URL，index.html另外加上目录的URL，两个键共用同一份内容 **/
+    std::vector<std::string> urls;
+    std::vector<uint32_t> owner;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        urls.push_back(files[i].url);
+        owner.push_back(i);
+        const std::string& url = files[i].url;
+        if (url.size() >= 11 && url.compare(url.size() - 11, 11, "/index.html") == 0)
+        {
+            urls.push_back(url.substr(0, url.size() - 10));
+            owner.push_back(i);
+        }
+    }
+
+    uint32_t count = urls.size();
+    uint32_t buckets = count / 4 + 1;
+    std::vector<uint32_t> seeds, slots;
+    if (!build_index(urls, buckets, seeds, slots))
+    {
+        printf("cannot build the perfect hash index\n");
+        return 1;
+    }
+
+    /** 布局：pack_header | seeds | entries | 字符串 | 按页对齐的内容 **/
+    pack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, my_pack::MAGIC, sizeof(header.magic));
+    header.version = my_pack::VERSION;
+    header.count = count;
+    header.buckets = buckets;
+    header.seeds_offset = sizeof(pack_header);
+    header.entries_offset = align_up(header.seeds_offset + buckets * sizeof(uint32_t), 8);
+    uint64_t strings_offset = header.entries_offset + (uint64_t)count * sizeof(pack_entry);
+
+    std::string strings;
+    std::vector<pack_variant> variants(files.size() * my_pack::VARIANT_COUNT);
+    std::vector<uint64_t> type_offsets(files.size());
+    std::vector<std::string> bodies;                    // 与variants对应的源文件，空表示没有这个版本
+    bodies.resize(variants.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const char* type = content_type(files[i].url);
+        type_offsets[i] = strings_offset + strings.size();
+        strings.append(type).push_back('\0');
+
+        for (int v = 0; v < my_pack::VARIANT_COUNT; v++)
+        {
+            const std::string& path = (v == my_pack::VARIANT_GZIP) ? files[i].gz_path : files[i].path;
+            pack_variant& var = variants[i * my_pack::VARIANT_COUNT + v];
+            memset(&var, 0, sizeof(var));
+            if (path.empty())
+                continue;
+            pack_digest d;
+            if (!digest(path, d))
+            {
+                printf("cannot read %s\n", path.c_str());
+                return 1;
+            }
+            char etag[64];
+            snprintf(etag, sizeof(etag), "\"%llx-%016llx\"", (unsigned long long)d.size, (unsigned long long)d.hash);
+            var.etag_offset = strings_offset + strings.size();
+            var.etag_len = strlen(etag);
+            strings.append(etag).push_back('\0');
+
+            char text[512];
+            int len = snprintf(text, sizeof(text), "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nContent-Type: %s\r\nETag: %s\r\n%s%s",
+                               (unsigned long long)d.size, type, etag,
+                               v == my_pack::VARIANT_GZIP ? "Content-Encoding: gzip\r\n" : "",
+                               files[i].gz_path.empty() ? "" : "Vary: Accept-Encoding\r\n");
+            var.header_offset = strings_offset + strings.size();
+            var.header_len = len;
+            strings.append(text, len);
+            var.body_len = d.size;
+            bodies[i * my_pack::VARIANT_COUNT + v] = path;
+        }
+    }
+
+    std::vector<uint64_t> url_offsets(count);
+    for (uint32_t k = 0; k < count; k++)
+    {
+        url_offsets[k] = strings_offset + strings.size();
+        strings.append(urls[k]).push_back('\0');
+    }
+
+    /** 每份内容从新的一页开始 **/
+    uint64_t offset = align_up(strings_offset + strings.size(), my_pack::PAGE_SIZE);
+    for (size_t i = 0; i < variants.size(); i++)
+    {
+        if (bodies[i].empty())
+            continue;
+        variants[i].body_offset = offset;
+        offset = align_up(offset + variants[i].body_len, my_pack::PAGE_SIZE);
+    }
+    header.file_size = offset;
+
+    std::vector<pack_entry> entries(count);
+    for (uint32_t k = 0; k < count; k++)
+    {
+        uint32_t i = owner[k];
+        pack_entry& e = entries[slots[k]];
+        memset(&e, 0, sizeof(e));
+        e.url_offset = url_offsets[k];
+        e.url_len = urls[k].size();
+        e.flags = files[i].gz_path.empty() ? 0 : my_pack::FLAG_GZIP;
+        e.type_offset = type_offsets[i];
+        e.type_len = strlen(content_type(files[i].url));
+        for (int v = 0; v < my_pack::VARIANT_COUNT; v++)
+            e.variants[v] = variants[i * my_pack::VARIANT_COUNT + v];
+    }
+
+    std::string temp = std::string(argv[2]) + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("cannot create %s\n", temp.c_str());
+        return 1;
+    }
+    bool ok = ftruncate(fd, header.file_size) == 0 &&
+              pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+              pwrite(fd, seeds.data(), buckets * sizeof(uint32_t), header.seeds_offset) == (ssize_t)(buckets * sizeof(uint32_t)) &&
+              pwrite(fd, entries.data(), count * sizeof(pack_entry), header.entries_offset) == (ssize_t)(count * sizeof(pack_entry)) &&
+              pwrite(fd, strings.data(), strings.size(), strings_offset) == (ssize_t)strings.size();
+    for (size_t i = 0; ok && i < variants.size(); i++)
+    {
+        if (!bodies[i].empty())
+            ok = copy_body(bodies[i], fd, variants[i].body_offset);
+    }
+    if (ok)
+        ok = fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(temp.c_str(), argv[2]) < 0)       // rename之后服务器重新映射就能看到完整的新包
+    {
+        printf("cannot write %s\n", argv[2]);
+        unlink(temp.c_str());
+        return 1;
+    }
+    printf("%u urls, %zu files, %llu bytes\n", count, files.size(), (unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+*   ping-pong延迟测试：my_pingpong [-n 次数] [-c 连接数] [-w 预热次数] ip port [path]
+*                   或者 my_pingpong [选项] unix:/path [path]
+*   每个连接一个线程，在keep-alive连接上发出一个请求、读完应答之后才发下一个，
+*   统计每次往返的延迟分布。用来比较默认的阻塞epoll_wait与 --busy-poll 模式，以及同一台机器上的TCP与本地socket：
+*
+*   g++ -std=c++20 -O2 -pthread tools/my_pingpong.cpp -o my_pingpong
+*   ./my_pingpong -n 100000 127.0.0.1 8080 /index.html
+*   ./my_pingpong -n 100000 unix:/run/httpserver.sock /index.html
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+struct client
+{
+    pthread_t               tid;
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    const char*             request;
+    int                     count;
+    int                     warmup;
+    /** 每次往返的延迟(纳秒) **/
+    std::vector<long>       samples;
+    bool                    failed;
+};
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/** 读完一个应答：头部以空行结束，应答体长度由Content-Length给出，返回false表示连接出错 **/
+static bool read_response(int fd, char* buf, int size)
+{
+    int len = 0;
+    char* end = NULL;
+    while (!end)
+    {
+        if (len >= size - 1)            // 头部太长
+            return false;
+        ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+        if (n <= 0)
+            return false;
+        len += n;
+        buf[len] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    char* cl = strcasestr(buf, "\r\nContent-Length:");
+    long body = (cl && cl < end) ? atol(cl + 17) : 0;
+    long left = (end + 4 - buf) + body - len;   // 应答体剩下的部分直接丢弃
+    while (left > 0)
+    {
+        ssize_t n = recv(fd, buf, left < size ? left : size, 0);
+        if (n <= 0)
+            return false;
+        left -= n;
+    }
+    return left == 0;                   // 只发一个请求，不应该有多余的数据
+}
+
+static void* run(void* arg)
+{
+    client* c = (client*)arg;
+    int fd = socket(c->addr.ss_family, SOCK_STREAM, 0);
+    int on = 1;
+    if (c->addr.ss_family != AF_UNIX)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (struct sockaddr*)&c->addr, c->addr_len) < 0)
+    {
+        perror("connect");
+        c->failed = true;
+        return NULL;
+    }
+
+    static const int BUFFER_SIZE = 65536;
+    char* buf = new char[BUFFER_SIZE];
+    size_t req_len = strlen(c->request);
+    c->samples.reserve(c->count);
+    for (int i = 0; i < c->warmup + c->count; i++)
+    {
+        long start = now_ns();
+        if (send(fd, c->request, req_len, 0) != (ssize_t)req_len || !read_response(fd, buf, BUFFER_SIZE))
+        {
+            fprintf(stderr, "connection failed after %d requests\n", i);
+            c->failed = true;
+            break;
+        }
+        if (i >= c->warmup)
+            c->samples.push_back(now_ns() - start);
+    }
+    delete [] buf;
+    close(fd);
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-n requests] [-c connections] [-w warmup] ip port [path]\n", prog);
+    printf("       %s [-n requests] [-c connections] [-w warmup] unix:/path [path]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int count = 10000;
+    int conns = 1;
+    int warmup = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = atoi(optarg); break;
+            case 'c': conns = atoi(optarg); break;
+            case 'w': warmup = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    /** 本地socket的地址只占一个参数，没有端口 **/
+    bool local = (argc - optind >= 1) && strncmp(argv[optind], "unix:", 5) == 0;
+    int nargs = local ? 1 : 2;
+    if (argc - optind < nargs || count <= 0 || conns <= 0 || warmup < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* path = (argc - optind > nargs) ? argv[optind + nargs] : "/index.html";
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (local)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+        un->sun_family = AF_UNIX;
+        snprintf(un->sun_path, sizeof(un->sun_path), "%s", argv[optind] + 5);
+        addr_len = sizeof(*un);
+    }
+    else if (strchr(argv[optind], ':'))
+    {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(atoi(argv[optind + 1]));
+        addr_len = sizeof(*in6);
+        if (inet_pton(AF_INET6, argv[optind], &in6->sin6_addr) != 1)
+        {
+            printf("invalid address: %s\n", argv[optind]);
+            return 1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(atoi(argv[optind + 1]));
+        addr_len = sizeof(*in);
+        if (inet_pton(AF_INET, argv[optind], &in->sin_addr) != 1)
+        {
+            printf("invalid address: %s\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    char request[1024];
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+             path, local ? "localhost" : argv[optind]);
+
+    std::vector<client> clients(conns);
+    for (int i = 0; i < conns; i++)
+    {
+        client& c = clients[i];
+        c.addr = addr;
+        c.addr_len = addr_len;
+        c.request = request;
+        c.count = count;
+        c.warmup = warmup;
+        c.failed = false;
+    }
+
+    long start = now_ns();
+    for (int i = 0; i < conns; i++)
+        pthread_create(&clients[i].tid, NULL, run, &clients[i]);
+    std::vector<long> all;
+    for (int i = 0; i < conns; i++)
+    {
+        pthread_join(clients[i].tid, NULL);
+        all.insert(all.end(), clients[i].samples.begin(), clients[i].samples.end());
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    if (all.empty())
+        return 1;
+
+    std::sort(all.begin(), all.end());
+    double sum = 0;
+    for (size_t i = 0; i < all.size(); i++)
+        sum += all[i];
+    /** 百分位数，单位微秒 **/
+    #define PCT(p) (all[std::min(all.size() - 1, (size_t)(all.size() * (p)))] / 1000.0)
+    printf("requests  %zu in %.2fs, %.0f req/s\n", all.size(), elapsed, (all.size() + (size_t)warmup * conns) / elapsed);
+    printf("latency   min %.1fus  avg %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  max %.1fus\n",
+           all.front() / 1000.0, sum / all.size() / 1000.0, PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), all.back() / 1000.0);
+
+    for (int i = 0; i < conns; i++)
+    {
+        if (clients[i].failed)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,651 @@
+/*
+*   回放录制的流量：my_replay [-s 倍速] [-t 超时] [-o 延迟文件] capture ip port
+*                或者 my_replay [选项] capture unix:/path
+*   读取服务器用 --capture 录制的文件（格式见 my_capture.h），每个录下的连接重新建一个连接，
+*   在原来的时间点（按倍速缩短）发出原来的字节，连接的并发与流水线保持原样：
+*   录制时依赖前面应答的数据，回放时也要收齐同样多的应答才发，所以倍速很高时退化为按原来的依赖关系尽快发送。
+*   单线程epoll驱动所有连接，统计每个请求从发完到收完应答的延迟分布与状态码，
+*   -o 把每个请求的延迟（微秒）逐行写到文件，用来比较两个版本：
+*
+*   g++ -std=c++20 -O2 tools/my_replay.cpp -o my_replay
+*   ./my_replay -s 2 capture.bin 127.0.0.1 8080
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include "../my_capture.h"
+
+/** 录下的一批数据：在会话字节流中的位置与发送条件 **/
+struct chunk
+{
+    uint64_t    time;
+    size_t      offset;
+    size_t      len;
+    uint32_t    answered;
+};
+
+/** 应答的解析状态 **/
+enum PARSE_STATE { HEAD = 0, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_TRAILER, UNTIL_CLOSE };
+
+struct session
+{
+    /** 录下的内容 **/
+    uint64_t                open_time;
+    uint64_t                close_time;
+    bool                    closed;
+    bool                    abandoned;
+    std::string             stream;
+    std::vector<chunk>      chunks;
+    /** 每个完整请求在字节流中的结束位置，以及是不是HEAD（应答没有应答体） **/
+    std::vector<size_t>     req_end;
+    std::vector<bool>       req_head;
+
+    /** 回放的状态 **/
+    int                     fd;
+    bool                    connected;
+    bool                    done;
+    size_t                  next_chunk;
+    /** 已经发出的字节数与已经发完的请求数 **/
+    size_t                  sent;
+    size_t                  reqs_sent;
+    std::vector<long>       req_sent_at;
+    size_t                  responses;
+    /** 最近一次收到数据或者发出请求的时间，用于超时 **/
+    long                    last_active;
+    std::string             in;
+    PARSE_STATE             state;
+    int                     status;
+    long long               body_left;
+};
+
+/** 统计结果 **/
+static std::vector<long> latencies;
+static long status_count[6];
+static long errors = 0;
+static size_t finished = 0;
+static long lag_sum = 0, lag_max = 0, lag_count = 0;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/** 读入录制文件，按连接整理成会话 **/
+static bool load(const char* path, std::vector<session>& sessions)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return false;
+    }
+    capture_header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, my_capture::MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != my_capture::VERSION || header.record_size != sizeof(capture_record))
+    {
+        printf("%s: not a capture file\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    std::map<uint32_t, size_t> index;
+    capture_record r;
+    while (fread(&r, sizeof(r), 1, fp) == 1)
+    {
+        if (r.type == my_capture::OPEN)
+        {
+            index[r.conn] = sessions.size();
+            sessions.emplace_back();
+            session& s = sessions.back();
+            s.open_time = s.close_time = r.time;
+            s.closed = s.abandoned = false;
+        }
+        std::map<uint32_t, size_t>::iterator it = index.find(r.conn);
+        if (r.type == my_capture::DATA)
+        {
+            std::string data(r.len, '\0');
+            if (r.len > 0 && fread(&data[0], r.len, 1, fp) != 1)
+                break;                      // 录制停止时最后一条可能不完整
+            if (it == index.end())
+                continue;
+            session& s = sessions[it->second];
+            chunk c = { r.time, s.stream.size(), r.len, r.answered };
+            s.chunks.push_back(c);
+            s.stream += data;
+        }
+        else if (it != index.end() && r.type == my_capture::CLOSE)
+        {
+            sessions[it->second].closed = true;
+            sessions[it->second].close_time = r.time;
+        }
+        else if (it != index.end() && r.type == my_capture::ABANDON)
+            sessions[it->second].abandoned = true;
+    }
+    fclose(fp);
+    return true;
+}
+
+/** 在头部[head, end)中找一个头部字段，返回值的开始，没有时返回NULL **/
+static const char* find_header(const char* head, const char* end, const char* name)
+{
+    size_t len = strlen(name);
+    for (const char* p = head; p && p < end; )
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol)
+            break;
+        if ((size_t)(eol - p) > len && strncasecmp(p, name, len) == 0 && p[len] == ':')
+        {
+            const char* v = p + len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t'))
+                v++;
+            return v;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+/** 找出字节流中每个完整请求的结束位置；带chunked请求体的会话不能可靠地切分，返回false **/
+static bool split_requests(session& s)
+{
+    const std::string& b = s.stream;
+    size_t pos = 0;
+    while (pos < b.size())
+    {
+        while (pos + 1 < b.size() && b[pos] == '\r' && b[pos + 1] == '\n')
+            pos += 2;                       // 请求之间多余的空行
+        size_t end = b.find("\r\n\r\n", pos);
+        if (end == std::string::npos)
+            break;
+        end += 4;
+        const char* head = b.data() + pos;
+        const char* head_end = b.data() + end;
+        const char* te = find_header(head, head_end, "Transfer-Encoding");
+        if (te && strncasecmp(te, "chunked", 7) == 0)
+            return false;
+        const char* cl = find_header(head, head_end, "Content-Length");
+        size_t body = cl ? strtoull(cl, NULL, 10) : 0;
+        if (end + body > b.size())
+            break;                          // 客户端没有发完这个请求就关闭了
+        s.req_end.push_back(end + body);
+        s.req_head.push_back(b.compare(pos, 5, "HEAD ") == 0);
+        pos = end + body;
+    }
+    return true;
+}
+
+static void finish(session& s, int epollfd, bool failed)
+{
+    if (s.fd != -1)
+    {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, s.fd, NULL);
+        close(s.fd);
+        s.fd = -1;
+    }
+    if (failed)
+        errors += s.req_end.size() - s.responses;   // 没有收到应答的请求都算出错
+    s.done = true;
+    finished++;
+}
+
+/** 收完一个应答 **/
+static void complete_response(session& s, int status)
+{
+    long now = now_ns();
+    if (s.responses < s.req_sent_at.size())
+        latencies.push_back(now - s.req_sent_at[s.responses]);
+    status_count[(status >= 100 && status < 600) ? status / 100 : 0]++;
+    s.responses++;
+    s.state = HEAD;
+}
+
+/** 解析收到的应答，返回false表示应答格式错误 **/
+static bool parse_responses(session& s)
+{
+    size_t pos = 0;
+    while (pos < s.in.size())
+    {
+        if (s.state == HEAD)
+        {
+            size_t end = s.in.find("\r\n\r\n", pos);
+            if (end == std::string::npos)
+                break;
+            end += 4;
+            const char* head = s.in.data() + pos;
+            const char* head_end = s.in.data() + end;
+            if (end - pos < 12 || strncmp(head, "HTTP/1.", 7) != 0)
+                return false;
+            s.status = atoi(head + 9);
+            pos = end;
+            if (s.status >= 100 && s.status < 200)
+                continue;                   // 100 Continue之类的临时应答，后面还有真正的应答
+            bool head_req = s.responses < s.req_head.size() && s.req_head[s.responses];
+            const char* te = find_header(head, head_end, "Transfer-Encoding");
+            const char* cl = find_header(head, head_end, "Content-Length");
+            if (head_req || s.status == 204 || s.status == 304)
+                complete_response(s, s.status);
+            else if (te && strncasecmp(te, "chunked", 7) == 0)
+                s.state = CHUNK_SIZE;
+            else if (cl)
+            {
+                s.body_left = strtoll(cl, NULL, 10);
+                s.state = BODY;
+                if (s.body_left == 0)
+                    complete_response(s, s.status);
+            }
+            else
+                s.state = UNTIL_CLOSE;      // 没有长度的应答体以关闭连接结束
+        }
+        else if (s.state == BODY || s.state == CHUNK_DATA)
+        {
+            long long n = std::min((long long)(s.in.size() - pos), s.body_left);
+            pos += n;
+            s.body_left -= n;
+            if (s.body_left > 0)
+                break;
+            if (s.state == BODY)
+                complete_response(s, s.status);
+            else
+                s.state = CHUNK_SIZE;
+        }
+        else if (s.state == CHUNK_SIZE || s.state == CHUNK_TRAILER)
+        {
+            size_t eol = s.in.find("\r\n", pos);
+            if (eol == std::string::npos)
+                break;
+            if (s.state == CHUNK_SIZE)
+            {
+                long long size = strtoll(s.in.c_str() + pos, NULL, 16);
+                if (size < 0)
+                    return false;
+                s.body_left = size + 2;     // 数据之后的CRLF
+                s.state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+            }
+            else if (eol == pos)
+                complete_response(s, s.status); // trailer以空行结束
+            pos = eol + 2;
+        }
+        else
+            pos = s.in.size();              // UNTIL_CLOSE：丢弃，关闭时算完成
+    }
+    s.in.erase(0, pos);
+    return true;
+}
+
+/** 尽量推进一个会话：收应答、发出已经到时间并且依赖已经满足的数据、结束 **/
+static void advance(session& s, int epollfd, long start, double speed, long& next_due)
+{
+    long now = now_ns();
+    if (s.done || !s.connected)             // 连接建立时epoll会报告可写
+        return;
+
+    /** 收应答 **/
+    char buf[65536];
+    while (1)
+    {
+        ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            s.in.append(buf, n);
+            s.last_active = now;
+            if (!parse_responses(s))
+            {
+                fprintf(stderr, "malformed response\n");
+                finish(s, epollfd, true);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        /** 服务器关闭了连接 **/
+        if (s.state == UNTIL_CLOSE)
+            complete_response(s, s.status);
+        finish(s, epollfd, s.responses < s.req_end.size());
+        return;
+    }
+
+    /** 发送：到了时间，并且已经收齐了这批数据依赖的应答 **/
+    while (s.next_chunk < s.chunks.size())
+    {
+        const chunk& c = s.chunks[s.next_chunk];
+        long due = start + (long)(c.time / speed);
+        if (s.sent == c.offset)             // 这批数据还没有开始发
+        {
+            if (now < due)
+            {
+                next_due = std::min(next_due, due);
+                break;
+            }
+            if (s.responses < c.answered)
+                break;                      // 收到应答时再来
+            long lag = now - due;
+            lag_sum += lag;
+            lag_max = std::max(lag_max, lag);
+            lag_count++;
+        }
+        ssize_t n = send(s.fd, s.stream.data() + s.sent, c.offset + c.len - s.sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;                      // 等EPOLLOUT
+            finish(s, epollfd, true);
+            return;
+        }
+        s.sent += n;
+        s.last_active = now;
+        while (s.reqs_sent < s.req_end.size() && s.req_end[s.reqs_sent] <= s.sent)
+        {
+            s.req_sent_at.push_back(now);
+            s.reqs_sent++;
+        }
+        if (s.sent == c.offset + c.len)
+            s.next_chunk++;
+    }
+
+    /** 全部发完、应答收齐之后，在原来关闭的时间关闭，保持原来的并发连接数 **/
+    if (s.next_chunk == s.chunks.size() && s.responses >= s.req_end.size())
+    {
+        long due = start + (long)(s.close_time / speed);
+        if (now < due)
+            next_due = std::min(next_due, due);
+        else
+            finish(s, epollfd, false);
+    }
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-s speed] [-t timeout_sec] [-o latency_file] capture ip port\n", prog);
+    printf("       %s [-s speed] [-t timeout_sec] [-o latency_file] capture unix:/path\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    double speed = 1.0;
+    int timeout = 10;
+    const char* out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': speed = atof(optarg); break;
+            case 't': timeout = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    /** 本地socket的地址只占一个参数，没有端口 **/
+    bool local = (argc - optind >= 2) && strncmp(argv[optind + 1], "unix:", 5) == 0;
+    int nargs = local ? 2 : 3;
+    if (argc - optind < nargs || speed <= 0 || timeout <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* host = argv[optind + 1];
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (local)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+        un->sun_family = AF_UNIX;
+        snprintf(un->sun_path, sizeof(un->sun_path), "%s", host + 5);
+        addr_len = sizeof(*un);
+    }
+    else if (strchr(host, ':'))
+    {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(atoi(argv[optind + 2]));
+        addr_len = sizeof(*in6);
+        if (inet_pton(AF_INET6, host, &in6->sin6_addr) != 1)
+        {
+            printf("invalid address: %s\n", host);
+            return 1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(atoi(argv[optind + 2]));
+        addr_len = sizeof(*in);
+        if (inet_pton(AF_INET, host, &in->sin_addr) != 1)
+        {
+            printf("invalid address: %s\n", host);
+            return 1;
+        }
+    }
+
+    std::vector<session> all;
+    if (!load(argv[optind], all))
+        return 1;
+    /** 放弃的会话（HTTP/2、WebSocket、流式上传……）与录制停止时还没有关闭的会话不回放 **/
+    std::vector<session> sessions;
+    long skipped = 0;
+    uint64_t first = UINT64_MAX;
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        session& s = all[i];
+        if (s.abandoned || !s.closed || !split_requests(s))
+        {
+            skipped++;
+            continue;
+        }
+        first = std::min(first, s.open_time);
+        sessions.push_back(std::move(s));
+    }
+    all.clear();
+    if (sessions.empty())
+    {
+        printf("no sessions to replay (%ld skipped)\n", skipped);
+        return 1;
+    }
+    size_t total_requests = 0;
+    uint64_t last = 0;
+    for (size_t i = 0; i < sessions.size(); i++)
+    {
+        session& s = sessions[i];
+        /** 从第一个会话开始计时 **/
+        for (size_t j = 0; j < s.chunks.size(); j++)
+            s.chunks[j].time -= first;
+        s.open_time -= first;
+        s.close_time -= first;
+        last = std::max(last, s.close_time);
+        s.fd = -1;
+        s.connected = s.done = false;
+        s.next_chunk = s.sent = s.reqs_sent = s.responses = 0;
+        s.state = HEAD;
+        s.status = 0;
+        s.body_left = 0;
+        total_requests += s.req_end.size();
+    }
+    printf("replaying %zu sessions, %zu requests, %.2fs captured (%ld sessions skipped) at %.2fx\n",
+           sessions.size(), total_requests, last / 1e9, skipped, speed);
+
+    /** 并发连接数可能很多 **/
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    int epollfd = epoll_create1(0);
+    /** epoll_wait的超时只到毫秒，到期时间用timerfd精确到微秒 **/
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.u64 = UINT64_MAX;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &tev);
+    /** 会话按打开时间排序，依次在各自的时间建立连接 **/
+    std::vector<size_t> order(sessions.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sessions[a].open_time < sessions[b].open_time; });
+    /** 等待时间到达的会话：(到期时间, 会话) 的小顶堆 **/
+    typedef std::pair<long, size_t> due_item;
+    std::priority_queue<due_item, std::vector<due_item>, std::greater<due_item> > due;
+
+    long start = now_ns();
+    size_t next_open = 0;
+    long last_check = start;
+    epoll_event events[256];
+    while (finished < sessions.size())
+    {
+        long now = now_ns();
+        /** 到时间的会话建立连接 **/
+        while (next_open < order.size() && start + (long)(sessions[order[next_open]].open_time / speed) <= now)
+        {
+            session& s = sessions[order[next_open++]];
+            s.fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            int on = 1;
+            if (addr.ss_family != AF_UNIX)
+                setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            s.last_active = now;
+            int ret = s.fd < 0 ? -1 : connect(s.fd, (struct sockaddr*)&addr, addr_len);
+            if (ret < 0 && (s.fd < 0 || errno != EINPROGRESS))
+            {
+                perror("connect");
+                finish(s, epollfd, true);
+                continue;
+            }
+            s.connected = (ret == 0);       // 本地socket一般立即连上
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.u64 = &s - &sessions[0];
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, s.fd, &ev);
+        }
+        /** 到时间的会话继续发送或者关闭 **/
+        while (!due.empty() && due.top().first <= now)
+        {
+            session& s = sessions[due.top().second];
+            due.pop();
+            long next_due = LONG_MAX;
+            advance(s, epollfd, start, speed, next_due);
+            if (next_due != LONG_MAX)
+                due.push(due_item(next_due, &s - &sessions[0]));
+        }
+        /** 超时：太久没有收到应答的会话 **/
+        if (now - last_check > 100000000L)
+        {
+            last_check = now;
+            for (size_t i = 0; i < next_open; i++)
+            {
+                session& s = sessions[order[i]];
+                if (s.done || now - s.last_active <= timeout * 1000000000L)
+                    continue;
+                /** 在等应答：已经发出的请求没有应答，或者下一批数据到了时间还在等应答 **/
+                const chunk* c = s.next_chunk < s.chunks.size() ? &s.chunks[s.next_chunk] : NULL;
+                if (s.responses < s.reqs_sent || !s.connected ||
+                    (c && s.responses < c->answered && start + (long)(c->time / speed) < now - timeout * 1000000000L))
+                {
+                    fprintf(stderr, "session timed out waiting for a response\n");
+                    finish(s, epollfd, true);
+                }
+            }
+        }
+        if (finished == sessions.size())
+            break;
+
+        /** 等到下一个连接、下一批数据的时间，或者socket事件 **/
+        long wake = now + 100000000L;
+        if (next_open < order.size())
+            wake = std::min(wake, start + (long)(sessions[order[next_open]].open_time / speed));
+        if (!due.empty())
+            wake = std::min(wake, due.top().first);
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = wake / 1000000000L;
+        its.it_value.tv_nsec = wake % 1000000000L;
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+        int number = epoll_wait(epollfd, events, 256, -1);
+        for (int i = 0; i < number; i++)
+        {
+            if (events[i].data.u64 == UINT64_MAX)
+            {
+                uint64_t expired;
+                if (read(timerfd, &expired, sizeof(expired)) < 0) { }
+                continue;
+            }
+            size_t idx = events[i].data.u64;
+            session& s = sessions[idx];
+            if (!s.connected && !s.done)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0)
+                {
+                    fprintf(stderr, "connect: %s\n", strerror(err));
+                    finish(s, epollfd, true);
+                    continue;
+                }
+                s.connected = (events[i].events & EPOLLOUT) != 0;
+            }
+            long next_due = LONG_MAX;
+            advance(sessions[idx], epollfd, start, speed, next_due);
+            if (next_due != LONG_MAX)
+                due.push(due_item(next_due, idx));
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("requests  %zu responses, %ld errors in %.2fs, %.0f req/s\n", latencies.size(), errors, elapsed, latencies.size() / elapsed);
+    printf("status    1xx %ld  2xx %ld  3xx %ld  4xx %ld  5xx %ld\n",
+           status_count[1], status_count[2], status_count[3], status_count[4], status_count[5]);
+    if (lag_count > 0)
+        printf("schedule  avg lag %.1fus  max lag %.1fus\n", lag_sum / (double)lag_count / 1000.0, lag_max / 1000.0);
+    if (latencies.empty())
+        return 1;
+
+    if (out_path)
+    {
+        FILE* fp = fopen(out_path, "w");
+        if (!fp)
+            perror(out_path);
+        else
+        {
+            for (size_t i = 0; i < latencies.size(); i++)
+                fprintf(fp, "%.1f\n", latencies[i] / 1000.0);
+            fclose(fp);
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+        sum += latencies[i];
+    /** 百分位数，单位微秒 **/
+    #define PCT(p) (latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * (p)))] / 1000.0)
+    printf("latency   min %.1fus  avg %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  max %.1fus\n",
+           latencies.front() / 1000.0, sum / latencies.size() / 1000.0, PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), latencies.back() / 1000.0);
+    return errors > 0 ? 1 : 0;
+}